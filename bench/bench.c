@@ -0,0 +1,368 @@
+/*
+ * Throughput and latency benchmarks for OMcache
+ *
+ * Runs omcache_set, omcache_get and omcache_get_multi against in-process
+ * fake memcached servers (or real servers given with -S) over a matrix of
+ * server counts, value sizes and batch sizes and reports operations per
+ * second and p50, p99 and p99.9 latencies of individual calls.  The route
+ * operation measures omcache_server_index_for_key alone.
+ *
+ * Copyright (c) 2014, Oskari Saarenmaa <os@ohmu.fi>
+ * All rights reserved.
+ *
+ * This file is under the Apache License, Version 2.0.
+ * See the file `LICENSE` for details.
+ *
+ */
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "compat.h"
+
+#define OB_TIMEOUT_MSEC 5000
+#define OB_ROUTE_BATCH 64
+
+typedef struct ob_config_s {
+  const char *servers;
+  int io_backend;
+  omcache_dist_t *dist_method;
+  size_t ops;
+  size_t key_count;
+  size_t server_counts[16], server_counts_n;
+  size_t value_sizes[16], value_sizes_n;
+  size_t batch_sizes[16], batch_sizes_n;
+  bool run_set, run_get, run_get_multi, run_route;
+} ob_config_t;
+
+typedef struct ob_keys_s {
+  size_t count;
+  unsigned char **keys;
+  size_t *key_lens;
+} ob_keys_t;
+
+static int ob_cmp_int64(const void *a, const void *b)
+{
+  int64_t x = *(const int64_t *) a, y = *(const int64_t *) b;
+  return (x > y) - (x < y);
+}
+
+static void ob_report(const char *op, size_t servers, size_t value_size,
+                      size_t batch_size, size_t keys, int64_t elapsed_ns,
+                      int64_t *lat, size_t lat_count, size_t errors)
+{
+  qsort(lat, lat_count, sizeof(*lat), ob_cmp_int64);
+  printf("%-10s %7zu %7zu %6zu %12.0f %9.1f %9.1f %9.1f %7zu\n",
+         op, servers, value_size, batch_size,
+         keys * 1e9 / elapsed_ns,
+         lat[lat_count * 50 / 100] / 1e3,
+         lat[lat_count * 99 / 100] / 1e3,
+         lat[lat_count * 999 / 1000] / 1e3,
+         errors);
+  fflush(stdout);
+}
+
+static void ob_bench_set(omcache_t *mc, ob_keys_t *keys, size_t ops,
+                         const unsigned char *value, size_t value_size,
+                         size_t servers, int64_t *lat)
+{
+  size_t errors = 0;
+  int64_t start = ob_nsec();
+  for (size_t i = 0; i < ops; i ++)
+    {
+      size_t k = i % keys->count;
+      int64_t t = ob_nsec();
+      int ret = omcache_set(mc, keys->keys[k], keys->key_lens[k],
+                            value, value_size, 0, 0, 0, OB_TIMEOUT_MSEC);
+      lat[i] = ob_nsec() - t;
+      errors += ret != OMCACHE_OK;
+    }
+  ob_report("set", servers, value_size, 1, ops, ob_nsec() - start, lat, ops, errors);
+}
+
+static void ob_bench_get(omcache_t *mc, ob_keys_t *keys, size_t ops,
+                         size_t value_size, size_t servers, int64_t *lat)
+{
+  size_t errors = 0;
+  int64_t start = ob_nsec();
+  for (size_t i = 0; i < ops; i ++)
+    {
+      size_t k = i % keys->count, val_len = 0;
+      const unsigned char *val;
+      int64_t t = ob_nsec();
+      int ret = omcache_get(mc, keys->keys[k], keys->key_lens[k],
+                            &val, &val_len, NULL, NULL, OB_TIMEOUT_MSEC);
+      lat[i] = ob_nsec() - t;
+      errors += ret != OMCACHE_OK || val_len != value_size;
+    }
+  ob_report("get", servers, value_size, 1, ops, ob_nsec() - start, lat, ops, errors);
+}
+
+static void ob_bench_get_multi(omcache_t *mc, ob_keys_t *keys, size_t ops,
+                               size_t batch_size, size_t value_size,
+                               size_t servers, int64_t *lat)
+{
+  omcache_req_t *reqs = calloc(batch_size, sizeof(*reqs));
+  omcache_value_t *values = calloc(batch_size, sizeof(*values));
+  size_t calls = max(ops / batch_size, (size_t) 1), errors = 0;
+  int64_t start = ob_nsec();
+  for (size_t i = 0; i < calls; i ++)
+    {
+      size_t k = (i * batch_size) % keys->count;
+      size_t n = min(batch_size, keys->count - k);
+      size_t req_count = n, value_count = n, found;
+      int64_t t = ob_nsec();
+      int ret = omcache_get_multi(mc, (const unsigned char **) keys->keys + k,
+                                  keys->key_lens + k, n, reqs, &req_count,
+                                  values, &value_count, OB_TIMEOUT_MSEC);
+      found = value_count;
+      while (req_count > 0 && (ret == OMCACHE_OK || ret == OMCACHE_AGAIN))
+        {
+          value_count = batch_size;
+          ret = omcache_io(mc, reqs, &req_count, values, &value_count, OB_TIMEOUT_MSEC);
+          found += value_count;
+        }
+      lat[i] = ob_nsec() - t;
+      errors += n - min(found, n);
+    }
+  ob_report("get_multi", servers, value_size, batch_size, calls * batch_size,
+            ob_nsec() - start, lat, calls, errors);
+  free(reqs);
+  free(values);
+}
+
+// key routing is too fast to time one call at a time, the latencies are
+// averages over batches of OB_ROUTE_BATCH keys
+static void ob_bench_route(omcache_t *mc, ob_keys_t *keys, size_t ops,
+                           size_t servers, int64_t *lat)
+{
+  size_t calls = max(ops / OB_ROUTE_BATCH, (size_t) 1), errors = 0;
+  int64_t start = ob_nsec();
+  for (size_t i = 0; i < calls; i ++)
+    {
+      int64_t t = ob_nsec();
+      for (size_t j = 0; j < OB_ROUTE_BATCH; j ++)
+        {
+          size_t k = (i * OB_ROUTE_BATCH + j) % keys->count;
+          errors += omcache_server_index_for_key(mc, keys->keys[k], keys->key_lens[k]) < 0;
+        }
+      lat[i] = (ob_nsec() - t) / OB_ROUTE_BATCH;
+    }
+  ob_report("route", servers, 0, 1, calls * OB_ROUTE_BATCH,
+            ob_nsec() - start, lat, calls, errors);
+}
+
+static void ob_run(ob_config_t *cfg, const char *servers, size_t server_count,
+                   ob_keys_t *keys, int64_t *lat)
+{
+  omcache_t *mc = omcache_init();
+  omcache_set_servers(mc, servers);
+  omcache_set_distribution_method(mc, cfg->dist_method);
+  if (cfg->io_backend >= 0 && omcache_set_io_backend(mc, cfg->io_backend) != OMCACHE_OK)
+    {
+      fprintf(stderr, "I/O backend %d is not available\n", cfg->io_backend);
+      exit(1);
+    }
+
+  if (cfg->run_route)
+    ob_bench_route(mc, keys, cfg->ops, server_count, lat);
+  for (size_t v = 0; (cfg->run_set || cfg->run_get || cfg->run_get_multi) && v < cfg->value_sizes_n; v ++)
+    {
+      size_t value_size = cfg->value_sizes[v];
+      unsigned char *value = malloc(value_size + 1);
+      memset(value, 'x', value_size);
+
+      // populate all keys so that the lookups below always hit
+      for (size_t i = 0; i < keys->count; i ++)
+        omcache_set(mc, keys->keys[i], keys->key_lens[i], value, value_size,
+                    0, 0, 0, OB_TIMEOUT_MSEC);
+
+      if (cfg->run_set)
+        ob_bench_set(mc, keys, cfg->ops, value, value_size, server_count, lat);
+      if (cfg->run_get)
+        ob_bench_get(mc, keys, cfg->ops, value_size, server_count, lat);
+      if (cfg->run_get_multi)
+        for (size_t b = 0; b < cfg->batch_sizes_n; b ++)
+          ob_bench_get_multi(mc, keys, cfg->ops, cfg->batch_sizes[b],
+                             value_size, server_count, lat);
+      free(value);
+    }
+  omcache_free(mc);
+}
+
+static size_t ob_parse_list(const char *arg, size_t *vals, size_t max_vals)
+{
+  size_t n = 0;
+  char *end;
+  while (n < max_vals && *arg)
+    {
+      vals[n] = strtoul(arg, &end, 10);
+      if (end == arg || vals[n] == 0)
+        return 0;
+      n ++;
+      arg = (*end == ',') ? end + 1 : end;
+      if (*end && *end != ',')
+        return 0;
+    }
+  return n;
+}
+
+static void ob_usage(const char *prog)
+{
+  fprintf(stderr,
+    "usage: %s [options]\n"
+    "  -o OPS       comma separated operations to run: set,get,get_multi,route\n"
+    "  -s COUNTS    comma separated fake server counts (default 1,4)\n"
+    "  -v SIZES     comma separated value sizes (default 16,1024,16384)\n"
+    "  -b SIZES     comma separated get_multi batch sizes (default 1,16,128)\n"
+    "  -n OPS       number of keys operated on per test (default 20000)\n"
+    "  -k KEYS      number of distinct keys (default 10000)\n"
+    "  -i BACKEND   I/O backend: poll, epoll or uring\n"
+    "  -d METHOD    distribution method: ketama, ketama_xxh3, ketama_murmur3,\n"
+    "               ketama_crc32c, jump, maglev or rendezvous\n"
+    "  -S SERVERS   use the given memcached servers instead of fake ones\n",
+    prog);
+  exit(1);
+}
+
+int main(int argc, char **argv)
+{
+  ob_config_t cfg = {
+    .io_backend = -1,
+    .dist_method = &omcache_dist_libmemcached_ketama,
+    .ops = 20000,
+    .key_count = 10000,
+    .server_counts = {1, 4}, .server_counts_n = 2,
+    .value_sizes = {16, 1024, 16384}, .value_sizes_n = 3,
+    .batch_sizes = {1, 16, 128}, .batch_sizes_n = 3,
+    .run_set = true, .run_get = true, .run_get_multi = true,
+  };
+  int opt;
+
+  while ((opt = getopt(argc, argv, "o:s:v:b:n:k:i:d:S:h")) != -1)
+    {
+      switch (opt)
+        {
+        case 'o':
+          cfg.run_set = cfg.run_get = cfg.run_get_multi = cfg.run_route = false;
+          for (char *op = strtok(optarg, ","); op; op = strtok(NULL, ","))
+            {
+              if (strcmp(op, "set") == 0)
+                cfg.run_set = true;
+              else if (strcmp(op, "get") == 0)
+                cfg.run_get = true;
+              else if (strcmp(op, "get_multi") == 0)
+                cfg.run_get_multi = true;
+              else if (strcmp(op, "route") == 0)
+                cfg.run_route = true;
+              else
+                ob_usage(argv[0]);
+            }
+          break;
+        case 's':
+          if ((cfg.server_counts_n = ob_parse_list(optarg, cfg.server_counts, 16)) == 0)
+            ob_usage(argv[0]);
+          break;
+        case 'v':
+          if ((cfg.value_sizes_n = ob_parse_list(optarg, cfg.value_sizes, 16)) == 0)
+            ob_usage(argv[0]);
+          break;
+        case 'b':
+          if ((cfg.batch_sizes_n = ob_parse_list(optarg, cfg.batch_sizes, 16)) == 0)
+            ob_usage(argv[0]);
+          break;
+        case 'n':
+          if (ob_parse_list(optarg, &cfg.ops, 1) != 1)
+            ob_usage(argv[0]);
+          break;
+        case 'k':
+          if (ob_parse_list(optarg, &cfg.key_count, 1) != 1)
+            ob_usage(argv[0]);
+          break;
+        case 'i':
+          if (strcmp(optarg, "poll") == 0)
+            cfg.io_backend = OMCACHE_IO_POLL;
+          else if (strcmp(optarg, "epoll") == 0)
+            cfg.io_backend = OMCACHE_IO_EPOLL;
+          else if (strcmp(optarg, "uring") == 0)
+            cfg.io_backend = OMCACHE_IO_URING;
+          else
+            ob_usage(argv[0]);
+          break;
+        case 'd':
+          if (strcmp(optarg, "ketama") == 0)
+            cfg.dist_method = &omcache_dist_libmemcached_ketama;
+          else if (strcmp(optarg, "ketama_xxh3") == 0)
+            cfg.dist_method = &omcache_dist_ketama_xxh3;
+          else if (strcmp(optarg, "ketama_murmur3") == 0)
+            cfg.dist_method = &omcache_dist_ketama_murmur3;
+          else if (strcmp(optarg, "ketama_crc32c") == 0)
+            cfg.dist_method = &omcache_dist_ketama_crc32c;
+          else if (strcmp(optarg, "jump") == 0)
+            cfg.dist_method = &omcache_dist_jump_hash;
+          else if (strcmp(optarg, "maglev") == 0)
+            cfg.dist_method = &omcache_dist_maglev;
+          else if (strcmp(optarg, "rendezvous") == 0)
+            cfg.dist_method = &omcache_dist_rendezvous;
+          else
+            ob_usage(argv[0]);
+          break;
+        case 'S':
+          cfg.servers = optarg;
+          break;
+        default:
+          ob_usage(argv[0]);
+        }
+    }
+
+  ob_keys_t keys = {
+    .count = cfg.key_count,
+    .keys = calloc(cfg.key_count, sizeof(unsigned char *)),
+    .key_lens = calloc(cfg.key_count, sizeof(size_t)),
+  };
+  for (size_t i = 0; i < keys.count; i ++)
+    keys.key_lens[i] = asprintf((char **) &keys.keys[i], "omcache_bench_%08zu", i);
+  int64_t *lat = calloc(cfg.ops, sizeof(int64_t));
+
+  printf("%-10s %7s %7s %6s %12s %9s %9s %9s %7s\n", "op", "servers",
+         "value", "batch", "keys/s", "p50 us", "p99 us", "p999 us", "errors");
+
+  if (cfg.servers)
+    {
+      size_t server_count = 1;
+      for (const char *p = cfg.servers; *p; p ++)
+        server_count += *p == ',';
+      ob_run(&cfg, cfg.servers, server_count, &keys, lat);
+    }
+  for (size_t s = 0; cfg.servers == NULL && s < cfg.server_counts_n; s ++)
+    {
+      size_t server_count = cfg.server_counts[s];
+      ob_server_t **srvs = calloc(server_count, sizeof(*srvs));
+      char *srvstr = calloc(server_count, 32), *p = srvstr;
+      for (size_t i = 0; i < server_count; i ++)
+        {
+          srvs[i] = ob_server_start();
+          if (srvs[i] == NULL)
+            {
+              perror("ob_server_start");
+              return 1;
+            }
+          p += sprintf(p, "%s127.0.0.1:%d", i ? "," : "", ob_server_port(srvs[i]));
+        }
+      ob_run(&cfg, srvstr, server_count, &keys, lat);
+      for (size_t i = 0; i < server_count; i ++)
+        ob_server_stop(srvs[i]);
+      free(srvs);
+      free(srvstr);
+    }
+
+  for (size_t i = 0; i < keys.count; i ++)
+    free(keys.keys[i]);
+  free(keys.keys);
+  free(keys.key_lens);
+  free(lat);
+  return 0;
+}
@@ -0,0 +1,44 @@
+/*
+ * Benchmarks for OMcache
+ *
+ * Copyright (c) 2014, Oskari Saarenmaa <os@ohmu.fi>
+ * All rights reserved.
+ *
+ * This file is under the Apache License, Version 2.0.
+ * See the file `LICENSE` for details.
+ *
+ */
+
+#ifndef _OMCACHE_BENCH_H
+#define _OMCACHE_BENCH_H 1
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "omcache.h"
+
+typedef struct ob_server_s ob_server_t;
+
+/**
+ * Start an in-process fake memcached speaking the binary protocol on a
+ * random loopback port.  Every connection is served by its own thread.
+ * @return Handle to the server or NULL on failure.
+ */
+ob_server_t *ob_server_start(void);
+
+/**
+ * Stop a fake memcached started with ob_server_start and free its data.
+ */
+void ob_server_stop(ob_server_t *srv);
+
+/**
+ * @return The TCP port the fake memcached is listening on.
+ */
+int ob_server_port(ob_server_t *srv);
+
+/**
+ * @return Current monotonic time in nanoseconds.
+ */
+int64_t ob_nsec(void);
+
+#endif // !_OMCACHE_BENCH_H
@@ -0,0 +1,421 @@
+/*
+ * In-process fake memcached for OMcache benchmarks
+ *
+ * Implements just enough of the memcached binary protocol to serve the
+ * requests OMcache sends during benchmarks: GET(K)(Q), SET(Q), DELETE(Q),
+ * NOOP, VERSION and FLUSH.  Objects are kept in a mutex protected hash
+ * table, expiration times are ignored.
+ *
+ * Copyright (c) 2014, Oskari Saarenmaa <os@ohmu.fi>
+ * All rights reserved.
+ *
+ * This file is under the Apache License, Version 2.0.
+ * See the file `LICENSE` for details.
+ *
+ */
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "compat.h"
+#include "memcached_protocol_binary.h"
+
+#define OB_BUCKETS 65536
+#define OB_HDR_SIZE sizeof(protocol_binary_request_header)
+
+typedef struct ob_item_s {
+  struct ob_item_s *next;
+  uint32_t flags;
+  uint64_t cas;
+  size_t key_len;
+  size_t data_len;
+  unsigned char buf[];  // key followed by data
+} ob_item_t;
+
+typedef struct ob_conn_s {
+  struct ob_conn_s *next;
+  ob_server_t *srv;
+  pthread_t thread;
+  int fd;
+} ob_conn_t;
+
+typedef struct ob_buf_s {
+  unsigned char *base;
+  size_t len;
+  size_t size;
+} ob_buf_t;
+
+struct ob_server_s {
+  int fd;
+  int port;
+  volatile bool stopping;
+  pthread_t accept_thread;
+  pthread_mutex_t lock;
+  ob_conn_t *conns;
+  uint64_t cas;
+  ob_item_t *buckets[OB_BUCKETS];
+};
+
+int64_t ob_nsec(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static uint32_t ob_key_hash(const unsigned char *key, size_t key_len)
+{
+  // FNV-1a
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < key_len; i ++)
+    h = (h ^ key[i]) * 16777619u;
+  return h;
+}
+
+static ob_item_t **ob_item_find(ob_server_t *srv, const unsigned char *key, size_t key_len)
+{
+  ob_item_t **itp = &srv->buckets[ob_key_hash(key, key_len) % OB_BUCKETS];
+  for (; *itp; itp = &(*itp)->next)
+    if ((*itp)->key_len == key_len && memcmp((*itp)->buf, key, key_len) == 0)
+      break;
+  return itp;
+}
+
+static void ob_flush(ob_server_t *srv)
+{
+  for (size_t i = 0; i < OB_BUCKETS; i ++)
+    {
+      while (srv->buckets[i])
+        {
+          ob_item_t *it = srv->buckets[i];
+          srv->buckets[i] = it->next;
+          free(it);
+        }
+    }
+}
+
+static unsigned char *ob_buf_reserve(ob_buf_t *buf, size_t len)
+{
+  if (buf->len + len > buf->size)
+    {
+      size_t size = max(buf->size * 2, buf->len + len);
+      unsigned char *base = realloc(buf->base, size);
+      if (base == NULL)
+        return NULL;
+      buf->base = base;
+      buf->size = size;
+    }
+  unsigned char *p = buf->base + buf->len;
+  buf->len += len;
+  return p;
+}
+
+static void ob_respond(ob_buf_t *out, const protocol_binary_request_header *req,
+                       uint16_t status, uint64_t cas,
+                       const void *extra, size_t extra_len,
+                       const void *key, size_t key_len,
+                       const void *data, size_t data_len)
+{
+  size_t body_len = extra_len + key_len + data_len;
+  unsigned char *p = ob_buf_reserve(out, OB_HDR_SIZE + body_len);
+  if (p == NULL)
+    return;
+  protocol_binary_response_header *hdr = (protocol_binary_response_header *) p;
+  hdr->response.magic = PROTOCOL_BINARY_RES;
+  hdr->response.opcode = req->request.opcode;
+  hdr->response.keylen = htobe16(key_len);
+  hdr->response.extlen = extra_len;
+  hdr->response.datatype = PROTOCOL_BINARY_RAW_BYTES;
+  hdr->response.status = htobe16(status);
+  hdr->response.bodylen = htobe32(body_len);
+  hdr->response.opaque = req->request.opaque;
+  hdr->response.cas = htobe64(cas);
+  p += OB_HDR_SIZE;
+  if (extra_len)
+    memcpy(p, extra, extra_len);
+  if (key_len)
+    memcpy(p + extra_len, key, key_len);
+  if (data_len)
+    memcpy(p + extra_len + key_len, data, data_len);
+}
+
+static void ob_handle_request(ob_server_t *srv, ob_buf_t *out,
+                              const protocol_binary_request_header *req,
+                              const unsigned char *body)
+{
+  size_t extra_len = req->request.extlen;
+  size_t key_len = be16toh(req->request.keylen);
+  size_t data_len = be32toh(req->request.bodylen) - extra_len - key_len;
+  const unsigned char *key = body + extra_len, *data = key + key_len;
+  uint8_t opcode = req->request.opcode;
+  bool quiet = false, with_key = false;
+  uint32_t flags;
+  uint64_t cas;
+  ob_item_t *it, **itp;
+
+  switch (opcode)
+    {
+    case PROTOCOL_BINARY_CMD_GETKQ:
+      with_key = true;
+      // fall through
+    case PROTOCOL_BINARY_CMD_GETQ:
+      quiet = true;
+      // fall through
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETK:
+      with_key = with_key || opcode == PROTOCOL_BINARY_CMD_GETK;
+      pthread_mutex_lock(&srv->lock);
+      it = *ob_item_find(srv, key, key_len);
+      if (it != NULL)
+        {
+          flags = htobe32(it->flags);
+          ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_SUCCESS, it->cas,
+                     &flags, sizeof(flags), key, with_key ? key_len : 0,
+                     it->buf + it->key_len, it->data_len);
+        }
+      pthread_mutex_unlock(&srv->lock);
+      if (it == NULL && !quiet)
+        ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0,
+                   NULL, 0, key, with_key ? key_len : 0, NULL, 0);
+      break;
+
+    case PROTOCOL_BINARY_CMD_SETQ:
+      quiet = true;
+      // fall through
+    case PROTOCOL_BINARY_CMD_SET:
+      if (extra_len != 8 || key_len == 0)
+        {
+          ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_EINVAL, 0, NULL, 0, NULL, 0, NULL, 0);
+          break;
+        }
+      it = malloc(sizeof(*it) + key_len + data_len);
+      if (it == NULL)
+        {
+          ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_ENOMEM, 0, NULL, 0, NULL, 0, NULL, 0);
+          break;
+        }
+      memcpy(&flags, body, sizeof(flags));
+      it->flags = be32toh(flags);
+      it->key_len = key_len;
+      it->data_len = data_len;
+      memcpy(it->buf, key, key_len);
+      memcpy(it->buf + key_len, data, data_len);
+      pthread_mutex_lock(&srv->lock);
+      itp = ob_item_find(srv, key, key_len);
+      it->cas = cas = ++ srv->cas;
+      it->next = *itp ? (*itp)->next : NULL;
+      free(*itp);
+      *itp = it;
+      pthread_mutex_unlock(&srv->lock);
+      if (!quiet)
+        ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_SUCCESS, cas, NULL, 0, NULL, 0, NULL, 0);
+      break;
+
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+      quiet = true;
+      // fall through
+    case PROTOCOL_BINARY_CMD_DELETE:
+      pthread_mutex_lock(&srv->lock);
+      itp = ob_item_find(srv, key, key_len);
+      it = *itp;
+      if (it != NULL)
+        *itp = it->next;
+      pthread_mutex_unlock(&srv->lock);
+      if (it == NULL)
+        ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_KEY_ENOENT, 0, NULL, 0, NULL, 0, NULL, 0);
+      else if (!quiet)
+        ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, NULL, 0, NULL, 0, NULL, 0);
+      free(it);
+      break;
+
+    case PROTOCOL_BINARY_CMD_FLUSH:
+      pthread_mutex_lock(&srv->lock);
+      ob_flush(srv);
+      pthread_mutex_unlock(&srv->lock);
+      ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, NULL, 0, NULL, 0, NULL, 0);
+      break;
+
+    case PROTOCOL_BINARY_CMD_NOOP:
+      ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, NULL, 0, NULL, 0, NULL, 0);
+      break;
+
+    case PROTOCOL_BINARY_CMD_VERSION:
+      ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_SUCCESS, 0, NULL, 0, NULL, 0,
+                 "1.4.0-omcache-bench", sizeof("1.4.0-omcache-bench") - 1);
+      break;
+
+    default:
+      ob_respond(out, req, PROTOCOL_BINARY_RESPONSE_UNKNOWN_COMMAND, 0, NULL, 0, NULL, 0, NULL, 0);
+    }
+}
+
+static bool ob_write_all(int fd, ob_buf_t *out)
+{
+  size_t pos = 0;
+  while (pos < out->len)
+    {
+      ssize_t res = send(fd, out->base + pos, out->len - pos, MSG_NOSIGNAL);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        return false;
+      pos += res;
+    }
+  out->len = 0;
+  return true;
+}
+
+static void *ob_conn_thread(void *arg)
+{
+  ob_conn_t *conn = arg;
+  ob_buf_t in = {0}, out = {0};
+  size_t pos = 0;
+
+  for (;;)
+    {
+      if (ob_buf_reserve(&in, 65536) == NULL)
+        break;
+      in.len -= 65536;
+      ssize_t res = recv(conn->fd, in.base + in.len, 65536, 0);
+      if (res < 0 && errno == EINTR)
+        continue;
+      if (res <= 0)
+        break;
+      in.len += res;
+
+      // handle all complete requests in the buffer and send all responses
+      // with a single call
+      while (in.len - pos >= OB_HDR_SIZE)
+        {
+          protocol_binary_request_header req;
+          memcpy(&req, in.base + pos, OB_HDR_SIZE);
+          size_t req_len = OB_HDR_SIZE + be32toh(req.request.bodylen);
+          if (req.request.magic != PROTOCOL_BINARY_REQ)
+            goto done;
+          if (in.len - pos < req_len)
+            break;
+          ob_handle_request(conn->srv, &out, &req, in.base + pos + OB_HDR_SIZE);
+          pos += req_len;
+        }
+      if (out.len && !ob_write_all(conn->fd, &out))
+        break;
+      memmove(in.base, in.base + pos, in.len - pos);
+      in.len -= pos;
+      pos = 0;
+    }
+done:
+  shutdown(conn->fd, SHUT_RDWR);
+  free(in.base);
+  free(out.base);
+  return NULL;
+}
+
+static void *ob_accept_thread(void *arg)
+{
+  ob_server_t *srv = arg;
+  for (;;)
+    {
+      int fd = accept(srv->fd, NULL, NULL);
+      if (srv->stopping)
+        {
+          if (fd >= 0)
+            close(fd);
+          break;
+        }
+      if (fd < 0)
+        {
+          if (errno == EINTR || errno == ECONNABORTED)
+            continue;
+          break;
+        }
+      int one = 1;
+      setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+      ob_conn_t *conn = calloc(1, sizeof(*conn));
+      if (conn == NULL)
+        {
+          close(fd);
+          continue;
+        }
+      conn->srv = srv;
+      conn->fd = fd;
+      if (pthread_create(&conn->thread, NULL, ob_conn_thread, conn) != 0)
+        {
+          close(fd);
+          free(conn);
+          continue;
+        }
+      pthread_mutex_lock(&srv->lock);
+      conn->next = srv->conns;
+      srv->conns = conn;
+      pthread_mutex_unlock(&srv->lock);
+    }
+  return NULL;
+}
+
+ob_server_t *ob_server_start(void)
+{
+  struct sockaddr_in sin = { .sin_family = AF_INET };
+  socklen_t sin_len = sizeof(sin);
+  int one = 1;
+
+  ob_server_t *srv = calloc(1, sizeof(*srv));
+  if (srv == NULL)
+    return NULL;
+  pthread_mutex_init(&srv->lock, NULL);
+  sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  srv->fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (srv->fd < 0)
+    goto err;
+  setsockopt(srv->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  if (bind(srv->fd, (struct sockaddr *) &sin, sizeof(sin)) < 0 ||
+      listen(srv->fd, 128) < 0 ||
+      getsockname(srv->fd, (struct sockaddr *) &sin, &sin_len) < 0)
+    goto err;
+  srv->port = ntohs(sin.sin_port);
+  if (pthread_create(&srv->accept_thread, NULL, ob_accept_thread, srv) != 0)
+    goto err;
+  return srv;
+
+err:
+  if (srv->fd >= 0)
+    close(srv->fd);
+  pthread_mutex_destroy(&srv->lock);
+  free(srv);
+  return NULL;
+}
+
+void ob_server_stop(ob_server_t *srv)
+{
+  if (srv == NULL)
+    return;
+  srv->stopping = true;
+  // wake up the accept thread and all connection threads
+  shutdown(srv->fd, SHUT_RDWR);
+  pthread_join(srv->accept_thread, NULL);
+  close(srv->fd);
+  while (srv->conns)
+    {
+      ob_conn_t *conn = srv->conns;
+      srv->conns = conn->next;
+      shutdown(conn->fd, SHUT_RDWR);
+      pthread_join(conn->thread, NULL);
+      close(conn->fd);
+      free(conn);
+    }
+  ob_flush(srv);
+  pthread_mutex_destroy(&srv->lock);
+  free(srv);
+}
+
+int ob_server_port(ob_server_t *srv)
+{
+  return srv->port;
+}
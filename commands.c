@@ -11,13 +11,12 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
-#include "compat.h"
-// Note: commands.c only uses the "public" omcache api
-#include "omcache.h"
-#include "memcached_protocol_binary.h"
+#include "omcache_priv.h"
 
 #define QCMD(k) (timeout_msec ? k : k ## Q)
 
@@ -321,22 +320,31 @@ int omcache_gat_multi(omcache_t *mc,
                            timeout_msec);
 }
 
-static int omc_get_cmd(omcache_t *mc, protocol_binary_command opcode,
-                       const unsigned char *key, size_t key_len,
-                       const unsigned char **valuep, size_t *value_len,
-                       uint32_t be_expiration, uint32_t *flags, uint64_t *cas,
-                       int32_t timeout_msec)
+static int omc_get_value(omcache_t *mc, protocol_binary_command opcode,
+                         const unsigned char *key, size_t key_len,
+                         uint32_t be_expiration, omcache_value_t *value,
+                         int32_t timeout_msec)
 {
   omcache_req_t req;
-  omcache_value_t value = {0};
   size_t req_count = 1, value_count = 1;
   int ret = omc_get_multi_cmd(mc, opcode, &key, &key_len, &be_expiration, 1, &req, &req_count,
-                              &value, &value_count, timeout_msec);
+                              value, &value_count, timeout_msec);
   if (value_count)
-    ret = value.status;
+    ret = value->status;
   if (value_count == 0 && ret == OMCACHE_OK)
     ret = OMCACHE_NOT_FOUND;
-  else if (ret == OMCACHE_AGAIN && valuep == NULL)
+  return ret;
+}
+
+static int omc_get_cmd(omcache_t *mc, protocol_binary_command opcode,
+                       const unsigned char *key, size_t key_len,
+                       const unsigned char **valuep, size_t *value_len,
+                       uint32_t be_expiration, uint32_t *flags, uint64_t *cas,
+                       int32_t timeout_msec)
+{
+  omcache_value_t value = {0};
+  int ret = omc_get_value(mc, opcode, key, key_len, be_expiration, &value, timeout_msec);
+  if (ret == OMCACHE_AGAIN && valuep == NULL)
     ret = OMCACHE_OK;
   if (valuep)
     *valuep = value.data;
@@ -370,3 +378,304 @@ int omcache_gat(omcache_t *mc,
                      value, value_len, htobe32(expiration),
                      flags, cas, timeout_msec);
 }
+
+// values stored with omcache_set_chunked() are split in chunks stored
+// under "key:0" .. "key:N" and the key itself holds a manifest telling
+// how to put them back together.  the chunks carry the manifest's
+// generation in their flags so that chunks left over from a different
+// write of the same key are never mixed in.
+#define OMC_CHUNK_SIZE_DEFAULT (1000 * 1000)
+#define OMC_CHUNK_KEY_MAX 250
+#define OMC_CHUNK_MAGIC "OMCHUNK1"
+
+struct omc_chunk_manifest_s {
+  char magic[8];
+  uint64_t value_len;
+  uint32_t chunk_size;
+  uint32_t chunk_count;
+  uint32_t generation;
+} __attribute__((packed));
+
+typedef struct omc_chunks_s
+{
+  size_t count;
+  size_t key_len;
+  unsigned char *key_buf;
+  const unsigned char **keys;
+  size_t *key_lens;
+  omcache_req_t *reqs;
+  omcache_value_t *values;
+  unsigned char *seen;
+} omc_chunks_t;
+
+static uint32_t omc_chunk_generation(void)
+{
+  static uint32_t counter = 0;
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  uint32_t gen = (uint32_t) ts.tv_nsec ^ ((uint32_t) ts.tv_sec << 12) ^
+    (__atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED) * 2654435761u);
+  return gen ? gen : 1;
+}
+
+static void omc_chunks_free(omc_chunks_t *ch)
+{
+  free(ch->key_buf);
+  free(ch->keys);
+  free(ch->key_lens);
+  free(ch->reqs);
+  free(ch->values);
+  free(ch->seen);
+}
+
+// build the keys "key:0" .. "key:N" of 'count' chunks
+static int omc_chunks_init(omc_chunks_t *ch, const unsigned char *key, size_t key_len, size_t count)
+{
+  char suffix[24];
+  size_t max_key_len = key_len + snprintf(suffix, sizeof(suffix), ":%zu", count - 1);
+  memset(ch, 0, sizeof(*ch));
+  if (max_key_len > OMC_CHUNK_KEY_MAX)
+    return OMCACHE_INVALID;
+  ch->count = count;
+  ch->key_len = key_len;
+  ch->key_buf = malloc(count * max_key_len);
+  ch->keys = malloc(count * sizeof(*ch->keys));
+  ch->key_lens = malloc(count * sizeof(*ch->key_lens));
+  ch->reqs = calloc(count, sizeof(*ch->reqs));
+  ch->values = calloc(count, sizeof(*ch->values));
+  ch->seen = calloc(count, 1);
+  for (size_t i = 0; i < count; i ++)
+    {
+      unsigned char *p = ch->key_buf + i * max_key_len;
+      size_t suffix_len = snprintf(suffix, sizeof(suffix), ":%zu", i);
+      memcpy(p, key, key_len);
+      memcpy(p + key_len, suffix, suffix_len);
+      ch->keys[i] = p;
+      ch->key_lens[i] = key_len + suffix_len;
+    }
+  return OMCACHE_OK;
+}
+
+// the index of the chunk a response belongs to or -1
+static ssize_t omc_chunks_index(omc_chunks_t *ch, const omcache_value_t *value)
+{
+  size_t index = 0;
+  if (value->key_len <= ch->key_len + 1 || value->key[ch->key_len] != ':')
+    return -1;
+  for (size_t i = ch->key_len + 1; i < value->key_len; i ++)
+    {
+      if (value->key[i] < '0' || value->key[i] > '9')
+        return -1;
+      index = index * 10 + value->key[i] - '0';
+    }
+  return (index < ch->count) ? (ssize_t) index : -1;
+}
+
+// complete the requests set up in 'ch' passing every response to 'func',
+// returns the first error reported by 'func' or the I/O status
+static int omc_chunks_io(omcache_t *mc, omc_chunks_t *ch, int ret, size_t req_count,
+                         size_t value_count, int64_t deadline, int32_t timeout_msec,
+                         int (*func)(omc_chunks_t *ch, const omcache_value_t *value, void *context),
+                         void *context)
+{
+  int status = OMCACHE_OK;
+  for (;;)
+    {
+      for (size_t i = 0; i < value_count; i ++)
+        {
+          int vret = func(ch, &ch->values[i], context);
+          if (status == OMCACHE_OK)
+            status = vret;
+        }
+      if (ret != OMCACHE_AGAIN || req_count == 0)
+        break;
+      int32_t left = timeout_msec;
+      if (timeout_msec > 0)
+        {
+          int64_t now = omc_msec();
+          if (now >= deadline)
+            break;
+          left = deadline - now;
+        }
+      value_count = ch->count;
+      ret = omcache_io(mc, ch->reqs, &req_count, ch->values, &value_count, left);
+    }
+  return (status != OMCACHE_OK) ? status : ret;
+}
+
+static int omc_chunk_stored(omc_chunks_t *ch omc_attribute_unused,
+                            const omcache_value_t *value, void *context omc_attribute_unused)
+{
+  return value->status;
+}
+
+int omcache_set_chunked(omcache_t *mc,
+                        const unsigned char *key, size_t key_len,
+                        const unsigned char *value, size_t value_len,
+                        time_t expiration, uint32_t flags,
+                        size_t chunk_size, int32_t timeout_msec)
+{
+  if (chunk_size == 0)
+    chunk_size = OMC_CHUNK_SIZE_DEFAULT;
+  if (value_len <= chunk_size)
+    return omcache_set(mc, key, key_len, value, value_len, expiration, flags, 0, timeout_msec);
+  size_t chunk_count = (value_len + chunk_size - 1) / chunk_size;
+  if (chunk_size > UINT32_MAX || chunk_count > UINT32_MAX)
+    return OMCACHE_INVALID;
+
+  omc_chunks_t ch;
+  int ret = omc_chunks_init(&ch, key, key_len, chunk_count);
+  if (ret != OMCACHE_OK)
+    return ret;
+  int64_t deadline = omc_msec() + timeout_msec;
+  uint32_t generation = omc_chunk_generation();
+  struct omc_chunk_manifest_s manifest = {
+    .magic = OMC_CHUNK_MAGIC,
+    .value_len = htobe64(value_len),
+    .chunk_size = htobe32(chunk_size),
+    .chunk_count = htobe32(chunk_count),
+    .generation = htobe32(generation),
+    };
+  struct protocol_binary_set_request_body_s extra = {
+    .flags = htobe32(generation),
+    .expiration = htobe32(expiration),
+    };
+  // all chunks are sent at once with quiet sets, only failures are
+  // reported back
+  for (size_t i = 0; i < chunk_count; i ++)
+    {
+      size_t data_len = (i == chunk_count - 1) ? value_len - i * chunk_size : chunk_size;
+      ch.reqs[i].server_index = -1;
+      ch.reqs[i].header.opcode = PROTOCOL_BINARY_CMD_SETQ;
+      ch.reqs[i].header.extlen = sizeof(extra);
+      ch.reqs[i].header.keylen = htobe16(ch.key_lens[i]);
+      ch.reqs[i].header.bodylen = htobe32(sizeof(extra) + ch.key_lens[i] + data_len);
+      ch.reqs[i].extra = &extra;
+      ch.reqs[i].key = ch.keys[i];
+      ch.reqs[i].data = value + i * chunk_size;
+    }
+  size_t req_count = chunk_count, value_count = chunk_count;
+  ret = omcache_command(mc, ch.reqs, &req_count, ch.values, &value_count, timeout_msec);
+  // without blocking the manifest is queued right after the chunks,
+  // otherwise it's only written once all the chunks have been stored so
+  // that readers never find a manifest without its chunks
+  if (timeout_msec != 0)
+    ret = omc_chunks_io(mc, &ch, ret, req_count, value_count, deadline,
+                        timeout_msec, omc_chunk_stored, NULL);
+  if (ret == OMCACHE_OK || ret == OMCACHE_BUFFERED)
+    {
+      int32_t left = timeout_msec;
+      if (timeout_msec > 0)
+        left = (deadline > omc_msec()) ? deadline - omc_msec() : 1;
+      ret = omcache_set(mc, key, key_len, (const unsigned char *) &manifest, sizeof(manifest),
+                        expiration, flags, 0, left);
+    }
+  omc_chunks_free(&ch);
+  return ret;
+}
+
+typedef struct omc_chunk_get_s
+{
+  unsigned char *buf;
+  size_t value_len;
+  size_t chunk_size;
+  uint32_t generation;
+  size_t found;
+} omc_chunk_get_t;
+
+// copy a chunk to its place in the caller's buffer
+static int omc_chunk_received(omc_chunks_t *ch, const omcache_value_t *value, void *context)
+{
+  omc_chunk_get_t *get = context;
+  ssize_t index = omc_chunks_index(ch, value);
+  if (value->status != OMCACHE_OK)
+    return value->status;
+  if (index < 0 || ch->seen[index])
+    return OMCACHE_OK;
+  // the chunk's data went to the stream callback
+  if (value->stream_len)
+    return OMCACHE_TOO_LARGE_VALUE;
+  size_t offset = index * get->chunk_size;
+  size_t data_len = min(get->chunk_size, get->value_len - offset);
+  // a chunk from another write of the key, treat it as a miss
+  if (value->flags != get->generation || value->data_len != data_len)
+    return OMCACHE_OK;
+  memcpy(get->buf + offset, value->data, data_len);
+  ch->seen[index] = 1;
+  get->found ++;
+  return OMCACHE_OK;
+}
+
+int omcache_get_chunked(omcache_t *mc,
+                        const unsigned char *key, size_t key_len,
+                        unsigned char *buf, size_t *buf_size,
+                        uint32_t *flags, int32_t timeout_msec)
+{
+  omcache_value_t value = {0};
+  // the chunks can only be requested once the manifest has been received
+  if (timeout_msec == 0 || buf_size == NULL)
+    return OMCACHE_INVALID;
+  int64_t deadline = omc_msec() + timeout_msec;
+  int ret = omc_get_value(mc, QCMD(PROTOCOL_BINARY_CMD_GETK), key, key_len, 0, &value, timeout_msec);
+  if (ret != OMCACHE_OK)
+    return ret;
+  if (value.stream_len)
+    return OMCACHE_TOO_LARGE_VALUE;
+  if (flags)
+    *flags = value.flags;
+  const unsigned char *data = value.data;
+  size_t data_len = value.data_len;
+
+  struct omc_chunk_manifest_s manifest;
+  memset(&manifest, 0, sizeof(manifest));
+  if (data_len == sizeof(manifest))
+    memcpy(&manifest, data, sizeof(manifest));
+  uint64_t value_len = be64toh(manifest.value_len);
+  size_t chunk_size = be32toh(manifest.chunk_size);
+  size_t chunk_count = be32toh(manifest.chunk_count);
+  if (memcmp(manifest.magic, OMC_CHUNK_MAGIC, sizeof(manifest.magic)) != 0 ||
+      chunk_size == 0 || chunk_count != (value_len + chunk_size - 1) / chunk_size)
+    {
+      // a value small enough to be stored without chunking
+      if (data_len > *buf_size)
+        {
+          *buf_size = data_len;
+          return OMCACHE_BUFFER_FULL;
+        }
+      memcpy(buf, data, data_len);
+      *buf_size = data_len;
+      return OMCACHE_OK;
+    }
+  if (value_len > *buf_size)
+    {
+      *buf_size = value_len;
+      return OMCACHE_BUFFER_FULL;
+    }
+
+  omc_chunks_t ch;
+  ret = omc_chunks_init(&ch, key, key_len, chunk_count);
+  if (ret != OMCACHE_OK)
+    return ret;
+  omc_chunk_get_t get = {
+    .buf = buf,
+    .value_len = value_len,
+    .chunk_size = chunk_size,
+    .generation = be32toh(manifest.generation),
+    };
+  int32_t left = timeout_msec;
+  if (timeout_msec > 0)
+    left = (deadline > omc_msec()) ? deadline - omc_msec() : 1;
+  size_t req_count = chunk_count, value_count = chunk_count;
+  ret = omcache_get_multi(mc, ch.keys, ch.key_lens, chunk_count, ch.reqs, &req_count,
+                          ch.values, &value_count, left);
+  ret = omc_chunks_io(mc, &ch, ret, req_count, value_count, deadline,
+                      timeout_msec, omc_chunk_received, &get);
+  omc_chunks_free(&ch);
+  if (ret != OMCACHE_OK)
+    return ret;
+  // some of the chunks were evicted or overwritten
+  if (get.found != chunk_count)
+    return OMCACHE_NOT_FOUND;
+  *buf_size = value_len;
+  return OMCACHE_OK;
+}
@@ -23,6 +23,23 @@
 #define max(a,b) ({__typeof__(a) a_ = (a), b_ = (b); a_ > b_ ? a_ : b_; })
 #define min(a,b) ({__typeof__(a) a_ = (a), b_ = (b); a_ < b_ ? a_ : b_; })
 
+// count trailing zero bits of a non-zero 64-bit value
+#ifdef __GNUC__
+#define omc_ctz64(x) __builtin_ctzll(x)
+#else
+static omc_attribute_unused
+int omc_ctz64(unsigned long long x)
+{
+  int n = 0;
+  while (!(x & 1))
+    {
+      x >>= 1;
+      n ++;
+    }
+  return n;
+}
+#endif
+
 #ifdef __linux__
 #include <endian.h>
 #elif defined(__APPLE__)
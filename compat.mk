@@ -7,6 +7,12 @@ ifeq ($(UNAME_S),Linux)
   SO_FLAGS = -shared -fPIC -Wl,-soname=$(SHLIB_V) -Wl,-version-script=symbol.map
   WITH_LIBS += -lrt
   WITH_CFLAGS += -std=gnu99 -D_GNU_SOURCE
+  ifeq ($(WITHOUT_EPOLL),)
+    WITH_CFLAGS += -DWITH_EPOLL
+  endif
+  ifneq ($(WITH_IO_URING),)
+    WITH_CFLAGS += -DWITH_IO_URING
+  endif
 else ifeq ($(UNAME_S),SunOS)
   SO_EXT = so
   SO_FLAGS = -shared -fPIC -Wl,-h,$(SHLIB_V) -Wl,-M,symbol.map
@@ -22,6 +28,11 @@ else ifeq ($(UNAME_S),Darwin)
   WITH_CFLAGS += -std=gnu99 -D_DARWIN_C_SOURCE
 endif
 
+ifeq ($(WITHOUT_THREADS),)
+  WITH_CFLAGS += -DWITH_THREADS -pthread
+  WITH_LIBS += -pthread
+endif
+
 ifeq ($(WITHOUT_ASYNCNS),)
   WITH_CFLAGS += -DWITH_ASYNCNS
   WITH_LIBS += -lasyncns
@@ -11,6 +11,7 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "omcache_priv.h"
 
@@ -57,6 +58,27 @@ static uint32_t omc_ketama_jenkins_oat(const char *hostname, const char *portnam
   return 1;
 }
 
+static uint32_t omc_ketama_point_hash(const char *hostname, const char *portname, uint32_t point,
+                                      uint32_t *hashes, omc_ketama_key_hash_func *hash_func)
+{
+  char name[strlen(hostname) + strlen(portname) + 16];
+  size_t name_len = omc_ketama_point_name(hostname, portname, point, name);
+  hashes[0] = hash_func((unsigned char *) name, name_len);
+  return 1;
+}
+
+static uint32_t omc_ketama_xxh3(const char *hostname, const char *portname,
+                                uint32_t point, uint32_t *hashes)
+{
+  return omc_ketama_point_hash(hostname, portname, point, hashes, omc_hash_xxh3);
+}
+
+static uint32_t omc_ketama_murmur3(const char *hostname, const char *portname,
+                                   uint32_t point, uint32_t *hashes)
+{
+  return omc_ketama_point_hash(hostname, portname, point, hashes, omc_hash_murmur3);
+}
+
 static uint32_t omc_ketama_md5_libmcd_weighted(const char *hostname, const char *portname,
                                                    uint32_t point, uint32_t *hashes)
 {
@@ -98,3 +120,146 @@ omcache_dist_t omcache_dist_libmemcached_ketama_pre1010 = {
   .point_hash_func = omc_ketama_md5_libmcd_weighted,
   .key_hash_func = omc_hash_jenkins_oat,
   };
+
+omcache_dist_t omcache_dist_ketama_xxh3 = {
+  .omcache_version = OMCACHE_VERSION,
+  .points_per_server = 256,
+  .entries_per_point = 1,
+  .point_hash_func = omc_ketama_xxh3,
+  .key_hash_func = omc_hash_xxh3,
+  };
+
+omcache_dist_t omcache_dist_ketama_murmur3 = {
+  .omcache_version = OMCACHE_VERSION,
+  .points_per_server = 256,
+  .entries_per_point = 1,
+  .point_hash_func = omc_ketama_murmur3,
+  .key_hash_func = omc_hash_murmur3,
+  };
+
+omcache_dist_t omcache_dist_ketama_crc32c = {
+  .omcache_version = OMCACHE_VERSION,
+  .points_per_server = 256,
+  .entries_per_point = 1,
+  .point_hash_func = omc_ketama_xxh3,
+  .key_hash_func = omc_hash_crc32c,
+  };
+
+static uint32_t omc_jump_hash(uint32_t key_hash, uint32_t server_count)
+{
+  // Jump Consistent Hash by Lamping and Veach, https://arxiv.org/abs/1406.2294
+  // the 32-bit key hash is first spread over 64 bits with splitmix64's
+  // finalizer as the algorithm uses the key as a random number seed
+  uint64_t key = key_hash + 0x9e3779b97f4a7c15ULL;
+  key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+  key ^= key >> 31;
+  int64_t b = -1, j = 0;
+  while (j < server_count)
+    {
+      b = j;
+      key = key * 2862933555777941757ULL + 1;
+      j = (b + 1) * ((double) (1LL << 31) / (double) ((key >> 33) + 1));
+    }
+  return b;
+}
+
+omcache_dist_t omcache_dist_jump_hash = {
+  .omcache_version = OMCACHE_VERSION,
+  .points_per_server = 0,
+  .entries_per_point = 0,
+  .key_hash_func = omc_hash_jenkins_oat,
+  .lookup_func = omc_jump_hash,
+  };
+
+static void omc_maglev_table(const uint32_t *server_hashes, uint32_t hashes_per_server,
+                             const uint8_t *enabled, uint32_t server_count,
+                             uint32_t *table, uint32_t table_size)
+{
+  // Maglev: A Fast and Reliable Software Network Load Balancer, section 3.4
+  // each server fills the table slots of its own permutation of the table
+  // in turns until all slots are taken
+  uint32_t *offsets = malloc(3 * server_count * sizeof(uint32_t));
+  uint32_t *skips = offsets + server_count, *next = skips + server_count;
+  uint32_t filled = 0, enabled_count = 0;
+
+  // a server's permutation is picked with its first two hashes, the
+  // second one is derived from the first if there's only one
+  for (uint32_t i = 0; i < server_count; i ++)
+    {
+      const uint32_t *hashes = server_hashes + i * hashes_per_server;
+      uint32_t skip_hash = (hashes_per_server > 1) ? hashes[1] :
+        omc_hash_jenkins_oat((const unsigned char *) &hashes[0], sizeof(hashes[0]));
+      offsets[i] = hashes[0] % table_size;
+      skips[i] = skip_hash % (table_size - 1) + 1;
+      next[i] = 0;
+      enabled_count += enabled[i] ? 1 : 0;
+    }
+  memset(table, 0xff, table_size * sizeof(uint32_t));
+  while (enabled_count && filled < table_size)
+    {
+      for (uint32_t i = 0; i < server_count && filled < table_size; i ++)
+        {
+          if (!enabled[i])
+            continue;
+          uint32_t slot;
+          do
+            slot = (offsets[i] + (uint64_t) next[i] ++ * skips[i]) % table_size;
+          while (table[slot] != UINT32_MAX);
+          table[slot] = i;
+          filled ++;
+        }
+    }
+  free(offsets);
+}
+
+omcache_dist_t omcache_dist_maglev = {
+  .omcache_version = OMCACHE_VERSION,
+  .points_per_server = 100,
+  .entries_per_point = 4,
+  .point_hash_func = omc_ketama_md5_libmcd_weighted,
+  .key_hash_func = omc_hash_jenkins_oat,
+  .table_func = omc_maglev_table,
+  };
+
+static void omc_rendezvous_scores(uint32_t key_hash, const uint32_t *server_seeds,
+                                  const float *server_weights, uint32_t server_count,
+                                  float *scores)
+{
+  // weighted rendezvous hashing: the score of a server is -weight / ln(u)
+  // for a uniform random number u in (0, 1) derived from the key and the
+  // server.  The loop has no branches or calls so that compilers can
+  // vectorize it, ln is computed like fdlibm's logf from the float's
+  // exponent and an atanh series of the mantissa which keeps its relative
+  // error small also when u is close to one.
+  for (uint32_t i = 0; i < server_count; i ++)
+    {
+      // murmur3's 32-bit finalizer
+      uint32_t h = key_hash ^ server_seeds[i];
+      h ^= h >> 16;
+      h *= 0x85ebca6b;
+      h ^= h >> 13;
+      h *= 0xc2b2ae35;
+      h ^= h >> 16;
+      // 23 bits of the hash give a u that is exactly representable
+      union { float f; uint32_t u; } u = { .f = ((h >> 9) + 0.5f) * (1.0f / 8388608.0f) };
+      // scale the mantissa to [sqrt(2)/2, sqrt(2)), 0x3504f3 is the
+      // mantissa of sqrt(2)
+      uint32_t mantissa = u.u & 0x007fffff, adjust = mantissa > 0x3504f3;
+      int32_t exponent = (int32_t) (u.u >> 23) - 127 + adjust;
+      u.u = mantissa | ((127 - adjust) << 23);
+      float t = (u.f - 1.0f) / (u.f + 1.0f), t2 = t * t;
+      float ln_u = exponent * 0.69314718f +
+        2.0f * t * (1.0f + t2 * (1.0f / 3 + t2 * (1.0f / 5 + t2 * (1.0f / 7 + t2 * (1.0f / 9)))));
+      scores[i] = server_weights[i] / -ln_u;
+    }
+}
+
+omcache_dist_t omcache_dist_rendezvous = {
+  .omcache_version = OMCACHE_VERSION,
+  .points_per_server = 1,
+  .entries_per_point = 1,
+  .point_hash_func = omc_ketama_jenkins_oat,
+  .key_hash_func = omc_hash_jenkins_oat,
+  .score_func = omc_rendezvous_scores,
+  };
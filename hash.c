@@ -0,0 +1,364 @@
+/*
+ * Fast non-cryptographic key hashing for OMcache.
+ *
+ * Copyright (c) 2014, Oskari Saarenmaa <os@ohmu.fi>
+ * All rights reserved.
+ *
+ * The OMcache bits in this file are under the Apache License, Version 2.0.
+ * See the file `LICENSE` for details.
+ *
+ * The MurmurHash3 and XXH3 functions below are ports of their reference
+ * implementations and are not covered by the copyright above, see the
+ * upstream notices in front of them.
+ *
+ */
+
+#include <string.h>
+#include "omcache_priv.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif // __x86_64__
+
+static inline uint32_t omc_read32(const unsigned char *p)
+{
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap32(v);
+#endif
+  return v;
+}
+
+static inline uint64_t omc_read64(const unsigned char *p)
+{
+  uint64_t v;
+  memcpy(&v, p, sizeof(v));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  v = __builtin_bswap64(v);
+#endif
+  return v;
+}
+
+static inline uint32_t omc_rotl32(uint32_t v, int r)
+{
+  return (v << r) | (v >> (32 - r));
+}
+
+static inline uint64_t omc_rotl64(uint64_t v, int r)
+{
+  return (v << r) | (v >> (64 - r));
+}
+
+/*
+ * MurmurHash3_x86_32 with seed 0, ported from MurmurHash3.cpp of SMHasher,
+ * https://github.com/aappleby/smhasher
+ *
+ * MurmurHash3 was written by Austin Appleby, and is placed in the public
+ * domain.  The author hereby disclaims copyright to this source code.
+ */
+omc_hidden uint32_t omc_hash_murmur3(const unsigned char *key, size_t key_len)
+{
+  const uint32_t c1 = 0xcc9e2d51, c2 = 0x1b873593;
+  uint32_t h = 0, k;
+  size_t i;
+
+  for (i = 0; i + 4 <= key_len; i += 4)
+    {
+      k = omc_read32(key + i) * c1;
+      h ^= omc_rotl32(k, 15) * c2;
+      h = omc_rotl32(h, 13) * 5 + 0xe6546b64;
+    }
+  k = 0;
+  switch (key_len & 3)
+    {
+    case 3: k ^= key[i + 2] << 16;  // fall through
+    case 2: k ^= key[i + 1] << 8;   // fall through
+    case 1: k ^= key[i];
+      h ^= omc_rotl32(k * c1, 15) * c2;
+    }
+  h ^= key_len;
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+  return h;
+}
+
+/*
+ * XXH3_64bits() ported from the reference implementation of xxHash 0.8,
+ * produces the same hash values.
+ *
+ * xxHash - Extremely Fast Hash algorithm
+ * Copyright (C) 2012-2021 Yann Collet
+ *
+ * BSD 2-Clause License (https://www.opensource.org/licenses/bsd-license.php)
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are
+ * met:
+ *
+ *    * Redistributions of source code must retain the above copyright
+ *      notice, this list of conditions and the following disclaimer.
+ *    * Redistributions in binary form must reproduce the above
+ *      copyright notice, this list of conditions and the following disclaimer
+ *      in the documentation and/or other materials provided with the
+ *      distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT
+ * LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+ * A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT
+ * OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT
+ * LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+ * OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * You can contact the author at:
+ *   - xxHash homepage: https://www.xxhash.com
+ *   - xxHash source repository: https://github.com/Cyan4973/xxHash
+ */
+
+#define XXH_PRIME32_1 0x9e3779b1U
+#define XXH_PRIME32_2 0x85ebca77U
+#define XXH_PRIME32_3 0xc2b2ae3dU
+#define XXH_PRIME64_1 0x9e3779b185ebca87ULL
+#define XXH_PRIME64_2 0xc2b2ae3d27d4eb4fULL
+#define XXH_PRIME64_3 0x165667b19e3779f9ULL
+#define XXH_PRIME64_4 0x85ebca77c2b2ae63ULL
+#define XXH_PRIME64_5 0x27d4eb2f165667c5ULL
+#define XXH_PRIME_MX1 0x165667919e3779f9ULL
+#define XXH_PRIME_MX2 0x9fb21c651e98df25ULL
+#define XXH_SECRET_SIZE 192
+#define XXH_STRIPE_LEN 64
+
+static const unsigned char omc_xxh3_secret[XXH_SECRET_SIZE] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+// multiply two 64-bit values to 128 bits and xor the halves together
+static inline uint64_t omc_mul128_fold64(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+  unsigned __int128 product = (unsigned __int128) a * b;
+  return (uint64_t) product ^ (uint64_t) (product >> 64);
+#else
+  uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+  uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+  uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+  uint64_t hi_hi = (a >> 32) * (b >> 32);
+  uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+  uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  uint64_t lower = (cross << 32) | (lo_lo & 0xffffffff);
+  return lower ^ upper;
+#endif
+}
+
+static inline uint64_t omc_xxh64_avalanche(uint64_t h)
+{
+  h ^= h >> 33;
+  h *= XXH_PRIME64_2;
+  h ^= h >> 29;
+  h *= XXH_PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline uint64_t omc_xxh3_avalanche(uint64_t h)
+{
+  h ^= h >> 37;
+  h *= XXH_PRIME_MX1;
+  h ^= h >> 32;
+  return h;
+}
+
+static inline uint64_t omc_xxh3_mix16(const unsigned char *p, const unsigned char *secret)
+{
+  return omc_mul128_fold64(omc_read64(p) ^ omc_read64(secret),
+                           omc_read64(p + 8) ^ omc_read64(secret + 8));
+}
+
+static inline void omc_xxh3_accumulate(uint64_t *acc, const unsigned char *p, const unsigned char *secret)
+{
+  for (int i = 0; i < 8; i ++)
+    {
+      uint64_t data = omc_read64(p + i * 8);
+      uint64_t key = data ^ omc_read64(secret + i * 8);
+      acc[i ^ 1] += data;
+      acc[i] += (key & 0xffffffff) * (key >> 32);
+    }
+}
+
+static uint64_t omc_xxh3_long(const unsigned char *key, size_t key_len)
+{
+  const size_t stripes_per_block = (XXH_SECRET_SIZE - XXH_STRIPE_LEN) / 8;
+  const size_t block_len = XXH_STRIPE_LEN * stripes_per_block;
+  const size_t blocks = (key_len - 1) / block_len;
+  uint64_t acc[8] = {
+    XXH_PRIME32_3, XXH_PRIME64_1, XXH_PRIME64_2, XXH_PRIME64_3,
+    XXH_PRIME64_4, XXH_PRIME32_2, XXH_PRIME64_5, XXH_PRIME32_1,
+  };
+
+  for (size_t b = 0; b < blocks; b ++)
+    {
+      for (size_t s = 0; s < stripes_per_block; s ++)
+        omc_xxh3_accumulate(acc, key + b * block_len + s * XXH_STRIPE_LEN, omc_xxh3_secret + s * 8);
+      // scramble the accumulators at the end of each block
+      const unsigned char *secret = omc_xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN;
+      for (int i = 0; i < 8; i ++)
+        acc[i] = (acc[i] ^ (acc[i] >> 47) ^ omc_read64(secret + i * 8)) * XXH_PRIME32_1;
+    }
+  size_t stripes = ((key_len - 1) - block_len * blocks) / XXH_STRIPE_LEN;
+  for (size_t s = 0; s < stripes; s ++)
+    omc_xxh3_accumulate(acc, key + blocks * block_len + s * XXH_STRIPE_LEN, omc_xxh3_secret + s * 8);
+  omc_xxh3_accumulate(acc, key + key_len - XXH_STRIPE_LEN,
+                      omc_xxh3_secret + XXH_SECRET_SIZE - XXH_STRIPE_LEN - 7);
+
+  // merge the accumulators
+  uint64_t h = key_len * XXH_PRIME64_1;
+  for (int i = 0; i < 4; i ++)
+    h += omc_mul128_fold64(acc[i * 2] ^ omc_read64(omc_xxh3_secret + 11 + i * 16),
+                           acc[i * 2 + 1] ^ omc_read64(omc_xxh3_secret + 11 + i * 16 + 8));
+  return omc_xxh3_avalanche(h);
+}
+
+// XXH3_64bits() truncated to 32 bits
+omc_hidden uint32_t omc_hash_xxh3(const unsigned char *key, size_t key_len)
+{
+  const unsigned char *secret = omc_xxh3_secret;
+  uint64_t h;
+
+  if (key_len == 0)
+    {
+      h = omc_xxh64_avalanche(omc_read64(secret + 56) ^ omc_read64(secret + 64));
+    }
+  else if (key_len <= 3)
+    {
+      uint32_t combined = ((uint32_t) key[0] << 16) | ((uint32_t) key[key_len >> 1] << 24) |
+                          ((uint32_t) key[key_len - 1]) | ((uint32_t) key_len << 8);
+      h = omc_xxh64_avalanche(combined ^ (uint64_t) (omc_read32(secret) ^ omc_read32(secret + 4)));
+    }
+  else if (key_len <= 8)
+    {
+      uint64_t input = omc_read32(key + key_len - 4) + ((uint64_t) omc_read32(key) << 32);
+      h = input ^ (omc_read64(secret + 8) ^ omc_read64(secret + 16));
+      h ^= omc_rotl64(h, 49) ^ omc_rotl64(h, 24);
+      h *= XXH_PRIME_MX2;
+      h ^= (h >> 35) + key_len;
+      h *= XXH_PRIME_MX2;
+      h ^= h >> 28;
+    }
+  else if (key_len <= 16)
+    {
+      uint64_t lo = omc_read64(key) ^ (omc_read64(secret + 24) ^ omc_read64(secret + 32));
+      uint64_t hi = omc_read64(key + key_len - 8) ^ (omc_read64(secret + 40) ^ omc_read64(secret + 48));
+      h = omc_xxh3_avalanche(key_len + __builtin_bswap64(lo) + hi + omc_mul128_fold64(lo, hi));
+    }
+  else if (key_len <= 128)
+    {
+      h = key_len * XXH_PRIME64_1;
+      if (key_len > 32)
+        {
+          if (key_len > 64)
+            {
+              if (key_len > 96)
+                {
+                  h += omc_xxh3_mix16(key + 48, secret + 96);
+                  h += omc_xxh3_mix16(key + key_len - 64, secret + 112);
+                }
+              h += omc_xxh3_mix16(key + 32, secret + 64);
+              h += omc_xxh3_mix16(key + key_len - 48, secret + 80);
+            }
+          h += omc_xxh3_mix16(key + 16, secret + 32);
+          h += omc_xxh3_mix16(key + key_len - 32, secret + 48);
+        }
+      h += omc_xxh3_mix16(key, secret);
+      h += omc_xxh3_mix16(key + key_len - 16, secret + 16);
+      h = omc_xxh3_avalanche(h);
+    }
+  else if (key_len <= 240)
+    {
+      h = key_len * XXH_PRIME64_1;
+      for (size_t i = 0; i < 8; i ++)
+        h += omc_xxh3_mix16(key + i * 16, secret + i * 16);
+      h = omc_xxh3_avalanche(h);
+      uint64_t h_end = omc_xxh3_mix16(key + key_len - 16, secret + 136 - 17);
+      for (size_t i = 8; i < key_len / 16; i ++)
+        h_end += omc_xxh3_mix16(key + i * 16, secret + (i - 8) * 16 + 3);
+      h = omc_xxh3_avalanche(h + h_end);
+    }
+  else
+    {
+      h = omc_xxh3_long(key, key_len);
+    }
+  return (uint32_t) h;
+}
+
+// CRC-32C (Castagnoli) as used by iSCSI and ext4, computed with the SSE 4.2
+// crc32 instruction when the CPU supports it and with a table otherwise
+static uint32_t omc_crc32c_table[256];
+static uint32_t (*omc_crc32c_impl)(uint32_t crc, const unsigned char *p, size_t len);
+
+static uint32_t omc_crc32c_sw(uint32_t crc, const unsigned char *p, size_t len)
+{
+  for (size_t i = 0; i < len; i ++)
+    crc = omc_crc32c_table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t omc_crc32c_sse42(uint32_t crc, const unsigned char *p, size_t len)
+{
+  uint64_t crc64 = crc;
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+    {
+      uint64_t v;
+      memcpy(&v, p + i, sizeof(v));
+      crc64 = _mm_crc32_u64(crc64, v);
+    }
+  crc = crc64;
+  for (; i < len; i ++)
+    crc = _mm_crc32_u8(crc, p[i]);
+  return crc;
+}
+#endif // __x86_64__
+
+__attribute__((constructor))
+static void omc_crc32c_init(void)
+{
+  for (uint32_t i = 0; i < 256; i ++)
+    {
+      uint32_t crc = i;
+      for (int b = 0; b < 8; b ++)
+        crc = (crc >> 1) ^ (0x82f63b78 & -(crc & 1));
+      omc_crc32c_table[i] = crc;
+    }
+  omc_crc32c_impl = omc_crc32c_sw;
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("sse4.2"))
+    omc_crc32c_impl = omc_crc32c_sse42;
+#endif // __x86_64__
+}
+
+omc_hidden uint32_t omc_hash_crc32c(const unsigned char *key, size_t key_len)
+{
+  return ~omc_crc32c_impl(~0U, key, key_len);
+}
@@ -0,0 +1,217 @@
+/*
+ * OMcache: client-side near cache
+ *
+ * Copyright (c) 2014, Oskari Saarenmaa <os@ohmu.fi>
+ * All rights reserved.
+ *
+ * This file is under the Apache License, Version 2.0.
+ * See the file `LICENSE` for details.
+ *
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "omcache_priv.h"
+
+typedef struct omc_near_entry_s
+{
+  struct omc_near_entry_s *next;
+  uint32_t hash;
+  // index of the entry in the clock ring
+  uint32_t slot;
+  bool referenced;
+  int64_t added;
+  uint32_t flags;
+  uint64_t cas;
+  size_t key_len;
+  size_t data_len;
+  // key followed by data
+  unsigned char key[];
+} omc_near_entry_t;
+
+struct omc_near_cache_s
+{
+  size_t max_bytes;
+  size_t bytes;
+  uint32_t ttl_msec;
+  uint32_t count;
+  uint32_t bucket_count;
+  uint32_t hand;
+  uint32_t ring_size;
+  omc_near_entry_t **buckets;
+  omc_near_entry_t **ring;
+};
+
+#define OMC_NEAR_MIN_BUCKETS 64
+
+static inline size_t omc_near_entry_size(size_t key_len, size_t data_len)
+{
+  return sizeof(omc_near_entry_t) + key_len + data_len;
+}
+
+omc_near_cache_t *omc_near_cache_init(omc_near_cache_t *old_nc, size_t max_bytes, uint32_t ttl_msec)
+{
+  omc_near_cache_t *nc = old_nc;
+  if (nc == NULL)
+    {
+      nc = calloc(1, sizeof(*nc));
+      nc->bucket_count = OMC_NEAR_MIN_BUCKETS;
+      nc->buckets = calloc(nc->bucket_count, sizeof(*nc->buckets));
+    }
+  nc->max_bytes = max_bytes;
+  nc->ttl_msec = ttl_msec;
+  // drop entries that don't fit in the new limit
+  while (nc->count && nc->bytes > nc->max_bytes)
+    omc_near_cache_del(nc, nc->ring[nc->count - 1]->key, nc->ring[nc->count - 1]->key_len);
+  return nc;
+}
+
+void omc_near_cache_free(omc_near_cache_t *nc)
+{
+  if (nc == NULL)
+    return;
+  omc_near_cache_clear(nc);
+  free(nc->buckets);
+  free(nc->ring);
+  free(nc);
+}
+
+void omc_near_cache_clear(omc_near_cache_t *nc)
+{
+  for (uint32_t i = 0; i < nc->count; i ++)
+    free(nc->ring[i]);
+  memset(nc->buckets, 0, nc->bucket_count * sizeof(*nc->buckets));
+  nc->count = 0;
+  nc->bytes = 0;
+  nc->hand = 0;
+}
+
+static omc_near_entry_t **omc_near_cache_lookup(omc_near_cache_t *nc, uint32_t hash,
+                                                const unsigned char *key, size_t key_len)
+{
+  omc_near_entry_t **ep = &nc->buckets[hash & (nc->bucket_count - 1)];
+  for (; *ep != NULL; ep = &(*ep)->next)
+    if ((*ep)->hash == hash && (*ep)->key_len == key_len &&
+        memcmp((*ep)->key, key, key_len) == 0)
+      return ep;
+  return ep;
+}
+
+// remove the entry pointed to by 'ep' from its hash chain and the ring,
+// the last entry of the ring is moved to its slot
+static void omc_near_cache_unlink(omc_near_cache_t *nc, omc_near_entry_t **ep)
+{
+  omc_near_entry_t *e = *ep;
+  *ep = e->next;
+  nc->count --;
+  if (e->slot != nc->count)
+    {
+      nc->ring[e->slot] = nc->ring[nc->count];
+      nc->ring[e->slot]->slot = e->slot;
+    }
+  nc->bytes -= omc_near_entry_size(e->key_len, e->data_len);
+  free(e);
+}
+
+static void omc_near_cache_grow(omc_near_cache_t *nc)
+{
+  if (nc->count == nc->ring_size)
+    {
+      nc->ring_size = nc->ring_size ? nc->ring_size * 2 : OMC_NEAR_MIN_BUCKETS;
+      nc->ring = realloc(nc->ring, nc->ring_size * sizeof(*nc->ring));
+    }
+  if (nc->count < nc->bucket_count)
+    return;
+  free(nc->buckets);
+  nc->bucket_count *= 2;
+  nc->buckets = calloc(nc->bucket_count, sizeof(*nc->buckets));
+  for (uint32_t i = 0; i < nc->count; i ++)
+    {
+      omc_near_entry_t *e = nc->ring[i];
+      omc_near_entry_t **bucket = &nc->buckets[e->hash & (nc->bucket_count - 1)];
+      e->next = *bucket;
+      *bucket = e;
+    }
+}
+
+// CLOCK eviction: entries that have been hit since the hand last passed
+// them get a second chance.  new entries start without the reference bit
+// so keys that are only read once can't push out the hot ones.
+static void omc_near_cache_evict(omc_near_cache_t *nc, size_t needed)
+{
+  while (nc->count && nc->bytes + needed > nc->max_bytes)
+    {
+      if (nc->hand >= nc->count)
+        nc->hand = 0;
+      omc_near_entry_t *e = nc->ring[nc->hand];
+      if (e->referenced)
+        {
+          e->referenced = false;
+          nc->hand ++;
+          continue;
+        }
+      omc_near_cache_unlink(nc, omc_near_cache_lookup(nc, e->hash, e->key, e->key_len));
+    }
+}
+
+bool omc_near_cache_find(omc_near_cache_t *nc, const unsigned char *key, size_t key_len,
+                         int64_t now, omcache_value_t *value)
+{
+  omc_near_entry_t **ep = omc_near_cache_lookup(nc, omc_hash_xxh3(key, key_len), key, key_len);
+  omc_near_entry_t *e = *ep;
+  if (e == NULL)
+    return false;
+  if (now - e->added >= nc->ttl_msec)
+    {
+      omc_near_cache_unlink(nc, ep);
+      return false;
+    }
+  e->referenced = true;
+  value->status = OMCACHE_OK;
+  value->key = e->key;
+  value->key_len = e->key_len;
+  value->data = e->key + e->key_len;
+  value->data_len = e->data_len;
+  value->flags = e->flags;
+  value->cas = e->cas;
+  value->delta_value = 0;
+  return true;
+}
+
+void omc_near_cache_add(omc_near_cache_t *nc, const omcache_value_t *value, int64_t now)
+{
+  uint32_t hash = omc_hash_xxh3(value->key, value->key_len);
+  omc_near_entry_t **ep = omc_near_cache_lookup(nc, hash, value->key, value->key_len);
+  if (*ep != NULL)
+    omc_near_cache_unlink(nc, ep);
+  // a single value may only take an eighth of the cache
+  size_t size = omc_near_entry_size(value->key_len, value->data_len);
+  if (size > nc->max_bytes / 8)
+    return;
+  omc_near_cache_evict(nc, size);
+  omc_near_cache_grow(nc);
+
+  omc_near_entry_t *e = malloc(size);
+  e->hash = hash;
+  e->slot = nc->count;
+  e->referenced = false;
+  e->added = now;
+  e->flags = value->flags;
+  e->cas = value->cas;
+  e->key_len = value->key_len;
+  e->data_len = value->data_len;
+  memcpy(e->key, value->key, value->key_len);
+  memcpy(e->key + value->key_len, value->data, value->data_len);
+  omc_near_entry_t **bucket = &nc->buckets[hash & (nc->bucket_count - 1)];
+  e->next = *bucket;
+  *bucket = e;
+  nc->ring[nc->count ++] = e;
+  nc->bytes += size;
+}
+
+void omc_near_cache_del(omc_near_cache_t *nc, const unsigned char *key, size_t key_len)
+{
+  omc_near_entry_t **ep = omc_near_cache_lookup(nc, omc_hash_xxh3(key, key_len), key, key_len);
+  if (*ep != NULL)
+    omc_near_cache_unlink(nc, ep);
+}
@@ -31,9 +31,41 @@
 #include <asyncns.h>
 #endif // WITH_ASYNCNS
 
+#ifdef WITH_EPOLL
+#include <sys/epoll.h>
+#define OMC_EPOLL_MAX_EVENTS 256
+#endif // WITH_EPOLL
+
+#ifdef WITH_IO_URING
+#include <linux/io_uring.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define OMC_URING_ENTRIES 256
+#define omc_uring_enabled(mc) ((mc)->ur.fd >= 0)
+#else
+#define omc_uring_enabled(mc) false
+#endif // WITH_IO_URING
+
+#ifdef WITH_THREADS
+#include <pthread.h>
+// 'depth' counts the recursive locks held by the owning thread
+#define omc_lock(mc) ({ if ((mc)->ts.enabled) { pthread_mutex_lock(&(mc)->ts.lock); (mc)->ts.depth ++; } })
+#define omc_unlock(mc) ({ if ((mc)->ts.enabled) { (mc)->ts.depth --; pthread_mutex_unlock(&(mc)->ts.lock); } })
+#else
+#define omc_lock(mc) ({ (void) (mc); })
+#define omc_unlock(mc) ({ (void) (mc); })
+#endif // WITH_THREADS
+
+#define OMC_MAX_CONNS_PER_SERVER 64
+
 #define max(a,b) ({__typeof__(a) a_ = (a), b_ = (b); a_ > b_ ? a_ : b_; })
 #define min(a,b) ({__typeof__(a) a_ = (a), b_ = (b); a_ < b_ ? a_ : b_; })
 
+// the fields added to omcache_dist_t in 0.4.0, distribution methods built
+// for older versions don't have them
+#define omc_dist_func(dist,field) ((dist)->omcache_version >= 0x400 ? (dist)->field : NULL)
+
 
 #define omc_log(pri,fmt,...) ({ \
     if (mc->log_cb && (pri) <= mc->log_level) { \
@@ -64,12 +96,72 @@ typedef struct omc_buf_s
   unsigned char *w;
 } omc_buf_t;
 
+// memcached doesn't accept keys longer than this
+#define OMC_MAX_KEY_LEN 250
+
+// responses are read into fixed size segments borrowed from the handle's
+// pool while they're being processed, idle connections don't hold any
+#define OMC_RECV_SEGMENT_SIZE ((size_t) 64 * 1024)
+#define OMC_RECV_POOL_MAX 16
+
+// req_ids wrap around once fewer than this many are left, unless other
+// calls are still waiting for responses: the wraparound is then deferred
+// until they complete or the ids really run out
+#define OMC_REQ_ID_WRAP_MARGIN ((uint32_t) 1 << 24)
+
+// memory holding values pinned by the caller, shared with a connection's
+// receive buffer until the connection needs to move or reuse the buffer
+struct omcache_pin_s
+{
+  uint32_t refs;
+  unsigned char *base;
+  size_t size;
+};
+
+// a lookup sent to a server that later lookups of the same key wait for
+// instead of sending requests of their own, see omc_command
+typedef struct omc_flight_s
+{
+  // hash chain in omcache_t's 'flights' table or the free list
+  struct omc_flight_s *next;
+  struct omc_srv_s *conn;
+  uint32_t req_id;
+  uint32_t key_hash;
+  uint8_t opcode;
+  // detached flights can't be followed anymore as the key was written
+  bool hashed;
+  uint16_t key_len;
+  uint32_t follower_count;
+  uint32_t follower_size;
+  struct omc_flight_follower_s
+  {
+    uint32_t req_id;
+    bool quiet;
+  } *followers;
+  unsigned char key[OMC_MAX_KEY_LEN];
+} omc_flight_t;
+
 typedef struct omc_srv_s
 {
   int list_index;
+  int conn_index;
+  // a server's extra connections are omc_srv_t structures of their own,
+  // conns[0] is the server itself
+  struct omc_srv_s *server;
+  struct omc_srv_s **conns;
+  uint32_t conn_count;
+  uint32_t next_conn;
   int sock;
   char *hostname;
   char *port;
+  uint32_t weight;
+  // the hashes of the first point_hash_count points computed with
+  // point_hash_func, point_hash_entries apart in point_hashes
+  omc_ketama_point_hash_func *point_hash_func;
+  uint32_t point_hash_entries;
+  uint32_t point_hash_count;
+  uint32_t *point_hashes;
+  uint8_t *point_hash_sizes;
   struct addrinfo *addrs;
   struct addrinfo *addrp;
 #ifdef WITH_ASYNCNS
@@ -81,27 +173,168 @@ typedef struct omc_srv_s
   uint32_t last_req_recvd;
   uint32_t last_req_sent;
   uint32_t last_req_sent_nq;
-  uint32_t active_requests;
   omc_buf_t send_buffer;
   omc_buf_t recv_buffer;
   uint32_t keep_recv_buffer_iteration;
+  // set while values in recv_buffer are pinned, holds a reference
+  omcache_pin_t *recv_pin;
+  // a lookup response whose value is passed to the stream callback as
+  // it's received.  the header and key stay at the start of recv_buffer
+  // and the value is read in pieces after them.
+  struct
+  {
+    bool active;
+    bool done;
+    uint32_t head_size;
+    uint32_t flags;
+    uint64_t cas;
+    size_t offset;
+    size_t data_len;
+  } stream;
+  // flights sent over this connection in the order of their req_ids
+  omc_flight_t **flights;
+  uint32_t flight_head;
+  uint32_t flight_count;
+  uint32_t flight_size;
   bool disabled;
+  // set on a server when all of its connections are disabled, keys are
+  // only distributed away from servers that are down
+  bool down;
   bool connected;
   int64_t retry_at;
   int64_t dead_timeout_start;
   int64_t expected_noop;
+#ifdef WITH_EPOLL
+  uint32_t ep_events;
+  uint32_t ep_round;
+  bool ep_registered;
+  bool ep_armed;
+  bool ep_dirty;
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+  uint64_t ur_poll;
+  short ur_wait;
+  bool ur_ready;
+  bool ur_failed;
+#endif // WITH_IO_URING
 } omc_srv_t;
 
+// requests of a call sent to a single connection, they have contiguous ids
+typedef struct omc_call_span_s
+{
+  omc_srv_t *srv;
+  uint32_t first_req;
+  uint32_t last_req;
+} omc_call_span_t;
+
+// state of an omcache_command() call waiting for the responses to its
+// requests.  a thread-safe handle has a call for each thread using it so
+// that the threads can wait for their responses at the same time, the
+// responses are routed to the active call whose request ids they match.
+typedef struct omc_call_s
+{
+  struct omc_call_s *prev, *next;
+  bool active;
+  uint32_t min_req;
+  uint32_t max_req;
+  uint32_t count;
+  uint32_t found;
+  omc_seq_table_t *table;
+  // values, values_size and values_returned are reset on each omcache_io call
+  omcache_value_t *values;
+  size_t values_size;
+  size_t values_returned;
+  omc_call_span_t *spans;
+  size_t span_count;
+  size_t spans_size;
+  // values served from the near cache are copied to 'near_buf' so that
+  // they remain valid while the rest of the call updates the cache
+  unsigned char *near_buf;
+  size_t near_buf_size;
+#ifdef WITH_THREADS
+  omcache_t *mc;
+  bool waiting;
+  pthread_cond_t cond;
+  // receive buffers holding the values returned to this call, other
+  // threads may replace them before this call's thread is done with the
+  // values.  released when the thread starts its next call.
+  omcache_pin_t **pins;
+  size_t pin_count;
+  size_t pins_size;
+#endif // WITH_THREADS
+} omc_call_t;
+
+// lookup table of table based distribution methods like Maglev.  'owners'
+// maps table slots to servers when all servers are enabled and 'live'
+// when the currently disabled servers are left out.
+typedef struct omc_dist_table_s
+{
+  uint32_t size;
+  uint32_t server_count;
+  uint32_t *server_hashes;
+  uint8_t *enabled;
+  uint32_t *owners;
+  uint32_t *live;
+  uint32_t data[];
+} omc_dist_table_t;
+
+// per-server state of rendezvous distribution methods: 'seeds' and
+// 'weights' are the score function's inputs and 'scores' its output
+typedef struct omc_dist_hrw_s
+{
+  uint32_t server_count;
+  uint32_t *seeds;
+  float *weights;
+  float *scores;
+  uint32_t data[];
+} omc_dist_hrw_t;
+
+// coalescing state of a request in omc_command
+typedef struct omc_coalesce_s
+{
+  // flight the request follows, or the flight it leads once sent
+  omc_flight_t *flight;
+  // index of the request of the same call this request follows or -1
+  ssize_t leader;
+  uint32_t key_hash;
+  bool follower;
+  bool leads;
+  // the key is written later in the same call, the flight is only
+  // followed by this call's earlier lookups
+  bool detached;
+} omc_coalesce_t;
+
+// requests sent to a single connection by omc_command
+typedef struct omc_rps_bucket_s
+{
+  omcache_req_t *reqs;
+  size_t count;
+} omc_rps_bucket_t;
+
 typedef struct omc_ketama_point_s
 {
   uint32_t hash_value;
-  omc_srv_t *srv;
+  uint32_t server_index;
 } omc_ketama_point_t;
 
+// the hash space is split into up to 2^16 equal slices and the index of
+// the first point in each slice is stored in 'buckets' so lookups only
+// need to search the points of a single slice
+#define OMC_KETAMA_BUCKET_BITS_MAX 16
+
 typedef struct omc_ketama_s
 {
   uint32_t point_count;
-  omc_ketama_point_t points[];
+  uint32_t bucket_shift;
+  uint32_t *buckets;
+  // sorted point hashes and the indexes of the servers they belong to are
+  // kept in parallel arrays so the searched hashes are densely packed
+  uint32_t *hashes;
+  uint32_t *server_indexes;
+  // points_per_server if every server got the same number of points
+  // and the continuum can be updated incrementally, zero otherwise
+  uint32_t uniform_points;
+  uint32_t data[];
 } omc_ketama_t;
 
 struct omcache_s
@@ -111,14 +344,78 @@ struct omcache_s
   omc_srv_t **servers;
   struct pollfd *server_polls;
   ssize_t server_count;
+  // connections to all servers, conns_per_server consecutive entries for
+  // each server in the order of 'servers'
+  omc_srv_t **conns;
+  ssize_t conn_count;
+  uint32_t conns_per_server;
   omc_int_hash_table_t *fd_table;
 #ifdef WITH_ASYNCNS
   asyncns_t *ans;
   int ans_fd;
 #endif // WITH_ASYNCNS
+#ifdef WITH_EPOLL
+  struct
+  {
+    int fd;
+    uint32_t round;
+    size_t armed;
+    int64_t timeout_at;
+    // servers whose poll interests must be re-evaluated before waiting
+    omc_srv_t **dirty;
+    size_t dirty_count;
+  } ep;
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+  struct
+  {
+    int fd;
+    uint32_t epoch;
+    uint32_t inflight;
+    uint32_t to_submit;
+    uint32_t sq_tail;
+    uint32_t sq_entries;
+    uint32_t *sq_khead, *sq_ktail, *sq_kmask, *sq_array;
+    uint32_t *cq_khead, *cq_ktail, *cq_kmask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *ring;
+    size_t ring_size;
+    size_t sqes_size;
+#ifdef WITH_ASYNCNS
+    uint64_t ans_poll;
+    bool ans_ready;
+#endif // WITH_ASYNCNS
+  } ur;
+#endif // WITH_IO_URING
+#ifdef WITH_THREADS
+  // 'polling' is set while a thread waiting for its call polls the
+  // connections without holding the lock, the thread polling the
+  // connections is woken up through 'wake_fds' when requests are sent
+  struct
+  {
+    bool enabled;
+    pthread_mutex_t lock;
+    uint32_t depth;
+    pthread_key_t call_key;
+    bool polling;
+    bool wake_pending;
+    int wake_fds[2];
+    struct pollfd *pfds;
+    size_t pfds_size;
+  } ts;
+  struct
+  {
+    bool running;
+    bool stop;
+    pthread_t thread;
+  } iot;
+#endif // WITH_THREADS
 
   // distribution
   omc_ketama_t *ketama;
+  omc_dist_table_t *dist_table;
+  omc_dist_hrw_t *dist_hrw;
   omcache_dist_t *dist_method;
 
   // settings
@@ -128,27 +425,93 @@ struct omcache_s
 
   omcache_response_callback_func *resp_cb;
   void *resp_cb_context;
+  omcache_stream_callback_func *stream_cb;
+  void *stream_cb_context;
+  size_t stream_min_size;
 
   size_t recv_buffer_max;
   size_t send_buffer_max;
+  // receive segments not used by any connection and the receive buffers
+  // holding values returned in the current iteration that connections
+  // had to replace
+  struct
+  {
+    unsigned char *free;
+    uint32_t free_count;
+    omcache_pin_t **retired;
+    size_t retired_count;
+    size_t retired_size;
+  } recv_pool;
   uint32_t connect_timeout_msec;
   uint32_t reconnect_timeout_msec;
   uint32_t dead_timeout_msec;
   bool buffer_writes;
 
+  // scratch space for splitting requests by connection in omc_command and
+  // keys by server in omcache_server_indexes_for_keys, grown as needed and
+  // reused so that steady state commands don't allocate memory
   struct
   {
-    bool active;
-    uint32_t iteration;
-    uint32_t min_req;
-    uint32_t max_req;
+    uint32_t *hashes;
+    size_t hashes_size;
+    int *conns;
+    size_t conns_size;
+    omcache_req_t *reqs;
+    size_t reqs_size;
+    omc_rps_bucket_t *buckets;
+    size_t buckets_size;
+    struct iovec *iov;
+    size_t iov_size;
+    omc_coalesce_t *coalesce;
+    size_t coalesce_size;
+    size_t *order;
+    size_t order_size;
+    size_t *offsets;
+    size_t offsets_size;
+  } split;
+
+  // scratch space for updating the distribution after the server list
+  // changed, grown as needed and kept with the handle
+  struct
+  {
+    ssize_t *server_map;
+    size_t server_map_size;
+    uint32_t *srv_points;
+    size_t srv_points_size;
+    bool *kept;
+    size_t kept_size;
+  } rebuild;
+
+  // lookups in flight by key hash and the lookups of the current call that
+  // others may follow by key hash
+  struct
+  {
+    bool enabled;
     uint32_t count;
-    uint32_t found;
-    omc_hash_table_t *table;
-    // values, values_size and values_returned are reset on each omcache_io call
-    omcache_value_t *values;
-    size_t values_size;
-    size_t values_returned;
+    uint32_t bucket_count;
+    omc_flight_t **buckets;
+    omc_flight_t *freelist;
+    omc_int_hash_table_t *calls;
+  } flights;
+
+  // client-side near cache.  responses to requests sent before
+  // 'fill_after' may predate a write made through this handle and are not
+  // cached, which relies on all requests for a key using one connection.
+  // neither are responses to requests sent before a req_id wraparound.
+  struct
+  {
+    omc_near_cache_t *cache;
+    uint32_t fill_after;
+    bool barrier;
+  } near;
+
+  // 'call' is used when thread-safe mode is off, 'calls' lists it and
+  // the calls of the threads using a thread-safe handle
+  struct
+  {
+    uint32_t iteration;
+    omc_call_t call;
+    omc_call_t *calls;
   } lookup;
 };
 
@@ -157,10 +520,41 @@ static int omc_srv_connect(omcache_t *mc, omc_srv_t *srv);
 static int omc_srv_io(omcache_t *mc, omc_srv_t *srv);
 static void omc_srv_reset(omcache_t *mc, omc_srv_t *srv, const char *log_msg);
 static int omc_srv_send_noop(omcache_t *mc, omc_srv_t *srv);
-static omc_ketama_t *omc_ketama_create(omcache_t *mc);
+static void omc_dist_update(omcache_t *mc, const ssize_t *server_map, ssize_t old_count);
+static void omc_dist_table_update(omcache_t *mc, omc_srv_t *srv);
+static void omc_srv_update_down(omcache_t *mc, omc_srv_t *srv);
 static uint32_t omc_lookup_discard_requests(omcache_t *mc, omc_srv_t *srv, uint32_t max_req);
 static bool omc_is_request_quiet(uint8_t opcode);
-static inline int64_t omc_msec();
+static bool omc_is_request_lookup(uint8_t opcode);
+static void omc_flights_drop(omcache_t *mc, omc_srv_t *srv);
+static void omc_recv_buffer_release(omcache_t *mc, omc_srv_t *srv);
+static void omc_recv_pool_reclaim(omcache_t *mc);
+static void omc_flights_detach_all(omcache_t *mc);
+static void omc_srv_mark_dirty(omcache_t *mc, omc_srv_t *srv);
+static void *omc_scratch_reserve(void *buf, size_t *size, size_t count, size_t elem_size);
+#ifdef WITH_EPOLL
+static void omc_epoll_free(omcache_t *mc);
+static void omc_epoll_reset(omcache_t *mc);
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+static int omc_uring_init(omcache_t *mc);
+static void omc_uring_free(omcache_t *mc);
+static void omc_uring_cancel(omcache_t *mc);
+static void omc_uring_flush(omcache_t *mc);
+#endif // WITH_IO_URING
+#ifdef WITH_THREADS
+static void omc_ts_free(omcache_t *mc);
+static void omc_io_wake(omcache_t *mc);
+static void omc_call_pin(omc_call_t *call, omc_srv_t *srv, const omcache_value_t *value);
+#endif // WITH_THREADS
+static int omc_io(omcache_t *mc,
+                  omcache_req_t *reqs, size_t *req_count,
+                  omcache_value_t *values, size_t *value_count,
+                  int32_t timeout_msec);
+static int omc_command(omcache_t *mc,
+                       omcache_req_t *reqs, size_t *req_countp,
+                       omcache_value_t *values, size_t *value_count,
+                       int32_t timeout_msec);
 
 static int g_iov_max = 0;
 
@@ -178,7 +572,15 @@ omcache_t *omcache_init(void)
   mc->connect_timeout_msec = 10 * 1000;
   mc->reconnect_timeout_msec = 10 * 1000;
   mc->dead_timeout_msec = 10 * 1000;
+  mc->conns_per_server = 1;
   mc->dist_method = &omcache_dist_libmemcached_ketama;
+  mc->lookup.calls = &mc->lookup.call;
+#ifdef WITH_EPOLL
+  mc->ep.fd = -1;
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+  mc->ur.fd = -1;
+#endif // WITH_IO_URING
 #ifdef WITH_ASYNCNS
   mc->ans = asyncns_new(1);
   mc->ans_fd = asyncns_fd(mc->ans);
@@ -188,6 +590,16 @@ omcache_t *omcache_init(void)
 
 int omcache_free(omcache_t *mc)
 {
+#ifdef WITH_THREADS
+  omcache_set_io_thread(mc, false);
+  omc_ts_free(mc);
+#endif // WITH_THREADS
+#ifdef WITH_EPOLL
+  omc_epoll_free(mc);
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+  omc_uring_free(mc);
+#endif // WITH_IO_URING
   if (mc->servers)
     {
       for (off_t i=0; i<mc->server_count; i++)
@@ -201,10 +613,44 @@ int omcache_free(omcache_t *mc)
       memset(mc->servers, 'L', mc->server_count * sizeof(void *));
       free(mc->servers);
     }
+  omc_recv_pool_reclaim(mc);
+  free(mc->recv_pool.retired);
+  while (mc->recv_pool.free)
+    {
+      unsigned char *seg = mc->recv_pool.free;
+      mc->recv_pool.free = *(unsigned char **) seg;
+      free(seg);
+    }
+  while (mc->flights.freelist)
+    {
+      omc_flight_t *flight = mc->flights.freelist;
+      mc->flights.freelist = flight->next;
+      free(flight->followers);
+      free(flight);
+    }
+  free(mc->flights.buckets);
+  omc_int_hash_table_free(mc->flights.calls);
+  free(mc->conns);
   free(mc->server_polls);
   free(mc->ketama);
+  free(mc->dist_table);
+  free(mc->dist_hrw);
+  free(mc->split.hashes);
+  free(mc->split.conns);
+  free(mc->split.reqs);
+  free(mc->split.buckets);
+  free(mc->split.iov);
+  free(mc->split.coalesce);
+  free(mc->split.order);
+  free(mc->split.offsets);
+  free(mc->rebuild.server_map);
+  free(mc->rebuild.srv_points);
+  free(mc->rebuild.kept);
+  omc_near_cache_free(mc->near.cache);
   omc_int_hash_table_free(mc->fd_table);
-  omc_hash_table_free(mc->lookup.table);
+  omc_seq_table_free(mc->lookup.call.table);
+  free(mc->lookup.call.spans);
+  free(mc->lookup.call.near_buf);
 #ifdef WITH_ASYNCNS
   asyncns_free(mc->ans);
 #endif // WITH_ASYNCNS
@@ -263,26 +709,14 @@ void omcache_log_stderr(void *context,
           "?", msg);
 }
 
-static inline int64_t omc_msec()
-{
-  struct timespec ts;
-#ifdef CLOCK_MONOTONIC_COARSE
-  if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == -1)
-#endif
-#ifdef CLOCK_MONOTONIC
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-#else
-    clock_gettime(CLOCK_REALTIME, &ts);
-#endif
-  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
-}
-
 static omc_srv_t *omc_srv_init(const char *hostname)
 {
   const char *p;
   omc_srv_t *srv = calloc(1, sizeof(*srv));
   srv->sock = -1;
   srv->list_index = -1;
+  srv->conn_index = -1;
+  srv->weight = 1;
   if (*hostname == '[' && (p = strchr(hostname, ']')) != NULL)
     {
       // handle [addr]:port form
@@ -307,6 +741,19 @@ static omc_srv_t *omc_srv_init(const char *hostname)
   return srv;
 }
 
+// set up an additional connection to the given server
+static omc_srv_t *omc_srv_init_conn(omc_srv_t *server)
+{
+  omc_srv_t *srv = calloc(1, sizeof(*srv));
+  srv->sock = -1;
+  srv->list_index = -1;
+  srv->conn_index = -1;
+  srv->server = server;
+  srv->hostname = strdup(server->hostname);
+  srv->port = strdup(server->port);
+  return srv;
+}
+
 static void omc_srv_free_addrs(omcache_t *mc omc_attribute_unused, omc_srv_t *srv)
 {
 #ifdef WITH_ASYNCNS
@@ -333,6 +780,9 @@ static void omc_srv_free_addrs(omcache_t *mc omc_attribute_unused, omc_srv_t *sr
 
 static int omc_srv_free(omcache_t *mc, omc_srv_t *srv)
 {
+  for (uint32_t i = 1; i < srv->conn_count; i ++)
+    omc_srv_free(mc, srv->conns[i]);
+  free(srv->conns);
   if (srv->sock >= 0)
     {
       shutdown(srv->sock, SHUT_RDWR);
@@ -341,10 +791,14 @@ static int omc_srv_free(omcache_t *mc, omc_srv_t *srv)
       srv->sock = -1;
     }
   omc_srv_free_addrs(mc, srv);
+  omc_flights_drop(mc, srv);
+  free(srv->flights);
   free(srv->send_buffer.base);
-  free(srv->recv_buffer.base);
+  omc_recv_buffer_release(mc, srv);
   free(srv->hostname);
   free(srv->port);
+  free(srv->point_hashes);
+  free(srv->point_hash_sizes);
   memset(srv, 'S', sizeof(*srv));
   free(srv);
   return OMCACHE_OK;
@@ -363,11 +817,57 @@ static int omc_srvp_cmp(const void *sp1, const void *sp2)
   return omc_srv_cmp(*(omc_srv_t * const *) sp1, *(omc_srv_t * const *) sp2);
 }
 
+// set up or free each server's additional connections to match
+// conns_per_server and rebuild the connection array and fd_table
+static void omc_conns_update(omcache_t *mc)
+{
+  uint32_t cps = mc->conns_per_server;
+  ssize_t conn_count = mc->server_count * cps;
+
+  if (mc->conn_count != conn_count)
+    {
+      mc->conns = realloc(mc->conns, conn_count * sizeof(*mc->conns));
+      mc->server_polls = realloc(mc->server_polls, conn_count * sizeof(*mc->server_polls));
+    }
+  mc->conn_count = conn_count;
+  mc->fd_table = omc_int_hash_table_init(mc->fd_table, mc->conn_count);
+
+  for (ssize_t i = 0; i < mc->server_count; i ++)
+    {
+      omc_srv_t *server = mc->servers[i];
+      if (server->conn_count != cps)
+        {
+          for (uint32_t c = cps; c < server->conn_count; c ++)
+            omc_srv_free(mc, server->conns[c]);
+          server->conns = realloc(server->conns, cps * sizeof(*server->conns));
+          for (uint32_t c = max(server->conn_count, 1u); c < cps; c ++)
+            server->conns[c] = omc_srv_init_conn(server);
+          server->conns[0] = server;
+          server->server = server;
+          server->conn_count = cps;
+          omc_srv_update_down(mc, server);
+        }
+      for (uint32_t c = 0; c < cps; c ++)
+        {
+          omc_srv_t *srv = server->conns[c];
+          srv->list_index = i;
+          srv->conn_index = i * cps + c;
+          mc->conns[srv->conn_index] = srv;
+          if (srv->sock >= 0)
+            omc_int_hash_table_add(mc->fd_table, srv->sock, srv->conn_index);
+        }
+    }
+#ifdef WITH_EPOLL
+  if (mc->ep.fd >= 0)
+    omc_epoll_reset(mc);
+#endif // WITH_EPOLL
+}
+
 int omcache_set_servers(omcache_t *mc, const char *servers)
 {
   omc_srv_t **srv_new = NULL;
   ssize_t srv_new_count = 0, srv_new_size = 0, srv_len;
-  char *srv_dup = strdup(servers), *srv, *p;
+  char *srv_dup = strdup(servers), *srv, *p, *w;
 
   // parse and sort comma-delimited list of servers and strip whitespace
   for (srv=srv_dup; srv; srv=p)
@@ -382,22 +882,49 @@ int omcache_set_servers(omcache_t *mc, const char *servers)
         srv[--srv_len] = 0;
       if (srv_len == 0)
         continue;
+      // handle optional host:port/weight form
+      uint32_t weight = 1;
+      if ((w = strrchr(srv, '/')) != NULL)
+        {
+          char *end;
+          for (end = w; end > srv && isspace(end[-1]); end --)
+            ;
+          *end = 0;
+          while (isspace(*++w))
+            ;
+          unsigned long wval = strtoul(w, &end, 10);
+          if (!isdigit(*w) || *end != 0 || wval == 0 || wval > UINT32_MAX)
+            omc_log(LOG_WARNING, "invalid weight '%s' for server %s, using 1", w, srv);
+          else
+            weight = wval;
+        }
       if (srv_new_count >= srv_new_size)
         {
           srv_new_size += 16;
           srv_new = realloc(srv_new, sizeof(*srv_new) * srv_new_size);
         }
-      srv_new[srv_new_count++] = omc_srv_init(srv);
+      srv_new[srv_new_count] = omc_srv_init(srv);
+      srv_new[srv_new_count++]->weight = weight;
     }
   free(srv_dup);
 
   qsort(srv_new, srv_new_count, sizeof(*srv_new), omc_srvp_cmp);
 
-  // preallocated poll-structures for all servers
-  if (mc->server_count != srv_new_count)
-    mc->server_polls = realloc(mc->server_polls, srv_new_count * sizeof(*mc->server_polls));
-
-  // remove old servers that weren't on the new list and add the new ones
+  omc_lock(mc);
+
+#ifdef WITH_IO_URING
+  // io_uring operations refer to servers by their list index
+  if (omc_uring_enabled(mc))
+    omc_uring_cancel(mc);
+#endif // WITH_IO_URING
+
+  // remove old servers that weren't on the new list and add the new ones,
+  // server_map records the old servers' new indexes for the distribution
+  ssize_t old_count = mc->server_count;
+  mc->rebuild.server_map = omc_scratch_reserve(mc->rebuild.server_map, &mc->rebuild.server_map_size,
+                                               max(old_count, 1), sizeof(ssize_t));
+  ssize_t *server_map = mc->rebuild.server_map;
+  bool changed = old_count != srv_new_count;
   if (mc->server_count)
     {
       ssize_t i=0, j=0;
@@ -407,14 +934,19 @@ int omcache_set_servers(omcache_t *mc, const char *servers)
           if (res == 0)
             {
               // the same server is on both lists:
-              // move it to the new list
+              // move it to the new list but use its new weight
+              changed = changed || i != j || mc->servers[i]->weight != srv_new[j]->weight;
+              mc->servers[i]->weight = srv_new[j]->weight;
               omc_srv_free(mc, srv_new[j]);
+              server_map[i] = j;
               srv_new[j++] = mc->servers[i++];
             }
           else if (res < 0)
             {
               // server on old list is before the server on new list:
               // it's not on the new list at all
+              server_map[i] = -1;
+              changed = true;
               omc_srv_free(mc, mc->servers[i++]);
             }
           else if (res > 0)
@@ -430,284 +962,1276 @@ int omcache_set_servers(omcache_t *mc, const char *servers)
   mc->servers = srv_new;
   mc->server_count = srv_new_count;
 
-  // reset list indices and fd_table
-  mc->fd_table = omc_int_hash_table_init(mc->fd_table, mc->server_count);
+  // reset list indices, connections and fd_table
   for (ssize_t i=0; i<mc->server_count; i++)
-    {
-      omc_srv_debug(mc->servers[i], "server #%zd", i);
-      mc->servers[i]->list_index = i;
-      if (mc->servers[i]->sock >= 0)
-        omc_int_hash_table_add(mc->fd_table, mc->servers[i]->sock, i);
-    }
+    omc_srv_debug(mc->servers[i], "server #%zd", i);
+  omc_conns_update(mc);
 
-  // rerun distribution
-  free(mc->ketama);
-  mc->ketama = omc_ketama_create(mc);
+  // the distribution doesn't change if the same list was given again
+  if (changed)
+    omc_dist_update(mc, server_map, old_count);
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_distribution_method(omcache_t *mc, omcache_dist_t *method)
 {
+  omc_lock(mc);
   mc->dist_method = method;
-  // rerun distribution
-  free(mc->ketama);
-  mc->ketama = omc_ketama_create(mc);
+  omc_dist_update(mc, NULL, 0);
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_log_callback(omcache_t *mc, int level, omcache_log_callback_func *func, void *context)
 {
+  omc_lock(mc);
   mc->log_cb = func;
   mc->log_context = context;
   mc->log_level = level ? level : LOG_DEBUG - 1;
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_connect_timeout(omcache_t *mc, uint32_t msec)
 {
+  omc_lock(mc);
   mc->connect_timeout_msec = msec;
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_reconnect_timeout(omcache_t *mc, uint32_t msec)
 {
+  omc_lock(mc);
   mc->reconnect_timeout_msec = msec;
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_dead_timeout(omcache_t *mc, uint32_t msec)
 {
+  omc_lock(mc);
   mc->dead_timeout_msec = msec;
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_recv_buffer_max_size(omcache_t *mc, size_t size)
 {
+  omc_lock(mc);
   mc->recv_buffer_max = size;
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_send_buffer_max_size(omcache_t *mc, size_t size)
 {
+  omc_lock(mc);
   mc->send_buffer_max = size;
+  omc_unlock(mc);
+  return OMCACHE_OK;
+}
+
+int omcache_set_connections_per_server(omcache_t *mc, uint32_t count)
+{
+  if (count == 0 || count > OMC_MAX_CONNS_PER_SERVER)
+    return OMCACHE_INVALID;
+  omc_lock(mc);
+  if (count != mc->conns_per_server)
+    {
+#ifdef WITH_IO_URING
+      // io_uring operations refer to connections by their index
+      if (omc_uring_enabled(mc))
+        omc_uring_cancel(mc);
+#endif // WITH_IO_URING
+      mc->conns_per_server = count;
+      omc_conns_update(mc);
+    }
+  omc_unlock(mc);
+  return OMCACHE_OK;
+}
+
+int omcache_set_coalescing(omcache_t *mc, uint32_t enabled)
+{
+  omc_lock(mc);
+  mc->flights.enabled = enabled ? true : false;
+  // lookups in flight keep landing but can't be followed anymore
+  if (!enabled)
+    omc_flights_detach_all(mc);
+  omc_unlock(mc);
+  return OMCACHE_OK;
+}
+
+int omcache_set_near_cache(omcache_t *mc, size_t max_bytes, uint32_t ttl_msec)
+{
+  if (max_bytes && ttl_msec == 0)
+    return OMCACHE_INVALID;
+  omc_lock(mc);
+  if (max_bytes)
+    mc->near.cache = omc_near_cache_init(mc->near.cache, max_bytes, ttl_msec);
+  else
+    {
+      omc_near_cache_free(mc->near.cache);
+      mc->near.cache = NULL;
+    }
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_set_response_callback(omcache_t *mc, omcache_response_callback_func *resp_cb, void *resp_cb_context)
 {
+  omc_lock(mc);
   mc->resp_cb = resp_cb;
   mc->resp_cb_context = resp_cb_context;
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
-struct pollfd *omcache_poll_fds(omcache_t *mc, int *nfds, int *poll_timeout)
+int omcache_set_stream_callback(omcache_t *mc, size_t min_size,
+                                omcache_stream_callback_func *stream_cb, void *stream_cb_context)
 {
-  int n, i;
-#ifdef WITH_ASYNCNS
-  bool poll_ans = false;
-#endif // WITH_ASYNCNS
-  int64_t now = omc_msec();
-  *poll_timeout = mc->dead_timeout_msec;
+  omc_lock(mc);
+  mc->stream_cb = stream_cb;
+  mc->stream_cb_context = stream_cb_context;
+  mc->stream_min_size = min_size;
+  omc_unlock(mc);
+  return OMCACHE_OK;
+}
+
+#ifdef WITH_THREADS
+static void omc_call_unpin(omc_call_t *call)
+{
+  for (size_t i = 0; i < call->pin_count; i ++)
+    omcache_value_unpin(call->pins[i]);
+  call->pin_count = 0;
+}
+
+static void omc_call_free(void *ptr)
+{
+  omc_call_t *call = ptr;
+  omcache_t *mc = call->mc;
+  // called when a thread exits or when the handle is freed
+  omc_lock(mc);
+  if (call->prev)
+    call->prev->next = call->next;
+  else
+    mc->lookup.calls = call->next;
+  if (call->next)
+    call->next->prev = call->prev;
+  omc_call_unpin(call);
+  omc_unlock(mc);
+  pthread_cond_destroy(&call->cond);
+  omc_seq_table_free(call->table);
+  free(call->spans);
+  free(call->near_buf);
+  free(call->pins);
+  free(call);
+}
+
+static void omc_ts_free(omcache_t *mc)
+{
+  if (!mc->ts.enabled)
+    return;
+  pthread_key_delete(mc->ts.call_key);
+  for (omc_call_t *call = mc->lookup.calls, *next; call; call = next)
+    {
+      next = call->next;
+      if (call != &mc->lookup.call)
+        omc_call_free(call);
+    }
+  close(mc->ts.wake_fds[0]);
+  close(mc->ts.wake_fds[1]);
+  free(mc->ts.pfds);
+  mc->ts.pfds = NULL;
+  mc->ts.pfds_size = 0;
+  mc->ts.enabled = false;
+  pthread_mutex_destroy(&mc->ts.lock);
+}
 
-  for (i=n=0; i<mc->server_count; i++)
+// sleep until the call is complete, polling is handed over to it or the
+// timeout expires
+static void omc_call_wait(omcache_t *mc, omc_call_t *call, int32_t timeout_msec)
+{
+  call->waiting = true;
+  mc->ts.depth --;
+  if (timeout_msec < 0)
+    {
+      pthread_cond_wait(&call->cond, &mc->ts.lock);
+    }
+  else
     {
-      omc_srv_t *srv = mc->servers[i];
-      mc->server_polls[n].events = 0;
-      if (srv->last_req_sent != srv->last_req_sent_nq)
+      struct timespec ts;
+      clock_gettime(CLOCK_REALTIME, &ts);
+      ts.tv_sec += timeout_msec / 1000;
+      ts.tv_nsec += (timeout_msec % 1000) * 1000000;
+      if (ts.tv_nsec >= 1000000000)
         {
-          omc_srv_send_noop(mc, srv);
+          ts.tv_sec ++;
+          ts.tv_nsec -= 1000000000;
         }
-      if (srv->last_req_recvd < srv->last_req_sent_nq)
+      pthread_cond_timedwait(&call->cond, &mc->ts.lock, &ts);
+    }
+  mc->ts.depth ++;
+  call->waiting = false;
+}
+
+// let a thread waiting for its call take over polling the connections
+// after the thread that polled them stopped doing so
+static void omc_io_handoff(omcache_t *mc)
+{
+  if (mc->iot.running || mc->ts.polling)
+    return;
+  for (omc_call_t *call = mc->lookup.calls; call; call = call->next)
+    if (call->waiting)
+      {
+        pthread_cond_signal(&call->cond);
+        break;
+      }
+}
+#endif // WITH_THREADS
+
+// the calling thread's call, a thread-safe handle has one for each thread
+static omc_call_t *omc_call_get(omcache_t *mc)
+{
+#ifdef WITH_THREADS
+  if (mc->ts.enabled)
+    {
+      omc_call_t *call = pthread_getspecific(mc->ts.call_key);
+      if (call == NULL)
         {
-          omc_srv_debug(srv, "polling %d for POLLIN", srv->sock);
-          mc->server_polls[n].events |= POLLIN;
+          call = calloc(1, sizeof(*call));
+          call->mc = mc;
+          pthread_cond_init(&call->cond, NULL);
+          call->next = mc->lookup.calls;
+          call->next->prev = call;
+          mc->lookup.calls = call;
+          pthread_setspecific(mc->ts.call_key, call);
         }
-      if (srv->send_buffer.w != srv->send_buffer.r || srv->conn_timeout > 0)
+      return call;
+    }
+#endif // WITH_THREADS
+  return &mc->lookup.call;
+}
+
+// start a new call: the values returned by the thread's previous call
+// are no longer needed
+static omc_call_t *omc_call_begin(omcache_t *mc)
+{
+  omc_call_t *call = omc_call_get(mc);
+  call->active = false;
+  call->count = 0;
+  call->found = 0;
+  call->min_req = UINT32_MAX;
+  call->max_req = 0;
+  call->span_count = 0;
+#ifdef WITH_THREADS
+  omc_call_unpin(call);
+#endif // WITH_THREADS
+  return call;
+}
+
+int omcache_set_thread_safe(omcache_t *mc omc_attribute_unused, uint32_t enabled)
+{
+#ifdef WITH_THREADS
+  if (enabled && !mc->ts.enabled)
+    {
+      pthread_mutexattr_t attr;
+      pthread_mutexattr_init(&attr);
+      // callbacks may call back to OMcache while the handle is locked
+      pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+      pthread_mutex_init(&mc->ts.lock, &attr);
+      pthread_mutexattr_destroy(&attr);
+      if (pthread_key_create(&mc->ts.call_key, omc_call_free) != 0)
         {
-          omc_srv_debug(srv, "polling %d for POLLOUT", srv->sock);
-          mc->server_polls[n].events |= POLLOUT;
+          omc_log(LOG_ERR, "pthread_key_create failed: %s", strerror(errno));
+          pthread_mutex_destroy(&mc->ts.lock);
+          return OMCACHE_FAIL;
         }
-      if (mc->server_polls[n].events != 0 || srv->conn_timeout > 0)
+      if (pipe(mc->ts.wake_fds) != 0)
         {
-          if (srv->sock < 0)
-            omc_srv_connect(mc, srv);
-          // make sure poll timeout is at connection timeout, and in
-          // case it has already expired, set connection timeout to a
-          // special value (1) so next time we get here we know we
-          // weren't able to establish a connection in time.
-          if (srv->conn_timeout > 0)
-            {
-              omc_srv_debug(srv, "polling %d for POLLIN (connect)", srv->sock);
-              mc->server_polls[n].events |= POLLIN;
-              if (srv->conn_timeout == 1)
-                {
-                  errno = ETIME;
-                  omc_srv_reset(mc, srv, "timeout waiting for connect");
-                }
-              else if (now >= srv->conn_timeout)
-                {
-                  srv->conn_timeout = 1;
-                  *poll_timeout = 1;
-                }
-              else
-                {
-                  *poll_timeout = min(*poll_timeout, srv->conn_timeout - now);
-                }
-            }
-          if (srv->sock >= 0)
-            {
-              mc->server_polls[n].fd = srv->sock;
-              mc->server_polls[n].revents = 0;
-              n ++;
-            }
+          omc_log(LOG_ERR, "pipe failed: %s", strerror(errno));
+          pthread_key_delete(mc->ts.call_key);
+          pthread_mutex_destroy(&mc->ts.lock);
+          return OMCACHE_FAIL;
         }
-#ifdef WITH_ASYNCNS
-      if (srv->nsq && !poll_ans)
+      for (int i = 0; i < 2; i ++)
         {
-          // NOTE: we don't allocate extra space in 'server_polls' for async
-          // ns polling because we can't poll for both the server and for
-          // async ns resuls for it.
-          omc_srv_debug(srv, "polling asyncns fd %d for POLLIN", mc->ans_fd);
-          poll_ans = true;
-          mc->server_polls[n].fd = mc->ans_fd;
-          mc->server_polls[n].events = POLLIN;
-          mc->server_polls[n++].revents = 0;
+          fcntl(mc->ts.wake_fds[i], F_SETFL, fcntl(mc->ts.wake_fds[i], F_GETFL) | O_NONBLOCK);
+          fcntl(mc->ts.wake_fds[i], F_SETFD, FD_CLOEXEC);
         }
-#endif // WITH_ASYNCNS
+      mc->ts.depth = 0;
+      mc->ts.polling = false;
+      mc->ts.wake_pending = false;
+      mc->ts.enabled = true;
     }
-  *nfds = n;
-  return mc->server_polls;
+  else if (!enabled)
+    {
+      if (mc->iot.running)
+        return OMCACHE_INVALID;
+      omc_ts_free(mc);
+    }
+  return OMCACHE_OK;
+#else
+  return enabled ? OMCACHE_INVALID : OMCACHE_OK;
+#endif // WITH_THREADS
 }
 
-static int omc_ketama_point_cmp(const void *v1, const void *v2)
+#ifdef WITH_THREADS
+// wake up the thread polling the connections without holding the lock,
+// the I/O thread or a thread waiting for its call, so that it notices new
+// requests.  called with the lock held.
+static void omc_io_wake(omcache_t *mc)
 {
-  const omc_ketama_point_t *p1 = v1, *p2 = v2;
-  if (p1->hash_value == p2->hash_value)
-    return 0;
-  return p1->hash_value > p2->hash_value ? 1 : -1;
+  if (!(mc->iot.running || mc->ts.polling) || mc->ts.wake_pending)
+    return;
+  mc->ts.wake_pending = true;
+  if (write(mc->ts.wake_fds[1], "", 1) != 1)
+    omc_log(LOG_ERR, "write to wakeup pipe failed: %s", strerror(errno));
 }
 
-static omc_ketama_t *omc_ketama_create(omcache_t *mc)
+static void omc_io_wake_clear(omcache_t *mc)
 {
-  uint32_t pps = mc->dist_method->points_per_server;
-  uint32_t eps = mc->dist_method->entries_per_point;
-  size_t cidx = 0, total_points = mc->server_count * pps * eps;
-  omc_ketama_t *ktm = (omc_ketama_t *) malloc(sizeof(omc_ketama_t) + total_points * sizeof(omc_ketama_point_t));
+  char buf[64];
+  while (read(mc->ts.wake_fds[0], buf, sizeof(buf)) > 0)
+    ;
+  mc->ts.wake_pending = false;
+}
 
-  for (ssize_t i = 0; i < mc->server_count; i ++)
+// event loop of the background I/O thread: poll the sockets that have
+// pending work without holding the lock and process them with omc_io()
+static void *omc_io_thread(void *arg)
+{
+  omcache_t *mc = arg;
+  struct pollfd *pfds = NULL;
+  int pfds_size = 0;
+
+  omc_lock(mc);
+  while (!mc->iot.stop)
     {
-      omc_srv_t *srv = mc->servers[i];
-      uint32_t hashes[eps];
-      for (size_t p = 0; p < pps; p ++)
+      omc_io(mc, NULL, NULL, NULL, NULL, 0);
+      int nfds, poll_timeout;
+      struct pollfd *srv_pfds = omcache_poll_fds(mc, &nfds, &poll_timeout);
+      if (nfds + 1 > pfds_size)
         {
-          uint32_t sp_count = mc->dist_method->point_hash_func(srv->hostname, srv->port, p, hashes);
-          for (uint32_t e = 0; e < sp_count; e ++)
-            ktm->points[cidx++] = (omc_ketama_point_t) { .srv = srv, .hash_value = hashes[e] };
+          pfds_size = nfds + 1;
+          pfds = realloc(pfds, pfds_size * sizeof(*pfds));
         }
+      pfds[0].fd = mc->ts.wake_fds[0];
+      pfds[0].events = POLLIN;
+      pfds[0].revents = 0;
+      memcpy(pfds + 1, srv_pfds, nfds * sizeof(*pfds));
+      omc_unlock(mc);
+
+      // the copied descriptors may be closed by other threads in the
+      // meantime, that only causes an extra round
+      poll(pfds, nfds + 1, nfds ? poll_timeout : -1);
+
+      omc_lock(mc);
+      if (pfds[0].revents)
+        omc_io_wake_clear(mc);
     }
-
-  ktm->point_count = cidx;
-  qsort(ktm->points, ktm->point_count, sizeof(omc_ketama_point_t), omc_ketama_point_cmp);
-
-  return ktm;
+  omc_unlock(mc);
+  free(pfds);
+  return NULL;
 }
+#endif // WITH_THREADS
 
-static int omc_ketama_lookup(omcache_t *mc, const unsigned char *key, size_t key_len)
+int omcache_set_io_thread(omcache_t *mc omc_attribute_unused, uint32_t enabled)
 {
-  uint32_t hash_value = mc->dist_method->key_hash_func(key, key_len);
-  const omc_ketama_point_t *first = mc->ketama->points, *last = mc->ketama->points + mc->ketama->point_count;
-  const omc_ketama_point_t *left = first, *right = last, *selected;
-  bool wrap = false;
-  int64_t now = 0;
-
-  while (left < right)
+#ifdef WITH_THREADS
+  if (enabled && !mc->iot.running)
     {
-      const omc_ketama_point_t *middle = left + (right - left) / 2;
-      if (middle->hash_value < hash_value)
-        left = middle + 1;
-      else
-        right = middle;
+      int ret = omcache_set_thread_safe(mc, true);
+      if (ret != OMCACHE_OK)
+        return ret;
+      omc_lock(mc);
+      mc->iot.stop = false;
+      if ((errno = pthread_create(&mc->iot.thread, NULL, omc_io_thread, mc)) != 0)
+        {
+          omc_log(LOG_ERR, "pthread_create failed: %s", strerror(errno));
+          omc_unlock(mc);
+          return OMCACHE_FAIL;
+        }
+      mc->iot.running = true;
+      omc_unlock(mc);
+    }
+  else if (!enabled && mc->iot.running)
+    {
+      omc_lock(mc);
+      mc->iot.stop = true;
+      omc_io_wake(mc);
+      omc_unlock(mc);
+      pthread_join(mc->iot.thread, NULL);
+      omc_lock(mc);
+      mc->iot.running = false;
+      // threads waiting for their calls must poll the connections now
+      omc_io_handoff(mc);
+      omc_unlock(mc);
     }
+  return OMCACHE_OK;
+#else
+  return enabled ? OMCACHE_INVALID : OMCACHE_OK;
+#endif // WITH_THREADS
+}
 
-  // skip disabled servers
-  size_t skipped = 0;
-  for (selected = (right == last) ? first : right;
-      selected == last || selected->srv->disabled;
-      selected++)
+static int omc_set_io_backend(omcache_t *mc omc_attribute_unused, int backend)
+{
+  switch (backend)
     {
-      if (selected != last)
+    case OMCACHE_IO_POLL:
+#ifdef WITH_EPOLL
+      omc_epoll_free(mc);
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+      omc_uring_free(mc);
+#endif // WITH_IO_URING
+      return OMCACHE_OK;
+
+#ifdef WITH_EPOLL
+    case OMCACHE_IO_EPOLL:
+      if (mc->ep.fd >= 0)
+        return OMCACHE_OK;
+#ifdef WITH_IO_URING
+      omc_uring_free(mc);
+#endif // WITH_IO_URING
+      mc->ep.fd = epoll_create1(EPOLL_CLOEXEC);
+      if (mc->ep.fd < 0)
         {
-          // try to bring disabled servers back online but don't select them
-          // yet as we need to (asynchronously) verify that they're usable
-          if (selected->srv->disabled)
-            {
-              if (now == 0)
-                now = omc_msec();
-              // only attempt io with servers once per millisecond
-              if (now > selected->srv->retry_at)
-                {
-                  selected->srv->retry_at = now;
-                  omc_srv_io(mc, selected->srv);
-                }
-            }
-          skipped ++;
-          continue;
+          omc_log(LOG_ERR, "epoll_create1 failed: %s", strerror(errno));
+          return OMCACHE_FAIL;
         }
-      if (wrap)
+#ifdef WITH_ASYNCNS
+      // asyncns results are signaled with a NULL server pointer
+      struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+      epoll_ctl(mc->ep.fd, EPOLL_CTL_ADD, mc->ans_fd, &ev);
+#endif // WITH_ASYNCNS
+      for (ssize_t i = 0; i < mc->conn_count; i ++)
+        mc->conns[i]->ep_registered = false;
+      omc_epoll_reset(mc);
+      return OMCACHE_OK;
+#endif // WITH_EPOLL
+
+#ifdef WITH_IO_URING
+    case OMCACHE_IO_URING:
+      if (omc_uring_enabled(mc))
+        return OMCACHE_OK;
+#ifdef WITH_EPOLL
+      omc_epoll_free(mc);
+#endif // WITH_EPOLL
+      if (omc_uring_init(mc) < 0)
         {
-          omc_log(LOG_ERR, "%s", "all servers are disabled");
-          return -1;
+          omc_log(LOG_ERR, "io_uring setup failed: %s", strerror(errno));
+          return OMCACHE_FAIL;
         }
-      wrap = true;
-      selected = first;
-    }
-  if (skipped)
-    omc_log(LOG_INFO, "ketama skipped %zu disabled server points", skipped);
-  return selected->srv->list_index;
-}
+      return OMCACHE_OK;
+#endif // WITH_IO_URING
 
-int omcache_server_index_for_key(omcache_t *mc, const unsigned char *key, size_t key_len)
-{
-  if (mc->server_count > 1)
-    return omc_ketama_lookup(mc, key, key_len);
-  return 0;
+    default:
+      return OMCACHE_INVALID;
+    }
 }
 
-static void omc_srv_disable(omcache_t *mc, omc_srv_t *srv)
+int omcache_set_io_backend(omcache_t *mc, int backend)
 {
-  // disable server until reconnect timeout
-  // log at higher level if it's not yet disabled
-  omc_srv_log(srv->disabled ? LOG_INFO : LOG_NOTICE, srv,
-              "disabling server for %u msec", mc->reconnect_timeout_msec);
-  srv->retry_at = omc_msec() + mc->reconnect_timeout_msec;
-  srv->disabled = true;
-  // clear addrinfo cache to force fresh addrs to be used on retry
-  omc_srv_free_addrs(mc, srv);
+  omc_lock(mc);
+  int ret = omc_set_io_backend(mc, backend);
+  omc_unlock(mc);
+  return ret;
 }
 
-static void
-omc_srv_reset(omcache_t *mc, omc_srv_t *srv, const char *log_msg)
+// figure out the events we need to poll for with the given server, start
+// connecting to it if needed and handle connection timeouts.  returns zero
+// if the server's socket does not need to be polled at all.
+static short omc_srv_poll_events(omcache_t *mc, omc_srv_t *srv, int64_t now, int *poll_timeout)
 {
-  omc_srv_log(LOG_NOTICE, srv, "reset: %s (%s)", log_msg, strerror(errno));
-  if (srv->sock != -1)
+  short events = 0;
+  if (srv->last_req_sent != srv->last_req_sent_nq)
     {
-      close(srv->sock);
-      omc_int_hash_table_del(mc->fd_table, srv->sock);
+      omc_srv_send_noop(mc, srv);
     }
+  if (srv->last_req_recvd < srv->last_req_sent_nq)
+    {
+      omc_srv_debug(srv, "polling %d for POLLIN", srv->sock);
+      events |= POLLIN;
+    }
+  if (srv->send_buffer.w != srv->send_buffer.r || srv->conn_timeout > 0)
+    {
+      omc_srv_debug(srv, "polling %d for POLLOUT", srv->sock);
+      events |= POLLOUT;
+    }
+  if (events == 0 && srv->conn_timeout == 0)
+    return 0;
+  if (srv->sock < 0)
+    omc_srv_connect(mc, srv);
+  // wake up in time to notice that the server has stopped responding
+  if (srv->dead_timeout_start)
+    *poll_timeout = min(*poll_timeout, max(srv->dead_timeout_start + mc->dead_timeout_msec - now, 0));
+  // make sure poll timeout is at connection timeout, and in case it has
+  // already expired, set connection timeout to a special value (1) so next
+  // time we get here we know we weren't able to establish a connection in
+  // time.
+  if (srv->conn_timeout > 0)
+    {
+      omc_srv_debug(srv, "polling %d for POLLIN (connect)", srv->sock);
+      events |= POLLIN;
+      if (srv->conn_timeout == 1)
+        {
+          errno = ETIME;
+          omc_srv_reset(mc, srv, "timeout waiting for connect");
+        }
+      else if (now >= srv->conn_timeout)
+        {
+          srv->conn_timeout = 1;
+          *poll_timeout = 1;
+        }
+      else
+        {
+          *poll_timeout = min(*poll_timeout, srv->conn_timeout - now);
+        }
+    }
+  return (srv->sock >= 0) ? events : 0;
+}
+
+struct pollfd *omcache_poll_fds(omcache_t *mc, int *nfds, int *poll_timeout)
+{
+  int n, i;
+#ifdef WITH_ASYNCNS
+  bool poll_ans = false;
+#endif // WITH_ASYNCNS
+  int64_t now = omc_msec();
+  omc_lock(mc);
+  *poll_timeout = mc->dead_timeout_msec;
+
+  for (i=n=0; i<mc->conn_count; i++)
+    {
+      omc_srv_t *srv = mc->conns[i];
+      short events = omc_srv_poll_events(mc, srv, now, poll_timeout);
+      if (events != 0)
+        {
+          mc->server_polls[n].fd = srv->sock;
+          mc->server_polls[n].events = events;
+          mc->server_polls[n].revents = 0;
+          n ++;
+        }
+#ifdef WITH_ASYNCNS
+      if (srv->nsq && !poll_ans)
+        {
+          // NOTE: we don't allocate extra space in 'server_polls' for async
+          // ns polling because we can't poll for both the server and for
+          // async ns resuls for it.
+          omc_srv_debug(srv, "polling asyncns fd %d for POLLIN", mc->ans_fd);
+          poll_ans = true;
+          mc->server_polls[n].fd = mc->ans_fd;
+          mc->server_polls[n].events = POLLIN;
+          mc->server_polls[n++].revents = 0;
+        }
+#endif // WITH_ASYNCNS
+    }
+  *nfds = n;
+  omc_unlock(mc);
+  return mc->server_polls;
+}
+
+static void omc_srv_mark_dirty(omcache_t *mc omc_attribute_unused, omc_srv_t *srv omc_attribute_unused)
+{
+#ifdef WITH_EPOLL
+  // queue the server for re-evaluation of its epoll interests
+  if (mc->ep.fd >= 0 && !srv->ep_dirty)
+    {
+      srv->ep_dirty = true;
+      mc->ep.dirty[mc->ep.dirty_count++] = srv;
+    }
+#endif // WITH_EPOLL
+}
+
+#ifdef WITH_EPOLL
+static void omc_epoll_free(omcache_t *mc)
+{
+  if (mc->ep.fd >= 0)
+    close(mc->ep.fd);
+  free(mc->ep.dirty);
+  mc->ep.fd = -1;
+  mc->ep.dirty = NULL;
+  mc->ep.dirty_count = 0;
+  mc->ep.armed = 0;
+  mc->ep.timeout_at = 0;
+  for (ssize_t i = 0; i < mc->conn_count; i ++)
+    {
+      mc->conns[i]->ep_events = 0;
+      mc->conns[i]->ep_registered = false;
+      mc->conns[i]->ep_armed = false;
+      mc->conns[i]->ep_dirty = false;
+    }
+}
+
+// re-evaluate the poll interests of all servers, called when the server
+// list changes.  servers can be queued twice in the dirty list: once before
+// and once while the list is being processed.
+static void omc_epoll_reset(omcache_t *mc)
+{
+  mc->ep.dirty = realloc(mc->ep.dirty, (2 * mc->conn_count + 1) * sizeof(*mc->ep.dirty));
+  mc->ep.dirty_count = 0;
+  mc->ep.armed = 0;
+  mc->ep.timeout_at = 0;
+  for (ssize_t i = 0; i < mc->conn_count; i ++)
+    {
+      mc->conns[i]->ep_armed = false;
+      mc->conns[i]->ep_dirty = false;
+      omc_srv_mark_dirty(mc, mc->conns[i]);
+    }
+}
+
+// update epoll registrations of servers whose state has changed since the
+// last call and track the earliest time a timeout needs to be checked.
+static void omc_epoll_update(omcache_t *mc, int64_t now)
+{
+  // process the servers queued before this call, anything queued while
+  // we're processing them is handled on the next round
+  size_t queued = mc->ep.dirty_count;
+  for (size_t i = 0; i < queued; i ++)
+    {
+      omc_srv_t *srv = mc->ep.dirty[i];
+      int srv_timeout = mc->dead_timeout_msec;
+      srv->ep_dirty = false;
+      short events = omc_srv_poll_events(mc, srv, now, &srv_timeout);
+      uint32_t ep_events = ((events & POLLIN) ? EPOLLIN : 0) | ((events & POLLOUT) ? EPOLLOUT : 0);
+      if (srv->sock >= 0 && (!srv->ep_registered || srv->ep_events != ep_events))
+        {
+          struct epoll_event ev = { .events = ep_events, .data.ptr = srv };
+          int op = srv->ep_registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+          if (epoll_ctl(mc->ep.fd, op, srv->sock, &ev) == -1)
+            {
+              omc_srv_reset(mc, srv, "epoll_ctl failed");
+              continue;
+            }
+          srv->ep_registered = true;
+          srv->ep_events = ep_events;
+        }
+      bool armed = (events != 0);
+#ifdef WITH_ASYNCNS
+      armed = armed || (srv->nsq != NULL);
+#endif // WITH_ASYNCNS
+      if (armed != srv->ep_armed)
+        {
+          srv->ep_armed = armed;
+          mc->ep.armed += armed ? 1 : -1;
+        }
+      if (armed)
+        {
+          int64_t timeout_at = now + srv_timeout;
+          if (srv->dead_timeout_start)
+            timeout_at = min(timeout_at, srv->dead_timeout_start + mc->dead_timeout_msec);
+          if (mc->ep.timeout_at == 0 || timeout_at < mc->ep.timeout_at)
+            mc->ep.timeout_at = timeout_at;
+        }
+    }
+  mc->ep.dirty_count -= queued;
+  memmove(mc->ep.dirty, mc->ep.dirty + queued, mc->ep.dirty_count * sizeof(*mc->ep.dirty));
+}
+#endif // WITH_EPOLL
+
+static int omc_ketama_point_cmp(const void *v1, const void *v2)
+{
+  // order points with the same hash value by their server's index which is
+  // the same order in which they were added to the array; it's also the
+  // order in which incremental updates merge them
+  const omc_ketama_point_t *p1 = v1, *p2 = v2;
+  if (p1->hash_value != p2->hash_value)
+    return p1->hash_value > p2->hash_value ? 1 : -1;
+  if (p1->server_index != p2->server_index)
+    return p1->server_index > p2->server_index ? 1 : -1;
+  return 0;
+}
+
+static omc_ketama_t *omc_ketama_alloc(size_t total_points)
+{
+  // use about one slice per point
+  uint32_t bucket_bits = 0;
+  while (bucket_bits < OMC_KETAMA_BUCKET_BITS_MAX && (1UL << bucket_bits) < total_points)
+    bucket_bits ++;
+  size_t bucket_count = (1UL << bucket_bits) + 1;
+  omc_ketama_t *ktm = (omc_ketama_t *) malloc(sizeof(omc_ketama_t) +
+    (total_points * 2 + bucket_count) * sizeof(uint32_t));
+  ktm->point_count = 0;
+  ktm->uniform_points = 0;
+  ktm->bucket_shift = 32 - bucket_bits;
+  ktm->hashes = ktm->data;
+  ktm->server_indexes = ktm->data + total_points;
+  ktm->buckets = ktm->data + total_points * 2;
+  return ktm;
+}
+
+static void omc_ketama_fill_buckets(omc_ketama_t *ktm)
+{
+  // buckets[b] is the first point in slice b or later, the extra entry at
+  // the end points past the last point
+  size_t bucket_count = (1UL << (32 - ktm->bucket_shift)) + 1;
+  for (uint32_t b = 0, p = 0; b < bucket_count; b ++)
+    {
+      while (p < ktm->point_count && ((uint64_t) ktm->hashes[p] >> ktm->bucket_shift) < b)
+        p ++;
+      ktm->buckets[b] = p;
+    }
+}
+
+// return the distribution method's point hashes for the first point_count
+// points of a server, they're computed once and kept with the server
+static const uint32_t *omc_srv_point_hashes(omcache_t *mc, omc_srv_t *srv, uint32_t point_count)
+{
+  omc_ketama_point_hash_func *func = mc->dist_method->point_hash_func;
+  uint32_t eps = mc->dist_method->entries_per_point;
+
+  if (srv->point_hash_func != func || srv->point_hash_entries != eps)
+    {
+      srv->point_hash_func = func;
+      srv->point_hash_entries = eps;
+      srv->point_hash_count = 0;
+    }
+  if (srv->point_hash_count < point_count)
+    {
+      srv->point_hashes = realloc(srv->point_hashes, point_count * eps * sizeof(uint32_t));
+      srv->point_hash_sizes = realloc(srv->point_hash_sizes, point_count);
+      for (uint32_t p = srv->point_hash_count; p < point_count; p ++)
+        srv->point_hash_sizes[p] = func(srv->hostname, srv->port, p, srv->point_hashes + p * eps);
+      srv->point_hash_count = point_count;
+    }
+  return srv->point_hashes;
+}
+
+// compute the points of a server and return the number of points stored
+static size_t omc_ketama_server_points(omcache_t *mc, uint32_t server_index,
+                                       uint32_t point_count, omc_ketama_point_t *points)
+{
+  omc_srv_t *srv = mc->servers[server_index];
+  uint32_t eps = mc->dist_method->entries_per_point;
+  const uint32_t *hashes = omc_srv_point_hashes(mc, srv, point_count);
+  size_t cidx = 0;
+  for (size_t p = 0; p < point_count; p ++)
+    for (uint32_t e = 0; e < srv->point_hash_sizes[p]; e ++)
+      points[cidx++] = (omc_ketama_point_t) { .server_index = server_index, .hash_value = hashes[p * eps + e] };
+  return cidx;
+}
+
+static bool omc_ketama_uniform_weights(omcache_t *mc)
+{
+  for (ssize_t i = 1; i < mc->server_count; i ++)
+    if (mc->servers[i]->weight != mc->servers[0]->weight)
+      return false;
+  return true;
+}
+
+static omc_ketama_t *omc_ketama_create(omcache_t *mc)
+{
+  // distribution methods with their own lookup function don't need one
+  if (omc_dist_func(mc->dist_method, lookup_func) || omc_dist_func(mc->dist_method, table_func) ||
+      omc_dist_func(mc->dist_method, score_func))
+    return NULL;
+  uint32_t pps = mc->dist_method->points_per_server;
+  uint32_t eps = mc->dist_method->entries_per_point;
+  mc->rebuild.srv_points = omc_scratch_reserve(mc->rebuild.srv_points, &mc->rebuild.srv_points_size,
+                                               mc->server_count, sizeof(uint32_t));
+  uint32_t *srv_points = mc->rebuild.srv_points;
+  size_t cidx = 0, total_points = 0;
+  uint64_t total_weight = 0;
+
+  // scale the number of points of each server by its share of the total
+  // weight like libmemcached's weighted ketama does, servers of equal
+  // weight always get points_per_server points
+  for (ssize_t i = 0; i < mc->server_count; i ++)
+    total_weight += mc->servers[i]->weight;
+  for (ssize_t i = 0; i < mc->server_count; i ++)
+    {
+      uint32_t weight = mc->servers[i]->weight;
+      if ((uint64_t) weight * mc->server_count == total_weight)
+        srv_points[i] = pps;
+      else
+        srv_points[i] = (float) weight / (float) total_weight * pps * (float) mc->server_count + 0.0000000001;
+      total_points += srv_points[i] * eps;
+    }
+  omc_ketama_point_t *points = malloc(total_points * sizeof(omc_ketama_point_t));
+  omc_ketama_t *ktm = omc_ketama_alloc(total_points);
+
+  for (ssize_t i = 0; i < mc->server_count; i ++)
+    cidx += omc_ketama_server_points(mc, i, srv_points[i], points + cidx);
+
+  ktm->point_count = cidx;
+  qsort(points, ktm->point_count, sizeof(omc_ketama_point_t), omc_ketama_point_cmp);
+  for (uint32_t p = 0; p < ktm->point_count; p ++)
+    {
+      ktm->hashes[p] = points[p].hash_value;
+      ktm->server_indexes[p] = points[p].server_index;
+    }
+  free(points);
+  omc_ketama_fill_buckets(ktm);
+  if (omc_ketama_uniform_weights(mc))
+    ktm->uniform_points = pps;
+  return ktm;
+}
+
+// update the continuum after a server list change by dropping the points
+// of the removed servers and merging the points of the added servers into
+// it.  server_map maps the old servers' indexes to their new indexes or to
+// -1 for removed servers.  Returns NULL if the continuum must be rebuilt.
+static omc_ketama_t *omc_ketama_merge(omcache_t *mc, const omc_ketama_t *old,
+                                      const ssize_t *server_map, ssize_t old_count)
+{
+  uint32_t pps = mc->dist_method->points_per_server;
+  uint32_t eps = mc->dist_method->entries_per_point;
+
+  if (old == NULL || old->uniform_points != pps || !omc_ketama_uniform_weights(mc))
+    return NULL;
+  mc->rebuild.kept = omc_scratch_reserve(mc->rebuild.kept, &mc->rebuild.kept_size,
+                                         max(mc->server_count, 1), sizeof(bool));
+  bool *kept = mc->rebuild.kept;
+  size_t added = mc->server_count;
+  memset(kept, 0, mc->server_count * sizeof(bool));
+  for (ssize_t i = 0; i < old_count; i ++)
+    if (server_map[i] >= 0)
+      {
+        kept[server_map[i]] = true;
+        added --;
+      }
+
+  omc_ketama_point_t *points = malloc(max(added * pps * eps, 1) * sizeof(omc_ketama_point_t));
+  size_t new_count = 0, old_kept = 0;
+  for (ssize_t i = 0; i < mc->server_count; i ++)
+    if (!kept[i])
+      new_count += omc_ketama_server_points(mc, i, pps, points + new_count);
+  qsort(points, new_count, sizeof(omc_ketama_point_t), omc_ketama_point_cmp);
+  for (uint32_t p = 0; p < old->point_count; p ++)
+    old_kept += server_map[old->server_indexes[p]] >= 0;
+
+  omc_ketama_t *ktm = omc_ketama_alloc(old_kept + new_count);
+  uint32_t op = 0, np = 0, cidx = 0;
+  while (op < old->point_count || np < new_count)
+    {
+      if (op < old->point_count && server_map[old->server_indexes[op]] < 0)
+        {
+          op ++;
+          continue;
+        }
+      bool take_old = np == new_count;
+      if (!take_old && op < old->point_count)
+        {
+          omc_ketama_point_t old_point = {
+            .hash_value = old->hashes[op],
+            .server_index = server_map[old->server_indexes[op]],
+          };
+          take_old = omc_ketama_point_cmp(&old_point, &points[np]) < 0;
+        }
+      if (take_old)
+        {
+          ktm->hashes[cidx] = old->hashes[op];
+          ktm->server_indexes[cidx++] = server_map[old->server_indexes[op++]];
+        }
+      else
+        {
+          ktm->hashes[cidx] = points[np].hash_value;
+          ktm->server_indexes[cidx++] = points[np++].server_index;
+        }
+    }
+  free(points);
+  ktm->point_count = cidx;
+  ktm->uniform_points = pps;
+  omc_ketama_fill_buckets(ktm);
+  return ktm;
+}
+
+static omc_dist_table_t *omc_dist_table_create(omcache_t *mc)
+{
+  static const uint32_t primes[] = {
+    251, 509, 1021, 2039, 4093, 8191, 16381, 32749, 65521, 131071, 262139, 524287, 1048573,
+  };
+  uint32_t eps = mc->dist_method->entries_per_point;
+  size_t server_count = mc->server_count;
+
+  if (omc_dist_func(mc->dist_method, table_func) == NULL || server_count == 0)
+    return NULL;
+  // the table size is a prime of at least points_per_server slots per server
+  uint32_t size = primes[0];
+  for (size_t i = 0; i < sizeof(primes) / sizeof(primes[0]); i ++)
+    {
+      size = primes[i];
+      if (size >= server_count * mc->dist_method->points_per_server)
+        break;
+    }
+  omc_dist_table_t *tbl = malloc(sizeof(omc_dist_table_t) +
+    (server_count * eps + size * 2) * sizeof(uint32_t) + server_count);
+  tbl->size = size;
+  tbl->server_count = server_count;
+  tbl->owners = tbl->data;
+  tbl->live = tbl->owners + size;
+  tbl->server_hashes = tbl->live + size;
+  tbl->enabled = (uint8_t *) (tbl->server_hashes + server_count * eps);
+  for (size_t i = 0; i < server_count; i ++)
+    {
+      memcpy(tbl->server_hashes + i * eps, omc_srv_point_hashes(mc, mc->servers[i], 1), eps * sizeof(uint32_t));
+      tbl->enabled[i] = 1;
+    }
+  mc->dist_method->table_func(tbl->server_hashes, eps, tbl->enabled, server_count, tbl->owners, size);
+  memcpy(tbl->live, tbl->owners, size * sizeof(uint32_t));
+  return tbl;
+}
+
+// rebuild the whole live lookup table when a server goes down or comes
+// back, or check all servers if srv is NULL
+static void omc_dist_table_update(omcache_t *mc, omc_srv_t *srv)
+{
+  omc_dist_table_t *tbl = mc->dist_table;
+  bool changed = false;
+
+  if (tbl == NULL || tbl->server_count != mc->server_count)
+    return;
+  for (ssize_t i = 0; i < mc->server_count; i ++)
+    {
+      if (srv && srv->server != mc->servers[i])
+        continue;
+      uint8_t enabled = mc->servers[i]->down ? 0 : 1;
+      changed = changed || tbl->enabled[i] != enabled;
+      tbl->enabled[i] = enabled;
+    }
+  if (!changed)
+    return;
+  mc->dist_method->table_func(tbl->server_hashes, mc->dist_method->entries_per_point,
+                              tbl->enabled, mc->server_count, tbl->live, tbl->size);
+  omc_debug("%s", "rebuilt distribution table");
+}
+
+// rerun distribution after the server list or method changed
+static omc_dist_hrw_t *omc_dist_hrw_create(omcache_t *mc)
+{
+  size_t server_count = mc->server_count;
+
+  if (omc_dist_func(mc->dist_method, score_func) == NULL || server_count == 0)
+    return NULL;
+  omc_dist_hrw_t *hrw = malloc(sizeof(omc_dist_hrw_t) +
+    server_count * (sizeof(uint32_t) + 2 * sizeof(float)));
+  hrw->server_count = server_count;
+  hrw->seeds = hrw->data;
+  hrw->weights = (float *) (hrw->seeds + server_count);
+  hrw->scores = hrw->weights + server_count;
+  for (size_t i = 0; i < server_count; i ++)
+    {
+      hrw->seeds[i] = omc_srv_point_hashes(mc, mc->servers[i], 1)[0];
+      hrw->weights[i] = mc->servers[i]->weight;
+    }
+  return hrw;
+}
+
+static void omc_dist_update(omcache_t *mc, const ssize_t *server_map, ssize_t old_count)
+{
+  omc_ketama_t *ktm = NULL;
+  if (server_map)
+    ktm = omc_ketama_merge(mc, mc->ketama, server_map, old_count);
+  free(mc->ketama);
+  mc->ketama = ktm ? ktm : omc_ketama_create(mc);
+  free(mc->dist_table);
+  mc->dist_table = omc_dist_table_create(mc);
+  omc_dist_table_update(mc, NULL);
+  free(mc->dist_hrw);
+  mc->dist_hrw = omc_dist_hrw_create(mc);
+}
+
+// try to bring a disabled server or connection back online but don't
+// select it yet as we need to (asynchronously) verify that it's usable
+static void omc_srv_retry(omcache_t *mc, omc_srv_t *srv, int64_t *now)
+{
+  if (*now == 0)
+    *now = omc_msec();
+  // only attempt io with servers once per millisecond
+  if (*now > srv->retry_at)
+    {
+      srv->retry_at = *now;
+      omc_srv_io(mc, srv);
+    }
+}
+
+// map a key hash to the index of the server that owns it
+static int omc_ketama_route(omcache_t *mc, uint32_t hash_value)
+{
+  const omc_ketama_t *ktm = mc->ketama;
+  bool wrap = false;
+  int64_t now = 0;
+
+  // only search the points in the hash value's slice: halve the range
+  // until it's short and then count the smaller hashes without branching
+  uint32_t bucket = (uint64_t) hash_value >> ktm->bucket_shift;
+  uint32_t left = ktm->buckets[bucket], right = ktm->buckets[bucket + 1];
+  while (right - left > 8)
+    {
+      uint32_t middle = left + (right - left) / 2;
+      if (ktm->hashes[middle] < hash_value)
+        left = middle + 1;
+      else
+        right = middle;
+    }
+  uint32_t selected = left;
+  for (uint32_t p = left; p < right; p ++)
+    selected += ktm->hashes[p] < hash_value;
+
+  // skip disabled servers
+  size_t skipped = 0;
+  for (selected = (selected == ktm->point_count) ? 0 : selected;
+      selected == ktm->point_count || mc->servers[ktm->server_indexes[selected]]->down;
+      selected++)
+    {
+      if (selected != ktm->point_count)
+        {
+          omc_srv_retry(mc, mc->servers[ktm->server_indexes[selected]], &now);
+          skipped ++;
+          continue;
+        }
+      if (wrap)
+        {
+          omc_log(LOG_ERR, "%s", "all servers are disabled");
+          return -1;
+        }
+      wrap = true;
+      selected = -1;
+    }
+  if (skipped)
+    omc_log(LOG_INFO, "ketama skipped %zu disabled server points", skipped);
+  return ktm->server_indexes[selected];
+}
+
+// map a key hash to the enabled server with the highest score, the servers
+// with lower scores are the key's failover servers in order of their score
+static int omc_hrw_route(omcache_t *mc, uint32_t hash_value)
+{
+  omc_dist_hrw_t *hrw = mc->dist_hrw;
+  int64_t now = 0;
+  ssize_t selected = -1;
+
+  mc->dist_method->score_func(hash_value, hrw->seeds, hrw->weights, hrw->server_count, hrw->scores);
+  for (size_t i = 0; i < hrw->server_count; i ++)
+    if (selected < 0 || hrw->scores[i] > hrw->scores[selected])
+      selected = i;
+  if (!mc->servers[selected]->down)
+    return selected;
+
+  // retry the disabled servers that outrank the selected one
+  size_t skipped = 0;
+  selected = -1;
+  for (size_t i = 0; i < hrw->server_count; i ++)
+    if (!mc->servers[i]->down && (selected < 0 || hrw->scores[i] > hrw->scores[selected]))
+      selected = i;
+  for (size_t i = 0; i < hrw->server_count; i ++)
+    if (mc->servers[i]->down && (selected < 0 || hrw->scores[i] > hrw->scores[selected]))
+      {
+        omc_srv_retry(mc, mc->servers[i], &now);
+        skipped ++;
+      }
+  if (selected < 0)
+    {
+      omc_log(LOG_ERR, "%s", "all servers are disabled");
+      return -1;
+    }
+  omc_log(LOG_INFO, "rendezvous skipped %zu disabled servers", skipped);
+  return selected;
+}
+
+// map a key hash to a server with a distribution method's own lookup
+// function, keys of disabled servers are rehashed to pick another server
+static int omc_dist_route(omcache_t *mc, uint32_t hash_value)
+{
+  omc_dist_lookup_func *lookup_func = omc_dist_func(mc->dist_method, lookup_func);
+  int64_t now = 0;
+
+  if (mc->dist_table)
+    {
+      // the live table skips disabled servers, retry the server that
+      // owns the slot when it's disabled
+      omc_dist_table_t *tbl = mc->dist_table;
+      uint32_t slot = hash_value % tbl->size;
+      if (tbl->live[slot] != tbl->owners[slot])
+        omc_srv_retry(mc, mc->servers[tbl->owners[slot]], &now);
+      if (tbl->live[slot] == UINT32_MAX)
+        {
+          omc_log(LOG_ERR, "%s", "all servers are disabled");
+          return -1;
+        }
+      return tbl->live[slot];
+    }
+  if (mc->dist_hrw)
+    return omc_hrw_route(mc, hash_value);
+  if (lookup_func == NULL)
+    return omc_ketama_route(mc, hash_value);
+  for (ssize_t attempt = 0; attempt < mc->server_count; attempt ++)
+    {
+      omc_srv_t *srv = mc->servers[lookup_func(hash_value, mc->server_count)];
+      if (!srv->down)
+        {
+          if (attempt)
+            omc_log(LOG_INFO, "rehashed key %zd times to skip disabled servers", attempt);
+          return srv->list_index;
+        }
+      omc_srv_retry(mc, srv, &now);
+      hash_value = omc_hash_jenkins_oat((const unsigned char *) &hash_value, sizeof(hash_value));
+    }
+  // fall back to the first enabled server
+  for (ssize_t i = 0; i < mc->server_count; i ++)
+    if (!mc->servers[i]->down)
+      return i;
+  omc_log(LOG_ERR, "%s", "all servers are disabled");
+  return -1;
+}
+
+static int omc_dist_lookup(omcache_t *mc, const unsigned char *key, size_t key_len)
+{
+  return omc_dist_route(mc, mc->dist_method->key_hash_func(key, key_len));
+}
+
+// grow a scratch buffer kept in the handle to hold at least count elements
+static void *omc_scratch_reserve(void *buf, size_t *size, size_t count, size_t elem_size)
+{
+  if (*size >= count)
+    return buf;
+  *size = max(count, *size * 2);
+  return realloc(buf, *size * elem_size);
+}
+
+// hash all keys first and then map the hashes to servers, keeping the
+// table lookups of different keys independent of the hashing
+static void omc_route_keys(omcache_t *mc, const unsigned char **keys, const size_t *key_lens,
+                           size_t key_count, int *server_indexes)
+{
+  if (mc->server_count <= 1)
+    {
+      for (size_t i = 0; i < key_count; i ++)
+        server_indexes[i] = 0;
+      return;
+    }
+  mc->split.hashes = omc_scratch_reserve(mc->split.hashes, &mc->split.hashes_size,
+                                         key_count, sizeof(uint32_t));
+  for (size_t i = 0; i < key_count; i ++)
+    mc->split.hashes[i] = mc->dist_method->key_hash_func(keys[i], key_lens[i]);
+  for (size_t i = 0; i < key_count; i ++)
+    server_indexes[i] = omc_dist_route(mc, mc->split.hashes[i]);
+}
+
+// pick one of the server's connections skipping disabled connections, the
+// server itself is used if all are disabled.  requests with a key always go
+// to the same connection so that a read of a key is answered after an
+// earlier write of it, requests without a key are spread in round-robin
+// order
+static omc_srv_t *omc_srv_pick_conn(omcache_t *mc, omc_srv_t *server, bool keyed, uint32_t key_hash)
+{
+  int64_t now = 0;
+  uint32_t first = keyed ? key_hash : server->next_conn ++;
+  for (uint32_t i = 0; i < server->conn_count && server->conn_count > 1; i ++)
+    {
+      omc_srv_t *srv = server->conns[(first + i) % server->conn_count];
+      if (!srv->disabled)
+        return srv;
+      omc_srv_retry(mc, srv, &now);
+    }
+  return server;
+}
+
+int omcache_server_index_for_key(omcache_t *mc, const unsigned char *key, size_t key_len)
+{
+  int server_index = 0;
+  omc_lock(mc);
+  if (mc->server_count > 1)
+    server_index = omc_dist_lookup(mc, key, key_len);
+  omc_unlock(mc);
+  return server_index;
+}
+
+int omcache_server_indexes_for_keys(omcache_t *mc, const unsigned char **keys, const size_t *key_lens,
+                                    size_t key_count, int *server_indexes, size_t *key_order)
+{
+  omc_lock(mc);
+  if (mc->server_count == 0)
+    {
+      omc_unlock(mc);
+      return OMCACHE_NO_SERVERS;
+    }
+  omc_route_keys(mc, keys, key_lens, key_count, server_indexes);
+  if (key_order)
+    {
+      // counting sort by server index, keys without a server go last
+      mc->split.offsets = omc_scratch_reserve(mc->split.offsets, &mc->split.offsets_size,
+                                              mc->server_count + 1, sizeof(size_t));
+      size_t *offsets = mc->split.offsets;
+      memset(offsets, 0, (mc->server_count + 1) * sizeof(size_t));
+      for (size_t i = 0; i < key_count; i ++)
+        if (server_indexes[i] >= 0)
+          offsets[server_indexes[i]] ++;
+      for (size_t b = 0, start = 0; b <= (size_t) mc->server_count; b ++)
+        {
+          size_t count = offsets[b];
+          offsets[b] = start;
+          start += count;
+        }
+      for (size_t i = 0; i < key_count; i ++)
+        key_order[offsets[server_indexes[i] >= 0 ? server_indexes[i] : mc->server_count] ++] = i;
+    }
+  omc_unlock(mc);
+  return OMCACHE_OK;
+}
+
+// a server is down when all of its connections are disabled
+static void omc_srv_update_down(omcache_t *mc, omc_srv_t *srv)
+{
+  omc_srv_t *server = srv->server;
+  bool down = srv->disabled;
+  for (uint32_t i = 0; i < server->conn_count && down; i ++)
+    down = server->conns[i]->disabled;
+  if (server->down == down)
+    return;
+  server->down = down;
+  omc_dist_table_update(mc, server);
+}
+
+static void omc_srv_disable(omcache_t *mc, omc_srv_t *srv)
+{
+  // disable server until reconnect timeout
+  // log at higher level if it's not yet disabled
+  omc_srv_log(srv->disabled ? LOG_INFO : LOG_NOTICE, srv,
+              "disabling server for %u msec", mc->reconnect_timeout_msec);
+  srv->retry_at = omc_msec() + mc->reconnect_timeout_msec;
+  srv->disabled = true;
+  omc_srv_update_down(mc, srv);
+  // clear addrinfo cache to force fresh addrs to be used on retry
+  omc_srv_free_addrs(mc, srv);
+}
+
+static void
+omc_srv_reset(omcache_t *mc, omc_srv_t *srv, const char *log_msg)
+{
+  omc_srv_log(LOG_NOTICE, srv, "reset: %s (%s)", log_msg, strerror(errno));
+  if (srv->sock != -1)
+    {
+      close(srv->sock);
+      omc_int_hash_table_del(mc->fd_table, srv->sock);
+    }
+#ifdef WITH_EPOLL
+  // closing the socket removed it from the epoll set
+  srv->ep_registered = false;
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+  srv->ur_ready = false;
+  srv->ur_wait = 0;
+#endif // WITH_IO_URING
+  omc_srv_mark_dirty(mc, srv);
   srv->connected = false;
   srv->sock = -1;
   srv->conn_timeout = 0;
   srv->last_req_recvd = 0;
   srv->last_req_sent = 0;
   srv->last_req_sent_nq = 0;
-  srv->recv_buffer.r = srv->recv_buffer.base;
-  srv->recv_buffer.w = srv->recv_buffer.base;
+  srv->stream.active = false;
+  srv->stream.done = false;
+  omc_recv_buffer_release(mc, srv);
   srv->send_buffer.r = srv->send_buffer.base;
   srv->send_buffer.w = srv->send_buffer.base;
   if (srv->expected_noop)
     {
       omc_srv_disable(mc, srv);
     }
+  omc_flights_drop(mc, srv);
   omc_lookup_discard_requests(mc, srv, UINT32_MAX);
 }
 
@@ -771,6 +2295,7 @@ static int omc_srv_connect(omcache_t *mc, omc_srv_t *srv)
 #ifdef WITH_ASYNCNS
               srv->nsq = asyncns_getaddrinfo(mc->ans, srv->hostname, srv->port, &hints);
               srv->last_gai = now;
+              omc_srv_mark_dirty(mc, srv);
               return OMCACHE_AGAIN;
 #else // WITH_ASYNCNS
               // NOTE: this can block
@@ -811,11 +2336,12 @@ static int omc_srv_connect(omcache_t *mc, omc_srv_t *srv)
               omc_srv_disable(mc, srv);
               return OMCACHE_SERVER_FAILURE;
             }
-          omc_int_hash_table_add(mc->fd_table, sock, srv->list_index);
+          omc_int_hash_table_add(mc->fd_table, sock, srv->conn_index);
           err = connect(sock, srv->addrp->ai_addr, srv->addrp->ai_addrlen);
           srv->dead_timeout_start = now;
           srv->addrp = srv->addrp->ai_next;
           srv->sock = sock;
+          omc_srv_mark_dirty(mc, srv);
           if (err == 0)
             {
               // connection established
@@ -871,6 +2397,7 @@ static int omc_srv_connect(omcache_t *mc, omc_srv_t *srv)
     }
   srv->connected = true;
   srv->conn_timeout = 0;
+  omc_srv_mark_dirty(mc, srv);
   srv->dead_timeout_start = 0;
   srv->addrp = srv->addrs;
   omc_srv_log(LOG_INFO, srv, "%s", "connected");
@@ -879,6 +2406,24 @@ static int omc_srv_connect(omcache_t *mc, omc_srv_t *srv)
   return OMCACHE_OK;
 }
 
+// find the active call waiting for the response to 'req_id'
+static omc_call_t *omc_call_find(omcache_t *mc, uint32_t req_id)
+{
+  for (omc_call_t *call = mc->lookup.calls; call; call = call->next)
+    if (call->active && req_id >= call->min_req && req_id <= call->max_req)
+      return call;
+  return NULL;
+}
+
+static void omc_call_found(omc_call_t *call)
+{
+  call->found ++;
+#ifdef WITH_THREADS
+  if (call->waiting && call->found == call->count)
+    pthread_cond_signal(&call->cond);
+#endif // WITH_THREADS
+}
+
 static bool omc_return_value(omcache_t *mc, omc_srv_t *srv, omcache_value_t *value,
                              uint32_t req_id, bool multi_req)
 {
@@ -886,72 +2431,89 @@ static bool omc_return_value(omcache_t *mc, omc_srv_t *srv, omcache_value_t *val
   if (mc->resp_cb)
     mc->resp_cb(mc, value, mc->resp_cb_context);
 
-  // add it to response list if it matches lookup range
-  if (!mc->lookup.active)
+  // add it to response list if it matches a lookup range
+  omc_call_t *call = omc_call_find(mc, req_id);
+  if (call == NULL)
     return false;
 
-  bool final = (multi_req == false) || (mc->lookup.values_size <= mc->lookup.values_returned);
-  omcache_req_t *req = (final ? omc_hash_table_del : omc_hash_table_find)(mc->lookup.table, req_id);
+  bool final = (multi_req == false) || (call->values_size <= call->values_returned);
+  omcache_req_t *req = (final ? omc_seq_table_del : omc_seq_table_find)(call->table, req_id);
   if (req == NULL)
     return false;
 
   if (final)
-    {
-      mc->lookup.found ++;
-      srv->active_requests --;
-    }
+    omc_call_found(call);
 
   omc_srv_debug(srv, "expected response %u (%u / %u): %s",
-                req_id, mc->lookup.found, mc->lookup.count,
+                req_id, call->found, call->count,
                 omcache_strerror(value->status));
 
-  if (mc->lookup.values_size <= mc->lookup.values_returned)
+  if (call->values_size <= call->values_returned)
     {
-      if (mc->lookup.values_size)
+      if (call->values_size)
         omc_srv_log(LOG_WARNING, srv,
                     "no space to store response %u "
                     "in a buffer of %zu entries, dropping response",
-                    req_id, mc->lookup.values_size);
+                    req_id, call->values_size);
       return false;
     }
-  mc->lookup.values[mc->lookup.values_returned++] = *value;
+#ifdef WITH_THREADS
+  if (mc->ts.enabled)
+    omc_call_pin(call, srv, value);
+#endif // WITH_THREADS
+  call->values[call->values_returned++] = *value;
   return true;
 }
 
+// complete a quiet request which didn't return a response
+static void omc_lookup_complete(omcache_t *mc, uint32_t req_id)
+{
+  omc_call_t *call = omc_call_find(mc, req_id);
+  if (call && omc_seq_table_del(call->table, req_id))
+    omc_call_found(call);
+}
+
 static uint32_t omc_lookup_discard_requests(omcache_t *mc, omc_srv_t *srv, uint32_t max_req)
 {
-  if (!mc->lookup.active || srv->active_requests == 0)
-    return 0;
   uint32_t discarded = 0;
-  for (uint32_t bucket = 0; bucket < mc->lookup.table->size; bucket ++)
-    for (omc_hash_node_t *node = mc->lookup.table->buckets[bucket], *next_node = NULL;
-          node != NULL; node = next_node)
-      {
-        omcache_req_t *req = (omcache_req_t *) node->val;
-        next_node = node->next;
-        if (req->server_index == srv->list_index && req->header.opaque < max_req)
-          {
-            // response "found" to never arrive
-            discarded ++;
-            if (max_req == UINT32_MAX || !omc_is_request_quiet(req->header.opcode))
-              {
-                // server failed (called from omc_srv_reset or request wasn't quiet)
-                omcache_value_t value = {
-                  .status = OMCACHE_SERVER_FAILURE,
-                  .key = req->key,
-                  .key_len = be16toh(req->header.keylen),
-                  .data = NULL,
-                  };
-                omc_return_value(mc, srv, &value, req->header.opaque, false);
-              }
-            else
-              {
-                mc->lookup.found ++;
-                srv->active_requests --;
-                omc_hash_table_del(mc->lookup.table, node->key);
-              }
-          }
-      }
+  bool matched = false;
+  for (omc_call_t *call = mc->lookup.calls; call; call = call->next)
+    {
+      for (size_t si = 0; call->active && si < call->span_count; si ++)
+        {
+          omc_call_span_t *span = &call->spans[si];
+          if (span->srv != srv)
+            continue;
+          matched = true;
+          omc_seq_table_t *table = call->table;
+          // only look at the range of requests sent to this server, anything
+          // already answered is skipped using the table's bitmap
+          uint32_t end_req = min(max_req, span->last_req + 1);
+          for (uint32_t req_id = omc_seq_table_next(table, span->first_req);
+               req_id < end_req;
+               req_id = omc_seq_table_next(table, req_id + 1))
+            {
+              omcache_req_t *req = (omcache_req_t *) omc_seq_table_find(table, req_id);
+              // response "found" to never arrive
+              discarded ++;
+              if (max_req == UINT32_MAX || !omc_is_request_quiet(req->header.opcode))
+                {
+                  // server failed (called from omc_srv_reset or request wasn't quiet)
+                  omcache_value_t value = {
+                    .status = OMCACHE_SERVER_FAILURE,
+                    .key = req->key,
+                    .key_len = be16toh(req->header.keylen),
+                    .data = NULL,
+                    };
+                  omc_return_value(mc, srv, &value, req->header.opaque, false);
+                }
+              else
+                omc_lookup_complete(mc, req_id);
+            }
+        }
+    }
+  if (!matched)
+    return 0;
   // log a differnet message if we're discarding everything and when we're
   // discarding quiet messages when seeing a no-op
   if (max_req == UINT32_MAX)
@@ -961,64 +2523,512 @@ static uint32_t omc_lookup_discard_requests(omcache_t *mc, omc_srv_t *srv, uint3
   return discarded;
 }
 
-static int omc_buffer_realloc(omc_buf_t *buf, size_t buf_max, uint32_t required)
+// lookups that return the same response for the same key
+static bool omc_is_request_coalescable(uint8_t opcode)
+{
+  switch (opcode)
+    {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+      return true;
+    }
+  return false;
+}
+
+// quiet and non-quiet lookups of a key can follow each other
+static uint8_t omc_flight_opcode(uint8_t opcode)
+{
+  if (opcode == PROTOCOL_BINARY_CMD_GETQ)
+    return PROTOCOL_BINARY_CMD_GET;
+  if (opcode == PROTOCOL_BINARY_CMD_GETKQ)
+    return PROTOCOL_BINARY_CMD_GETK;
+  return opcode;
+}
+
+static omc_flight_t *omc_flight_find(omcache_t *mc, uint32_t key_hash,
+                                     const omcache_req_t *req, omc_srv_t *server)
+{
+  if (mc->flights.count == 0)
+    return NULL;
+  size_t key_len = be16toh(req->header.keylen);
+  uint8_t opcode = omc_flight_opcode(req->header.opcode);
+  omc_flight_t *flight = mc->flights.buckets[key_hash & (mc->flights.bucket_count - 1)];
+  for (; flight != NULL; flight = flight->next)
+    if (flight->key_hash == key_hash && flight->opcode == opcode &&
+        flight->conn->server == server && flight->key_len == key_len &&
+        memcmp(flight->key, req->key, key_len) == 0)
+      return flight;
+  return NULL;
+}
+
+static void omc_flight_unhash(omcache_t *mc, omc_flight_t *flight)
+{
+  if (!flight->hashed)
+    return;
+  omc_flight_t **fp = &mc->flights.buckets[flight->key_hash & (mc->flights.bucket_count - 1)];
+  while (*fp != flight)
+    fp = &(*fp)->next;
+  *fp = flight->next;
+  flight->hashed = false;
+  mc->flights.count --;
+}
+
+// later lookups of a key that is being written must not follow the
+// flights sent before the write, they keep landing for their followers
+static void omc_flights_detach(omcache_t *mc, uint32_t key_hash,
+                               const unsigned char *key, size_t key_len)
+{
+  if (mc->flights.count == 0)
+    return;
+  omc_flight_t **fp = &mc->flights.buckets[key_hash & (mc->flights.bucket_count - 1)];
+  while (*fp != NULL)
+    {
+      omc_flight_t *flight = *fp;
+      if (flight->key_hash == key_hash && flight->key_len == key_len &&
+          memcmp(flight->key, key, key_len) == 0)
+        {
+          *fp = flight->next;
+          flight->hashed = false;
+          mc->flights.count --;
+        }
+      else
+        fp = &flight->next;
+    }
+}
+
+static void omc_flights_detach_all(omcache_t *mc)
 {
-  size_t space = buf->end - buf->w, buffered = buf->w - buf->r;
+  for (uint32_t i = 0; i < mc->flights.bucket_count && mc->flights.count; i ++)
+    for (; mc->flights.buckets[i]; mc->flights.buckets[i] = mc->flights.buckets[i]->next)
+      {
+        mc->flights.buckets[i]->hashed = false;
+        mc->flights.count --;
+      }
+}
+
+static void omc_flight_release(omcache_t *mc, omc_flight_t *flight)
+{
+  omc_flight_unhash(mc, flight);
+  flight->next = mc->flights.freelist;
+  mc->flights.freelist = flight;
+}
+
+// start a flight for a lookup sent to 'srv'
+static omc_flight_t *omc_flight_launch(omcache_t *mc, omc_srv_t *srv,
+                                       uint32_t key_hash, const omcache_req_t *req)
+{
+  omc_flight_t *flight = mc->flights.freelist;
+  if (flight)
+    mc->flights.freelist = flight->next;
+  else
+    flight = calloc(1, sizeof(*flight));
+  flight->conn = srv;
+  flight->req_id = req->header.opaque;
+  flight->key_hash = key_hash;
+  flight->opcode = omc_flight_opcode(req->header.opcode);
+  flight->key_len = be16toh(req->header.keylen);
+  flight->follower_count = 0;
+  memcpy(flight->key, req->key, flight->key_len);
+
+  if (mc->flights.count >= mc->flights.bucket_count)
+    {
+      // double the hash table and move the flights over
+      uint32_t old_count = mc->flights.bucket_count;
+      omc_flight_t **old = mc->flights.buckets;
+      mc->flights.bucket_count = max(64, old_count * 2);
+      mc->flights.buckets = calloc(mc->flights.bucket_count, sizeof(*mc->flights.buckets));
+      for (uint32_t i = 0; i < old_count; i ++)
+        while (old[i])
+          {
+            omc_flight_t *f = old[i];
+            old[i] = f->next;
+            f->next = mc->flights.buckets[f->key_hash & (mc->flights.bucket_count - 1)];
+            mc->flights.buckets[f->key_hash & (mc->flights.bucket_count - 1)] = f;
+          }
+      free(old);
+    }
+  omc_flight_t **bucket = &mc->flights.buckets[key_hash & (mc->flights.bucket_count - 1)];
+  flight->next = *bucket;
+  *bucket = flight;
+  flight->hashed = true;
+  mc->flights.count ++;
+
+  // queue the flight on the connection, the queue is a ring of a power
+  // of two entries
+  if (srv->flight_count == srv->flight_size)
+    {
+      uint32_t size = max(16, srv->flight_size * 2);
+      omc_flight_t **flights = malloc(size * sizeof(*flights));
+      for (uint32_t i = 0; i < srv->flight_count; i ++)
+        flights[i] = srv->flights[(srv->flight_head + i) & (srv->flight_size - 1)];
+      free(srv->flights);
+      srv->flights = flights;
+      srv->flight_size = size;
+      srv->flight_head = 0;
+    }
+  srv->flights[(srv->flight_head + srv->flight_count ++) & (srv->flight_size - 1)] = flight;
+  return flight;
+}
 
-  if (space >= required)
+static void omc_flight_follow(omc_flight_t *flight, const omcache_req_t *req)
+{
+  if (flight->follower_count == flight->follower_size)
+    {
+      flight->follower_size = max(4, flight->follower_size * 2);
+      flight->followers = realloc(flight->followers, flight->follower_size * sizeof(*flight->followers));
+    }
+  flight->followers[flight->follower_count ++] = (struct omc_flight_follower_s) {
+    .req_id = req->header.opaque,
+    .quiet = omc_is_request_quiet(req->header.opcode),
+    };
+}
+
+// pass the response to the first flight queued on 'srv' to its followers,
+// or if 'value' is NULL, complete them as misses as the quiet lookup
+// leading the flight didn't return a response
+static bool omc_flight_land(omcache_t *mc, omc_srv_t *srv, omcache_value_t *value)
+{
+  omc_flight_t *flight = srv->flights[srv->flight_head];
+  srv->flight_head = (srv->flight_head + 1) & (srv->flight_size - 1);
+  srv->flight_count --;
+  omc_srv_debug(srv, "flight %u landed with %u followers", flight->req_id, flight->follower_count);
+
+  bool kept = false;
+  for (uint32_t i = 0; i < flight->follower_count; i ++)
+    {
+      struct omc_flight_follower_s *follower = &flight->followers[i];
+      if (value && (value->status == OMCACHE_OK || !follower->quiet))
+        {
+          kept |= omc_return_value(mc, srv, value, follower->req_id, false);
+        }
+      else if (value == NULL && !follower->quiet)
+        {
+          omc_call_t *call = omc_call_find(mc, follower->req_id);
+          omcache_req_t *req = call ?
+            omc_seq_table_find(call->table, follower->req_id) : NULL;
+          omcache_value_t miss = {
+            .status = OMCACHE_NOT_FOUND,
+            .key = req ? req->key : flight->key,
+            .key_len = flight->key_len,
+            };
+          omc_return_value(mc, srv, &miss, follower->req_id, false);
+        }
+      else
+        {
+          omc_lookup_complete(mc, follower->req_id);
+        }
+    }
+  omc_flight_release(mc, flight);
+  return kept;
+}
+
+// forget the flights of a connection that was reset or freed, the
+// followers are failed along with the connection's other requests
+static void omc_flights_drop(omcache_t *mc, omc_srv_t *srv)
+{
+  for (; srv->flight_count; srv->flight_count --)
+    {
+      omc_flight_release(mc, srv->flights[srv->flight_head]);
+      srv->flight_head = (srv->flight_head + 1) & (srv->flight_size - 1);
+    }
+  srv->flight_head = 0;
+}
+
+// true if values pinned by the caller still use the receive buffer
+static bool omc_recv_buffer_pinned(omc_srv_t *srv)
+{
+  omcache_pin_t *pin = srv->recv_pin;
+  if (pin == NULL)
+    return false;
+  // nobody can take new references without holding the handle's lock
+  if (__atomic_load_n(&pin->refs, __ATOMIC_ACQUIRE) > 1)
+    return true;
+  free(pin);
+  srv->recv_pin = NULL;
+  return false;
+}
+
+// the pin of a connection's receive buffer, holding a reference on
+// behalf of the connection
+static omcache_pin_t *omc_recv_buffer_pin(omc_srv_t *srv)
+{
+  if (srv->recv_pin == NULL)
+    {
+      omc_buf_t *buf = &srv->recv_buffer;
+      srv->recv_pin = malloc(sizeof(*srv->recv_pin));
+      srv->recv_pin->refs = 1;
+      srv->recv_pin->base = buf->base;
+      srv->recv_pin->size = buf->end - buf->base;
+    }
+  return srv->recv_pin;
+}
+
+#ifdef WITH_THREADS
+// keep the receive buffer holding a value returned to 'call' until the
+// call's thread starts its next call, other threads may process more
+// responses from the connection in the meantime
+static void omc_call_pin(omc_call_t *call, omc_srv_t *srv, const omcache_value_t *value)
+{
+  omc_buf_t *buf = &srv->recv_buffer;
+  const unsigned char *p = value->data_len ? value->data : value->key;
+  if (p == NULL || p < buf->base || p >= buf->end)
+    return;
+  omcache_pin_t *pin = omc_recv_buffer_pin(srv);
+  if (call->pin_count && call->pins[call->pin_count - 1] == pin)
+    return;
+  call->pins = omc_scratch_reserve(call->pins, &call->pins_size, call->pin_count + 1, sizeof(*call->pins));
+  __atomic_add_fetch(&pin->refs, 1, __ATOMIC_RELAXED);
+  call->pins[call->pin_count ++] = pin;
+}
+#endif // WITH_THREADS
+
+static void omc_recv_pool_put(omcache_t *mc, unsigned char *base, size_t size)
+{
+  if (size == OMC_RECV_SEGMENT_SIZE && mc->recv_pool.free_count < OMC_RECV_POOL_MAX)
+    {
+      // the segment's first bytes link it to the next free one
+      *(unsigned char **) base = mc->recv_pool.free;
+      mc->recv_pool.free = base;
+      mc->recv_pool.free_count ++;
+    }
+  else
+    {
+      free(base);
+    }
+}
+
+// called when a new iteration starts: the values returned from the
+// retired buffers aren't needed anymore
+static void omc_recv_pool_reclaim(omcache_t *mc)
+{
+  for (size_t i = 0; i < mc->recv_pool.retired_count; i ++)
+    {
+      omcache_pin_t *pin = mc->recv_pool.retired[i];
+      if (__atomic_load_n(&pin->refs, __ATOMIC_ACQUIRE) == 1)
+        {
+          omc_recv_pool_put(mc, pin->base, pin->size);
+          free(pin);
+        }
+      else
+        {
+          omcache_value_unpin(pin);
+        }
+    }
+  mc->recv_pool.retired_count = 0;
+}
+
+// take a connection's receive buffer away from it, discarding any
+// unprocessed data.  the buffer is returned to the handle's segment pool
+// unless it holds values returned in this iteration or values pinned by
+// the caller.
+static void omc_recv_buffer_release(omcache_t *mc, omc_srv_t *srv)
+{
+  omc_buf_t *buf = &srv->recv_buffer;
+  if (srv->keep_recv_buffer_iteration == mc->lookup.iteration && buf->base != NULL)
+    {
+      omcache_pin_t *pin = srv->recv_pin;
+      if (pin == NULL)
+        {
+          pin = malloc(sizeof(*pin));
+          pin->refs = 1;
+          pin->base = buf->base;
+          pin->size = buf->end - buf->base;
+        }
+      srv->recv_pin = NULL;
+      mc->recv_pool.retired = omc_scratch_reserve(mc->recv_pool.retired, &mc->recv_pool.retired_size,
+                                                  mc->recv_pool.retired_count + 1, sizeof(omcache_pin_t *));
+      mc->recv_pool.retired[mc->recv_pool.retired_count ++] = pin;
+    }
+  else if (omc_recv_buffer_pinned(srv))
+    {
+      omcache_value_unpin(srv->recv_pin);
+      srv->recv_pin = NULL;
+    }
+  else if (buf->base != NULL)
+    {
+      omc_recv_pool_put(mc, buf->base, buf->end - buf->base);
+    }
+  buf->base = NULL;
+  buf->end = NULL;
+  buf->r = NULL;
+  buf->w = NULL;
+}
+
+// make room for 'required' bytes after the unprocessed data in a
+// connection's receive buffer.  responses that fit in a segment are read
+// into segments borrowed from the handle's pool, larger ones get a buffer
+// of their own so they're never moved once their reading has started.
+static int omc_recv_buffer_reserve(omcache_t *mc, omc_srv_t *srv, size_t required)
+{
+  omc_buf_t *buf = &srv->recv_buffer;
+  if ((size_t) (buf->end - buf->w) >= required)
+    return OMCACHE_OK;
+  // a buffer larger than a segment is sized for the response being read
+  // into it, the space left in it is all the response needs
+  if (buf->w < buf->end && (size_t) (buf->end - buf->base) > OMC_RECV_SEGMENT_SIZE)
     return OMCACHE_OK;
+  size_t buffered = buf->w - buf->r, needed = buffered + required;
+  if (needed > mc->recv_buffer_max)
+    return OMCACHE_BUFFER_FULL;
 
-  // move the contents of the buffer to its beginning
-  if (buf->r != buf->base)
+  // the start of a response is moved to the beginning of its segment
+  // unless the segment holds values that must stay in place
+  if (buf->end - buf->base == OMC_RECV_SEGMENT_SIZE && needed <= OMC_RECV_SEGMENT_SIZE &&
+      srv->keep_recv_buffer_iteration != mc->lookup.iteration &&
+      !omc_recv_buffer_pinned(srv))
     {
       memmove(buf->base, buf->r, buffered);
-      space = buf->end - buf->base - buffered;
+      buf->r = buf->base;
+      buf->w = buf->base + buffered;
+      return OMCACHE_OK;
     }
 
-  // allocate more space if required
-  if (space < required)
+  size_t size = max(needed, OMC_RECV_SEGMENT_SIZE);
+  unsigned char *base = mc->recv_pool.free;
+  if (size == OMC_RECV_SEGMENT_SIZE && base != NULL)
     {
-      if ((size_t) (buf->end - buf->base) + required > buf_max)
-        return OMCACHE_BUFFER_FULL;
-      size_t new_size = min(buf_max, buffered + required + 30000);
-      buf->base = realloc(buf->base, new_size);
-      buf->end = buf->base + new_size;
+      mc->recv_pool.free = *(unsigned char **) base;
+      mc->recv_pool.free_count --;
     }
-
-  buf->r = buf->base;
-  buf->w = buf->base + buffered;
+  else
+    {
+      base = malloc(size);
+    }
+  if (buffered)
+    memcpy(base, buf->r, buffered);
+  omc_recv_buffer_release(mc, srv);
+  buf->base = base;
+  buf->end = base + size;
+  buf->r = base;
+  buf->w = base + buffered;
   return OMCACHE_OK;
 }
 
 static int omc_do_read(omcache_t *mc, omc_srv_t *srv, size_t msg_size)
 {
+#ifdef WITH_IO_URING
+  // process anything received by the io_uring engine before reading more
+  if (srv->ur_ready)
+    {
+      srv->ur_ready = false;
+      return OMCACHE_OK;
+    }
+#endif // WITH_IO_URING
   // make sure we have room for at least the requested bytes, but read as much as possible
   size_t space = srv->recv_buffer.end - srv->recv_buffer.w;
   if (space < msg_size)
     {
-      if (srv->keep_recv_buffer_iteration == mc->lookup.iteration)
-        return OMCACHE_BUFFER_FULL;
-      if (omc_buffer_realloc(&srv->recv_buffer, mc->recv_buffer_max, msg_size) != OMCACHE_OK)
+      if (omc_recv_buffer_reserve(mc, srv, msg_size) != OMCACHE_OK)
         return OMCACHE_BUFFER_FULL;
       space = srv->recv_buffer.end - srv->recv_buffer.w;
     }
+  // with io_uring enabled all reads are performed by omc_io_uring
+  if (omc_uring_enabled(mc))
+    return OMCACHE_AGAIN;
   ssize_t res = read(srv->sock, srv->recv_buffer.w, space);
   if (res <= 0 && errno != EINTR && errno != EAGAIN)
     {
-      omc_srv_reset(mc, srv, "read failed");
-      return OMCACHE_SERVER_FAILURE;
+      omc_srv_reset(mc, srv, "read failed");
+      return OMCACHE_SERVER_FAILURE;
+    }
+  omc_srv_debug(srv, "read %zd bytes to a buffer of %zu bytes %s",
+                res, space, (res == -1) ? strerror(errno) : "");
+  if (res <= 0)
+    return OMCACHE_AGAIN;
+  srv->recv_buffer.w += res;
+  // push back dead timeout as we managed to do some io here
+  srv->dead_timeout_start = omc_msec();
+  srv->retry_at = 0;
+  return OMCACHE_OK;
+}
+
+// true if the value of a successful lookup response should be passed to
+// the stream callback in pieces instead of being buffered in full
+static bool omc_stream_wanted(omcache_t *mc, const protocol_binary_response_header *hdr,
+                              size_t head_size, size_t msg_size)
+{
+  if (mc->stream_cb == NULL || hdr->response.status != 0 ||
+      !omc_is_request_lookup(hdr->response.opcode) ||
+      head_size + 255 > mc->recv_buffer_max)
+    return false;
+  return msg_size - head_size > mc->stream_min_size || msg_size > mc->recv_buffer_max;
+}
+
+static int omc_srv_stream_start(omcache_t *mc, omc_srv_t *srv,
+                                const protocol_binary_response_header *hdr, size_t head_size)
+{
+  // keep room for the header and at most a segment of the value
+  size_t window = min(OMC_RECV_SEGMENT_SIZE, mc->recv_buffer_max - head_size);
+  size_t buffered = srv->recv_buffer.w - srv->recv_buffer.r;
+  if (buffered < head_size + window &&
+      omc_recv_buffer_reserve(mc, srv, head_size + window - buffered) != OMCACHE_OK)
+    return OMCACHE_BUFFER_FULL;
+  srv->stream.active = true;
+  srv->stream.head_size = head_size;
+  srv->stream.flags = 0;
+  if (hdr->response.extlen == 4)
+    {
+      memcpy(&srv->stream.flags, srv->recv_buffer.r + sizeof(*hdr), 4);
+      srv->stream.flags = be32toh(srv->stream.flags);
+    }
+  srv->stream.cas = be64toh(hdr->response.cas);
+  srv->stream.offset = 0;
+  srv->stream.data_len = sizeof(*hdr) + be32toh(hdr->response.bodylen) - head_size;
+  omc_srv_debug(srv, "streaming a value of %zu bytes, id %u",
+                srv->stream.data_len, hdr->response.opaque);
+  return OMCACHE_OK;
+}
+
+// pass the received part of a streamed value to the stream callback and
+// discard it from the buffer.  once the whole value has been passed the
+// response is rewritten to one without a value and processed normally.
+static int omc_srv_stream(omcache_t *mc, omc_srv_t *srv)
+{
+  omc_buf_t *buf = &srv->recv_buffer;
+  protocol_binary_response_header hdr;
+  memcpy(&hdr, buf->r, sizeof(hdr));
+  unsigned char *data = buf->r + srv->stream.head_size;
+  size_t buffered = buf->w - data;
+  size_t len = min(buffered, srv->stream.data_len - srv->stream.offset);
+  if (len)
+    {
+      omcache_value_t value = {0};
+      value.status = OMCACHE_OK;
+      value.key = buf->r + sizeof(hdr) + hdr.response.extlen;
+      value.key_len = be16toh(hdr.response.keylen);
+      value.data = data;
+      value.data_len = len;
+      value.flags = srv->stream.flags;
+      value.cas = srv->stream.cas;
+      mc->stream_cb(mc, &value, srv->stream.offset, srv->stream.data_len, mc->stream_cb_context);
+      srv->stream.offset += len;
+      // anything after the value belongs to the following responses
+      memmove(data, data + len, buffered - len);
+      buf->w -= len;
     }
-  omc_srv_debug(srv, "read %zd bytes to a buffer of %zu bytes %s",
-                res, space, (res == -1) ? strerror(errno) : "");
-  if (res <= 0)
-    return OMCACHE_AGAIN;
-  srv->recv_buffer.w += res;
-  // push back dead timeout as we managed to do some io here
-  srv->dead_timeout_start = omc_msec();
-  srv->retry_at = 0;
+  if (srv->stream.offset < srv->stream.data_len)
+    return omc_do_read(mc, srv, 1);
+  hdr.response.bodylen = htobe32(srv->stream.head_size - sizeof(hdr));
+  memcpy(buf->r, &hdr, sizeof(hdr));
+  srv->stream.active = false;
+  srv->stream.done = true;
   return OMCACHE_OK;
 }
 
+// requests for a key stay on one of the server's connections while none
+// of them is disabled; the near cache fill barrier only orders requests
+// sent over the same connection
+static bool omc_srv_conns_stable(omc_srv_t *srv)
+{
+  omc_srv_t *server = srv->server;
+  for (uint32_t i = 0; i < server->conn_count && server->conn_count > 1; i ++)
+    if (server->conns[i]->disabled)
+      return false;
+  return true;
+}
+
 // read any responses returned by the server calling mc->resp_cb on them.
 // if a response's 'opaque' matches req_id store that response in *resp.
 static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
@@ -1026,13 +3036,10 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
   protocol_binary_response_header stack_header;
   int ret = OMCACHE_OK;
 
-  // reset read buffer in case everything was processed
+  // return the buffer to the pool in case everything was processed
   if (srv->recv_buffer.r == srv->recv_buffer.w &&
       srv->keep_recv_buffer_iteration != mc->lookup.iteration)
-    {
-      srv->recv_buffer.r = srv->recv_buffer.base;
-      srv->recv_buffer.w = srv->recv_buffer.base;
-    }
+    omc_recv_buffer_release(mc, srv);
 
   // handle as many messages as possible
   for (int i=0; ret == OMCACHE_OK; i++)
@@ -1042,6 +3049,11 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
           ret = omc_do_read(mc, srv, 255);
           continue;
         }
+      if (srv->stream.active)
+        {
+          ret = omc_srv_stream(mc, srv);
+          continue;
+        }
 
       omcache_value_t value = {0};
       size_t buffered = srv->recv_buffer.w - srv->recv_buffer.r;
@@ -1079,6 +3091,15 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
       // check body length (but don't overwrite it in the buffer yet)
       size_t body_size = be32toh(hdr->response.bodylen);
       msg_size += body_size;
+      size_t head_size = sizeof(hdr->bytes) + hdr->response.extlen + be16toh(hdr->response.keylen);
+      if (omc_stream_wanted(mc, hdr, head_size, msg_size))
+        {
+          if (buffered < head_size)
+            ret = omc_do_read(mc, srv, head_size - buffered);
+          else
+            ret = omc_srv_stream_start(mc, srv, hdr, head_size);
+          continue;
+        }
       if (buffered < msg_size)
         {
           omc_srv_debug(srv, "msg %d: not enough data in buffer (%zd, need %zd)",
@@ -1112,9 +3133,17 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
       bool multi_req = (hdr->response.opcode == PROTOCOL_BINARY_CMD_STAT &&
         hdr->response.status == 0 && hdr->response.keylen != 0);
 
+      // a response to a request sent before a req_id wraparound can't be
+      // ordered against the requests sent after it
+      bool stale = hdr->response.opaque > mc->req_id;
+
       if (hdr->response.opaque)
         {
-          if (!multi_req)
+          // quiet lookups leading flights that were passed by this
+          // response without a response of their own were misses
+          while (!stale && srv->flight_count && srv->flights[srv->flight_head]->req_id < hdr->response.opaque)
+            omc_flight_land(mc, srv, NULL);
+          if (!multi_req && !stale)
             {
               // set last received request number for everything but a
               // successful response to stat request which doesn't have an
@@ -1125,7 +3154,8 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
             {
               // when we receive a NOOP all quiet lookups before this request will
               // not return a value
-              omc_lookup_discard_requests(mc, srv, hdr->response.opaque);
+              if (!stale)
+                omc_lookup_discard_requests(mc, srv, hdr->response.opaque);
               if (hdr->response.opaque == srv->expected_noop)
                 {
                   // a connection setup noop message, mark server alive and don't process this further.
@@ -1134,6 +3164,11 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
                     {
                       omc_srv_log(LOG_NOTICE, srv, "%s", "re-enabling server");
                       srv->disabled = false;
+                      omc_srv_update_down(mc, srv);
+                      // keys move back to this connection, lookups sent
+                      // on it may not see writes sent on the others
+                      if (srv->server->conn_count > 1)
+                        mc->near.barrier = true;
                     }
                   srv->recv_buffer.r += msg_size;
                   omc_srv_debug(srv, "%s", "received expected noop packet");
@@ -1149,12 +3184,18 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
       value.data = value.key + value.key_len;
       value.data_len = be32toh(hdr->response.bodylen) - hdr->response.extlen - value.key_len;
       value.cas = be64toh(hdr->response.cas);
+      bool streamed = srv->stream.done;
+      if (streamed)
+        {
+          // the value was passed to the stream callback
+          srv->stream.done = false;
+          value.data = NULL;
+          value.data_len = 0;
+          value.stream_len = srv->stream.data_len;
+        }
 
       if (hdr->response.extlen == 4 &&
-          (hdr->response.opcode == PROTOCOL_BINARY_CMD_GET ||
-           hdr->response.opcode == PROTOCOL_BINARY_CMD_GETQ ||
-           hdr->response.opcode == PROTOCOL_BINARY_CMD_GETK ||
-           hdr->response.opcode == PROTOCOL_BINARY_CMD_GETKQ))
+          omc_is_request_lookup(hdr->response.opcode))
         {
           // don't cast recv_buffer to protocol_binary_response_header as
           // that'd require us to realign it properly and in practice we'll
@@ -1177,12 +3218,25 @@ static int omc_srv_read(omcache_t *mc, omc_srv_t *srv)
 
       srv->recv_buffer.r += msg_size;
 
-      if (omc_return_value(mc, srv, &value, hdr->response.opaque, multi_req))
+      // store the values returned by keyed lookups in the near cache
+      if (mc->near.cache && value.status == OMCACHE_OK && value.key_len && !streamed &&
+          !stale && hdr->response.opaque > mc->near.fill_after &&
+          omc_is_request_lookup(hdr->response.opcode) && omc_srv_conns_stable(srv))
+        omc_near_cache_add(mc->near.cache, &value, omc_msec());
+
+      bool kept = omc_return_value(mc, srv, &value, hdr->response.opaque, multi_req);
+      if (srv->flight_count && srv->flights[srv->flight_head]->req_id == hdr->response.opaque)
+        kept |= omc_flight_land(mc, srv, &value);
+      if (kept)
         {
           // don't overwrite the buffer to avoid overwriting the response
           srv->keep_recv_buffer_iteration = mc->lookup.iteration;
         }
     }
+  // give the buffer back to the pool if there's nothing left in it
+  if (srv->recv_buffer.r == srv->recv_buffer.w &&
+      srv->keep_recv_buffer_iteration != mc->lookup.iteration)
+    omc_recv_buffer_release(mc, srv);
   if (ret == OMCACHE_BUFFER_FULL)
     return ret;
   if (srv->last_req_recvd < srv->last_req_sent_nq)
@@ -1202,7 +3256,12 @@ static int omc_srv_io(omcache_t *mc, omc_srv_t *srv)
     return ret;
 
   ssize_t buf_len = srv->send_buffer.w - srv->send_buffer.r;
-  if (buf_len > 0)
+  if (buf_len > 0 && omc_uring_enabled(mc))
+    {
+      // buffered data is sent by omc_io_uring
+      ret = OMCACHE_AGAIN;
+    }
+  else if (buf_len > 0)
     {
       ssize_t res = send(srv->sock, srv->send_buffer.r, buf_len, MSG_NOSIGNAL);
       if (srv->dead_timeout_start == 0)
@@ -1239,9 +3298,598 @@ static int omc_srv_io(omcache_t *mc, omc_srv_t *srv)
       if (read_ret != OMCACHE_OK)
         ret = read_ret;
     }
-
+
+  omc_srv_mark_dirty(mc, srv);
+  return ret;
+}
+
+#ifdef WITH_ASYNCNS
+// handle name resolution results and start connecting to resolved hosts
+static void omc_asyncns_process(omcache_t *mc)
+{
+  asyncns_wait(mc->ans, 0);
+  for (int j=0; j<mc->conn_count; j++)
+    if (mc->conns[j]->nsq)
+      omc_srv_connect(mc, mc->conns[j]);
+}
+#endif // WITH_ASYNCNS
+
+// poll all servers that have pending operations and perform io on the ones
+// that are ready.  *nfds is set to the number of polled descriptors.
+static int omc_io_poll(omcache_t *mc, int32_t timeout_msec,
+                       int *nfds, bool *found_new_names omc_attribute_unused)
+{
+  int ret = OMCACHE_OK;
+  int timeout_poll = -1, polls omc_attribute_unused = -1;
+  struct pollfd *pfds = omcache_poll_fds(mc, nfds, &timeout_poll);
+  if (*nfds == 0)
+    return OMCACHE_OK;
+  timeout_poll = (timeout_msec >= 0) ? min(timeout_msec, timeout_poll) : timeout_poll;
+  polls = poll(pfds, *nfds, timeout_poll);
+  omc_debug("poll(%d, %d): %d %s", *nfds, timeout_poll, polls, polls == -1 ? strerror(errno) : "");
+  int64_t now = omc_msec();
+  for (int i = 0; i < *nfds; i++)
+    {
+#ifdef WITH_ASYNCNS
+      if (pfds[i].fd == mc->ans_fd)
+        {
+          *found_new_names = true;
+          omc_asyncns_process(mc);
+          continue;
+        }
+#endif // WITH_ASYNCNS
+      int conn_index = omc_int_hash_table_find(mc->fd_table, pfds[i].fd);
+      if (conn_index == -1)
+        {
+          omc_log(LOG_ERR, "server socket %d not found from fd_table!", pfds[i].fd);
+          abort();
+        }
+      omc_srv_t *srv = mc->conns[conn_index];
+      if (srv->sock != pfds[i].fd)
+        {
+          omc_srv_log(LOG_ERR, srv, "server socket %d does not match poll fd %d!", srv->sock, pfds[i].fd);
+          abort();
+        }
+      if (!pfds[i].revents)
+        {
+          // reset connections that have timed out
+          if (srv->dead_timeout_start && now - srv->dead_timeout_start >= mc->dead_timeout_msec)
+            {
+              errno = ETIME;
+              omc_srv_reset(mc, srv, "io timeout");
+            }
+          continue;
+        }
+      ret = omc_srv_io(mc, srv);
+      omc_srv_debug(srv, "io: %s", omcache_strerror(ret));
+      if (!(ret == OMCACHE_OK || ret == OMCACHE_AGAIN || ret == OMCACHE_BUFFER_FULL))
+        break;
+    }
+  return ret;
+}
+
+#ifdef WITH_EPOLL
+// wait for events on the persistent epoll set and perform io on the servers
+// that are ready.  only servers whose state changed since the last round are
+// re-evaluated unless a connection or io timeout may have expired.
+static int omc_io_epoll(omcache_t *mc, int32_t timeout_msec,
+                        int *nfds, bool *found_new_names omc_attribute_unused)
+{
+  int ret = OMCACHE_OK;
+  int64_t now = omc_msec();
+  omc_epoll_update(mc, now);
+  *nfds = mc->ep.armed;
+  if (*nfds == 0 && mc->ep.dirty_count == 0)
+    return OMCACHE_OK;
+
+  int timeout_poll = 0;
+  if (mc->ep.dirty_count == 0)
+    timeout_poll = max(mc->ep.timeout_at - now, (int64_t) 1);
+  timeout_poll = (timeout_msec >= 0) ? min(timeout_msec, timeout_poll) : timeout_poll;
+  struct epoll_event events[OMC_EPOLL_MAX_EVENTS];
+  int polls = epoll_wait(mc->ep.fd, events, OMC_EPOLL_MAX_EVENTS, timeout_poll);
+  omc_debug("epoll_wait(%d, %d): %d %s", *nfds, timeout_poll, polls, polls == -1 ? strerror(errno) : "");
+  mc->ep.round ++;
+  for (int i = 0; i < polls; i++)
+    {
+      omc_srv_t *srv = events[i].data.ptr;
+#ifdef WITH_ASYNCNS
+      if (srv == NULL)
+        {
+          *found_new_names = true;
+          omc_asyncns_process(mc);
+          continue;
+        }
+#endif // WITH_ASYNCNS
+      srv->ep_round = mc->ep.round;
+      if (srv->ep_events == 0)
+        {
+          // we're not interested in any events from this server, but an
+          // idle connection reported an error or a hangup
+          errno = ECONNRESET;
+          omc_srv_reset(mc, srv, "idle connection closed");
+          continue;
+        }
+      ret = omc_srv_io(mc, srv);
+      omc_srv_debug(srv, "io: %s", omcache_strerror(ret));
+      if (!(ret == OMCACHE_OK || ret == OMCACHE_AGAIN || ret == OMCACHE_BUFFER_FULL))
+        break;
+    }
+
+  now = omc_msec();
+  if (mc->ep.timeout_at && now >= mc->ep.timeout_at)
+    {
+      // reset connections that have timed out and re-evaluate everything
+      // else to pick up connection timeouts and the next deadline
+      mc->ep.timeout_at = 0;
+      for (int i = 0; i < mc->conn_count; i++)
+        {
+          omc_srv_t *srv = mc->conns[i];
+          if (srv->ep_armed && srv->ep_round != mc->ep.round &&
+              srv->dead_timeout_start && now - srv->dead_timeout_start >= mc->dead_timeout_msec)
+            {
+              errno = ETIME;
+              omc_srv_reset(mc, srv, "io timeout");
+            }
+          omc_srv_mark_dirty(mc, srv);
+        }
+    }
+  return ret;
+}
+#endif // WITH_EPOLL
+
+#ifdef WITH_IO_URING
+// io_uring user_data consists of the epoch of the server list (32 bits),
+// the index of the server (30 bits) and the operation (2 bits).  the epoch
+// is bumped when the server list changes so that completions of operations
+// referring to the old list can be ignored.
+enum omc_uring_op_e
+{
+  OMC_URING_REMOVE = 0,
+  OMC_URING_SEND = 1,
+  OMC_URING_RECV = 2,
+  OMC_URING_POLL = 3,
+};
+#define OMC_URING_ANS_INDEX 0x3fffffff
+#define omc_uring_data(mc,idx,op) (((uint64_t) (mc)->ur.epoch << 32) | ((uint64_t) (idx) << 2) | (op))
+
+static int omc_uring_init(omcache_t *mc)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  int fd = syscall(__NR_io_uring_setup, OMC_URING_ENTRIES, &params);
+  if (fd < 0)
+    return -1;
+  // we map both rings at once and need timeouts for waits, i.e. linux 5.11+
+  if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG))
+    {
+      close(fd);
+      errno = ENOSYS;
+      return -1;
+    }
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  mc->ur.ring_size = max(sq_size, cq_size);
+  mc->ur.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+  mc->ur.ring = mmap(NULL, mc->ur.ring_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  mc->ur.sqes = (mc->ur.ring == MAP_FAILED) ? MAP_FAILED :
+    mmap(NULL, mc->ur.sqes_size, PROT_READ | PROT_WRITE,
+         MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+  if (mc->ur.sqes == MAP_FAILED)
+    {
+      int err = errno;
+      if (mc->ur.ring != MAP_FAILED)
+        munmap(mc->ur.ring, mc->ur.ring_size);
+      close(fd);
+      errno = err;
+      return -1;
+    }
+  unsigned char *ring = mc->ur.ring;
+  mc->ur.sq_khead = (uint32_t *) (ring + params.sq_off.head);
+  mc->ur.sq_ktail = (uint32_t *) (ring + params.sq_off.tail);
+  mc->ur.sq_kmask = (uint32_t *) (ring + params.sq_off.ring_mask);
+  mc->ur.sq_array = (uint32_t *) (ring + params.sq_off.array);
+  mc->ur.cq_khead = (uint32_t *) (ring + params.cq_off.head);
+  mc->ur.cq_ktail = (uint32_t *) (ring + params.cq_off.tail);
+  mc->ur.cq_kmask = (uint32_t *) (ring + params.cq_off.ring_mask);
+  mc->ur.cqes = (struct io_uring_cqe *) (ring + params.cq_off.cqes);
+  mc->ur.sq_entries = params.sq_entries;
+  mc->ur.sq_tail = *mc->ur.sq_ktail;
+  mc->ur.inflight = 0;
+  mc->ur.to_submit = 0;
+  mc->ur.epoch ++;
+  mc->ur.fd = fd;
+  return 0;
+}
+
+static void omc_uring_free(omcache_t *mc)
+{
+  if (!omc_uring_enabled(mc))
+    return;
+  // closing the ring cancels all pending polls, sends and receives are
+  // always completed before we return to the caller
+  munmap(mc->ur.sqes, mc->ur.sqes_size);
+  munmap(mc->ur.ring, mc->ur.ring_size);
+  close(mc->ur.fd);
+  mc->ur.fd = -1;
+#ifdef WITH_ASYNCNS
+  mc->ur.ans_poll = 0;
+  mc->ur.ans_ready = false;
+#endif // WITH_ASYNCNS
+  for (int i = 0; i < mc->conn_count; i ++)
+    {
+      mc->conns[i]->ur_poll = 0;
+      mc->conns[i]->ur_wait = 0;
+      mc->conns[i]->ur_failed = false;
+    }
+}
+
+static void omc_uring_submit(omcache_t *mc, int32_t wait_msec);
+
+static struct io_uring_sqe *omc_uring_sqe(omcache_t *mc, int fd, uint8_t opcode, uint64_t user_data)
+{
+  // submit what we have so far if the submission queue is full
+  if (mc->ur.sq_tail - __atomic_load_n(mc->ur.sq_khead, __ATOMIC_ACQUIRE) >= mc->ur.sq_entries)
+    omc_uring_submit(mc, 0);
+  uint32_t idx = mc->ur.sq_tail & *mc->ur.sq_kmask;
+  struct io_uring_sqe *sqe = &mc->ur.sqes[idx];
+  memset(sqe, 0, sizeof(*sqe));
+  sqe->opcode = opcode;
+  sqe->fd = fd;
+  sqe->user_data = user_data;
+  mc->ur.sq_array[idx] = idx;
+  mc->ur.sq_tail ++;
+  mc->ur.to_submit ++;
+  if (opcode == IORING_OP_SEND || opcode == IORING_OP_RECV)
+    mc->ur.inflight ++;
+  return sqe;
+}
+
+static void omc_uring_complete(omcache_t *mc, uint64_t user_data, int32_t res)
+{
+  uint32_t op = user_data & 3, index = (user_data >> 2) & OMC_URING_ANS_INDEX;
+  if (op == OMC_URING_SEND || op == OMC_URING_RECV)
+    mc->ur.inflight --;
+  if (op == OMC_URING_REMOVE || (user_data >> 32) != mc->ur.epoch)
+    return;
+#ifdef WITH_ASYNCNS
+  if (index == OMC_URING_ANS_INDEX)
+    {
+      if (user_data == mc->ur.ans_poll)
+        {
+          mc->ur.ans_poll = 0;
+          mc->ur.ans_ready = (res >= 0);
+        }
+      return;
+    }
+#endif // WITH_ASYNCNS
+  omc_srv_t *srv = mc->conns[index];
+  switch (op)
+    {
+    case OMC_URING_SEND:
+      if (srv->dead_timeout_start == 0)
+        srv->dead_timeout_start = omc_msec();
+      if (res < 0 && res != -EINTR && res != -EAGAIN)
+        {
+          errno = -res;
+          omc_srv_reset(mc, srv, "write failed");
+          srv->ur_failed = true;
+          break;
+        }
+      omc_srv_debug(srv, "write %d bytes of %zd bytes %s", res,
+                    srv->send_buffer.w - srv->send_buffer.r, (res < 0) ? strerror(-res) : "");
+      if (res > 0)
+        {
+          srv->retry_at = 0;
+          srv->send_buffer.r += res;
+        }
+      // reset send buffer in case everything was written
+      if (srv->send_buffer.r == srv->send_buffer.w)
+        {
+          srv->send_buffer.r = srv->send_buffer.base;
+          srv->send_buffer.w = srv->send_buffer.base;
+        }
+      else
+        {
+          srv->ur_wait |= POLLOUT;
+        }
+      break;
+
+    case OMC_URING_RECV:
+      // ignore the results of a receive that was queued together with a
+      // send that failed and reset the connection
+      if (srv->ur_failed)
+        break;
+      if (res == 0 || (res < 0 && res != -EINTR && res != -EAGAIN))
+        {
+          errno = res ? -res : ECONNRESET;
+          omc_srv_reset(mc, srv, "read failed");
+          srv->ur_failed = true;
+          break;
+        }
+      omc_srv_debug(srv, "read %d bytes to a buffer of %zd bytes %s", res,
+                    srv->recv_buffer.end - srv->recv_buffer.w, (res < 0) ? strerror(-res) : "");
+      if (res < 0)
+        {
+          srv->ur_wait |= POLLIN;
+          break;
+        }
+      srv->recv_buffer.w += res;
+      srv->ur_ready = true;
+      // push back dead timeout as we managed to do some io here
+      srv->dead_timeout_start = omc_msec();
+      srv->retry_at = 0;
+      break;
+
+    case OMC_URING_POLL:
+      if (user_data != srv->ur_poll)
+        break;
+      srv->ur_poll = 0;
+      if (res >= 0)
+        srv->ur_ready = true;
+      break;
+    }
+}
+
+static void omc_uring_reap(omcache_t *mc)
+{
+  uint32_t head = *mc->ur.cq_khead;
+  while (head != __atomic_load_n(mc->ur.cq_ktail, __ATOMIC_ACQUIRE))
+    {
+      struct io_uring_cqe *cqe = &mc->ur.cqes[head & *mc->ur.cq_kmask];
+      uint64_t user_data = cqe->user_data;
+      int32_t res = cqe->res;
+      __atomic_store_n(mc->ur.cq_khead, ++ head, __ATOMIC_RELEASE);
+      omc_uring_complete(mc, user_data, res);
+    }
+}
+
+// submit queued operations and process their completions.  sends and
+// receives are always nonblocking and are waited for, in addition to them
+// wait up to wait_msec (forever if negative) for one of the polls to fire.
+static void omc_uring_submit(omcache_t *mc, int32_t wait_msec)
+{
+  struct __kernel_timespec ts = {
+    .tv_sec = max(wait_msec, 0) / 1000,
+    .tv_nsec = (max(wait_msec, 0) % 1000) * 1000000,
+    };
+  struct io_uring_getevents_arg arg = { .sigmask_sz = _NSIG / 8 };
+
+  __atomic_store_n(mc->ur.sq_ktail, mc->ur.sq_tail, __ATOMIC_RELEASE);
+  for (;;)
+    {
+      uint32_t min_complete = mc->ur.inflight;
+      if (min_complete == 0 && wait_msec != 0)
+        min_complete = 1;
+      arg.ts = (mc->ur.inflight == 0 && wait_msec > 0) ? (uintptr_t) &ts : 0;
+      int res = syscall(__NR_io_uring_enter, mc->ur.fd, mc->ur.to_submit, min_complete,
+                        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+      omc_debug("io_uring_enter(%u, %u, %d): %d %s", mc->ur.to_submit, min_complete,
+                mc->ur.inflight ? -1 : wait_msec, res, (res == -1) ? strerror(errno) : "");
+      if (res >= 0)
+        {
+          mc->ur.to_submit -= res;
+        }
+      else if (errno != EINTR && errno != ETIME && errno != EAGAIN && errno != EBUSY)
+        {
+          omc_log(LOG_ERR, "io_uring_enter failed: %s", strerror(errno));
+          abort();
+        }
+      if (mc->ur.inflight == 0)
+        wait_msec = 0;
+      omc_uring_reap(mc);
+      if (mc->ur.inflight == 0 && mc->ur.to_submit == 0)
+        break;
+    }
+}
+
+static void omc_uring_queue_send(omcache_t *mc, omc_srv_t *srv)
+{
+  size_t buf_len = srv->send_buffer.w - srv->send_buffer.r;
+  if (!srv->connected || buf_len == 0)
+    return;
+  struct io_uring_sqe *sqe = omc_uring_sqe(mc, srv->sock, IORING_OP_SEND,
+    omc_uring_data(mc, srv->conn_index, OMC_URING_SEND));
+  sqe->addr = (uintptr_t) srv->send_buffer.r;
+  sqe->len = buf_len;
+  sqe->msg_flags = MSG_DONTWAIT | MSG_NOSIGNAL;
+}
+
+static void omc_uring_queue_recv(omcache_t *mc, omc_srv_t *srv)
+{
+  omc_buf_t *buf = &srv->recv_buffer;
+  // reset read buffer in case everything was processed
+  if (buf->r == buf->w && srv->keep_recv_buffer_iteration != mc->lookup.iteration)
+    omc_recv_buffer_release(mc, srv);
+  if (buf->end - buf->w < 255)
+    {
+      if (omc_recv_buffer_reserve(mc, srv, 255) != OMCACHE_OK)
+        {
+          // let omc_srv_read figure out what to do with the full buffer
+          srv->ur_ready = true;
+          return;
+        }
+    }
+  struct io_uring_sqe *sqe = omc_uring_sqe(mc, srv->sock, IORING_OP_RECV,
+    omc_uring_data(mc, srv->conn_index, OMC_URING_RECV));
+  sqe->addr = (uintptr_t) buf->w;
+  sqe->len = buf->end - buf->w;
+  sqe->msg_flags = MSG_DONTWAIT;
+}
+
+static void omc_uring_queue_poll(omcache_t *mc, int fd, int index, uint32_t events)
+{
+  struct io_uring_sqe *sqe = omc_uring_sqe(mc, fd, IORING_OP_POLL_ADD,
+    omc_uring_data(mc, index, OMC_URING_POLL));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  events = (events << 16) | (events >> 16);
+#endif
+  sqe->poll32_events = events;
+}
+
+static void omc_uring_queue_remove(omcache_t *mc, int index, uint64_t user_data)
+{
+  struct io_uring_sqe *sqe = omc_uring_sqe(mc, -1, IORING_OP_POLL_REMOVE,
+    omc_uring_data(mc, index, OMC_URING_REMOVE));
+  sqe->addr = user_data;
+}
+
+// remove all pending polls and invalidate the server indexes stored in
+// operations, called before the server list is modified
+static void omc_uring_cancel(omcache_t *mc)
+{
+#ifdef WITH_ASYNCNS
+  if (mc->ur.ans_poll)
+    omc_uring_queue_remove(mc, OMC_URING_ANS_INDEX, mc->ur.ans_poll);
+  mc->ur.ans_poll = 0;
+#endif // WITH_ASYNCNS
+  for (int i = 0; i < mc->conn_count; i ++)
+    {
+      if (mc->conns[i]->ur_poll)
+        omc_uring_queue_remove(mc, i, mc->conns[i]->ur_poll);
+      mc->conns[i]->ur_poll = 0;
+      mc->conns[i]->ur_wait = 0;
+    }
+  omc_uring_submit(mc, 0);
+  mc->ur.epoch ++;
+}
+
+// send the buffered requests of all servers with a single submission, used
+// when commands are sent without waiting for responses
+static void omc_uring_flush(omcache_t *mc)
+{
+  for (int i = 0; i < mc->conn_count; i ++)
+    omc_uring_queue_send(mc, mc->conns[i]);
+  omc_uring_submit(mc, 0);
+}
+
+// send buffered requests to and receive responses from all servers with a
+// single submission.  if none of the servers had anything for us wait for
+// them to become ready with another submission, the data will be received
+// on the next round.  *nfds is set to the number of servers with pending
+// operations.
+static int omc_io_uring(omcache_t *mc, int32_t timeout_msec,
+                        int *nfds, bool *found_new_names omc_attribute_unused)
+{
+  int ret = OMCACHE_OK;
+  int timeout_poll = mc->dead_timeout_msec;
+  int64_t now = omc_msec();
+  bool ready = false;
+#ifdef WITH_ASYNCNS
+  bool poll_ans = false;
+  if (mc->ur.ans_poll)
+    omc_uring_queue_remove(mc, OMC_URING_ANS_INDEX, mc->ur.ans_poll);
+  mc->ur.ans_poll = 0;
+#endif // WITH_ASYNCNS
+
+  *nfds = 0;
+  for (int i = 0; i < mc->conn_count; i++)
+    {
+      omc_srv_t *srv = mc->conns[i];
+      // polls that didn't fire during the previous round are re-added
+      // below if we still need them
+      if (srv->ur_poll)
+        omc_uring_queue_remove(mc, i, srv->ur_poll);
+      srv->ur_poll = 0;
+      srv->ur_wait = 0;
+      srv->ur_failed = false;
+      short events = omc_srv_poll_events(mc, srv, now, &timeout_poll);
+#ifdef WITH_ASYNCNS
+      if (srv->nsq)
+        poll_ans = true;
+#endif // WITH_ASYNCNS
+      if (events == 0)
+        continue;
+      (*nfds) ++;
+      if (srv->connected)
+        {
+          if (events & POLLOUT)
+            omc_uring_queue_send(mc, srv);
+          if (events & POLLIN)
+            omc_uring_queue_recv(mc, srv);
+        }
+      else
+        {
+          srv->ur_wait = events;
+        }
+    }
+#ifdef WITH_ASYNCNS
+  if (poll_ans)
+    (*nfds) ++;
+#endif // WITH_ASYNCNS
+  omc_uring_submit(mc, 0);
+
+  for (int i = 0; i < mc->conn_count; i++)
+    {
+      omc_srv_t *srv = mc->conns[i];
+      if (srv->ur_failed)
+        {
+          ret = OMCACHE_SERVER_FAILURE;
+          break;
+        }
+      if (!srv->ur_ready)
+        continue;
+      ready = true;
+      ret = omc_srv_io(mc, srv);
+      omc_srv_debug(srv, "io: %s", omcache_strerror(ret));
+      if (!(ret == OMCACHE_OK || ret == OMCACHE_AGAIN || ret == OMCACHE_BUFFER_FULL))
+        break;
+    }
+  if (ready || *nfds == 0 || !(ret == OMCACHE_OK || ret == OMCACHE_AGAIN))
+    return ret;
+
+  // nothing was ready, wait for the sockets we couldn't complete io on
+  for (int i = 0; i < mc->conn_count; i++)
+    {
+      omc_srv_t *srv = mc->conns[i];
+      if (srv->ur_wait && srv->sock >= 0)
+        {
+          omc_uring_queue_poll(mc, srv->sock, i, srv->ur_wait);
+          srv->ur_poll = omc_uring_data(mc, i, OMC_URING_POLL);
+        }
+    }
+#ifdef WITH_ASYNCNS
+  if (poll_ans)
+    {
+      omc_uring_queue_poll(mc, mc->ans_fd, OMC_URING_ANS_INDEX, POLLIN);
+      mc->ur.ans_poll = omc_uring_data(mc, OMC_URING_ANS_INDEX, OMC_URING_POLL);
+    }
+#endif // WITH_ASYNCNS
+  timeout_poll = (timeout_msec >= 0) ? min(timeout_msec, timeout_poll) : timeout_poll;
+  omc_uring_submit(mc, timeout_poll);
+  now = omc_msec();
+#ifdef WITH_ASYNCNS
+  if (mc->ur.ans_ready)
+    {
+      mc->ur.ans_ready = false;
+      *found_new_names = true;
+      omc_asyncns_process(mc);
+    }
+#endif // WITH_ASYNCNS
+  for (int i = 0; i < mc->conn_count; i++)
+    {
+      omc_srv_t *srv = mc->conns[i];
+      if (!srv->ur_wait)
+        continue;
+      if (!srv->ur_ready)
+        {
+          // reset connections that have timed out
+          if (srv->dead_timeout_start && now - srv->dead_timeout_start >= mc->dead_timeout_msec)
+            {
+              errno = ETIME;
+              omc_srv_reset(mc, srv, "io timeout");
+            }
+          continue;
+        }
+      ret = omc_srv_io(mc, srv);
+      omc_srv_debug(srv, "io: %s", omcache_strerror(ret));
+      if (!(ret == OMCACHE_OK || ret == OMCACHE_AGAIN || ret == OMCACHE_BUFFER_FULL))
+        break;
+    }
   return ret;
 }
+#endif // WITH_IO_URING
 
 // Process writes and reads until we see a response to req_id or until
 // timeout_msec has passed.
@@ -1251,42 +3899,39 @@ int omcache_io(omcache_t *mc,
                omcache_value_t *values, size_t *value_count,
                int32_t timeout_msec)
 {
-  int ret = OMCACHE_OK;
-  int64_t now = omc_msec();
-  int64_t timeout_abs = (timeout_msec > 0) ? now + timeout_msec : timeout_msec;
-
-  mc->lookup.iteration ++;
-  if (reqs && req_count && *req_count)
-    {
-      if (!(reqs[0].header.opaque == mc->lookup.min_req &&
-            reqs[*req_count - 1].header.opaque == mc->lookup.max_req))
-        {
-          omc_log(LOG_ERR, "%s", "omcache_io called with requests that are not active");
-          return OMCACHE_INVALID;
-        }
-      mc->lookup.active = true;
-      mc->lookup.values = values;
-      mc->lookup.values_size = value_count ? *value_count : 0;
-      mc->lookup.values_returned = 0;
-    }
-  else
-    {
-      mc->lookup.active = false;
-      mc->lookup.min_req = 0;
-      mc->lookup.max_req = 0;
-    }
+  omc_lock(mc);
+  int ret = omc_io(mc, reqs, req_count, values, value_count, timeout_msec);
+  omc_unlock(mc);
+  return ret;
+}
 
-  if (value_count)
-    *value_count = 0;
+// run one round of I/O on all servers with the configured backend
+static int omc_io_round(omcache_t *mc, int32_t timeout_msec, int *nfds, bool *found_new_names)
+{
+#ifdef WITH_EPOLL
+  if (mc->ep.fd >= 0)
+    return omc_io_epoll(mc, timeout_msec, nfds, found_new_names);
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+  if (omc_uring_enabled(mc))
+    return omc_io_uring(mc, timeout_msec, nfds, found_new_names);
+#endif // WITH_IO_URING
+  return omc_io_poll(mc, timeout_msec, nfds, found_new_names);
+}
 
+// run I/O rounds until the call is complete or the timeout expires,
+// waiting in the backend while holding the handle's lock
+static int omc_io_loop(omcache_t *mc, omc_call_t *call, int64_t timeout_abs, int32_t timeout_msec)
+{
+  int ret = OMCACHE_OK;
   while (ret == OMCACHE_OK || ret == OMCACHE_AGAIN)
     {
-      if (mc->lookup.active)
-        omc_debug("looking for req_ids (%u..%u)", mc->lookup.min_req, mc->lookup.max_req);
+      if (call)
+        omc_debug("looking for req_ids (%u..%u)", call->min_req, call->max_req);
       omc_debug("timeout in %lld msec", (long long) (timeout_abs > 0 ? timeout_abs - omc_msec() : timeout_abs));
       if (timeout_abs > 0)
         {
-          now = omc_msec();
+          int64_t now = omc_msec();
           if (now > timeout_abs)
             {
               omc_debug("%s", "omcache_io timeout");
@@ -1296,59 +3941,15 @@ int omcache_io(omcache_t *mc,
           timeout_msec = timeout_abs - now;
         }
 
-      int nfds = -1, timeout_poll = -1, polls omc_attribute_unused = -1;
-      struct pollfd *pfds = omcache_poll_fds(mc, &nfds, &timeout_poll);
+      int nfds = -1;
+      bool found_new_names = false;
+      ret = omc_io_round(mc, timeout_msec, &nfds, &found_new_names);
       if (nfds == 0)
         {
           omc_debug("%s", "nothing to poll, breaking");
           ret = OMCACHE_OK;
           break;
         }
-      timeout_poll = (timeout_msec >= 0) ? min(timeout_msec, timeout_poll) : timeout_poll;
-      polls = poll(pfds, nfds, timeout_poll);
-      omc_debug("poll(%d, %d): %d %s", nfds, timeout_poll, polls, polls == -1 ? strerror(errno) : "");
-      now = omc_msec();
-      bool found_new_names = false;
-      for (int i = 0; i < nfds; i++)
-        {
-#ifdef WITH_ASYNCNS
-          if (pfds[i].fd == mc->ans_fd)
-            {
-              found_new_names = true;
-              asyncns_wait(mc->ans, 0);
-              for (int j=0; j<mc->server_count; j++)
-                if (mc->servers[j]->nsq)
-                  omc_srv_connect(mc, mc->servers[j]);
-              continue;
-            }
-#endif // WITH_ASYNCNS
-          int server_index = omc_int_hash_table_find(mc->fd_table, pfds[i].fd);
-          if (server_index == -1)
-            {
-              omc_log(LOG_ERR, "server socket %d not found from fd_table!", pfds[i].fd);
-              abort();
-            }
-          omc_srv_t *srv = mc->servers[server_index];
-          if (srv->sock != pfds[i].fd)
-            {
-              omc_srv_log(LOG_ERR, srv, "server socket %d does not match poll fd %d!", srv->sock, pfds[i].fd);
-              abort();
-            }
-          if (!pfds[i].revents)
-            {
-              // reset connections that have timed out
-              if (srv->dead_timeout_start && now - srv->dead_timeout_start >= mc->dead_timeout_msec)
-                {
-                  errno = ETIME;
-                  omc_srv_reset(mc, srv, "io timeout");
-                }
-              continue;
-            }
-          ret = omc_srv_io(mc, srv);
-          omc_srv_debug(srv, "io: %s", omcache_strerror(ret));
-          if (!(ret == OMCACHE_OK || ret == OMCACHE_AGAIN || ret == OMCACHE_BUFFER_FULL))
-            break;
-        }
 
       // break the loop if the receive buffer is full and we can't
       // reallocate it because we've returned pointers to it or if we've
@@ -1359,9 +3960,9 @@ int omcache_io(omcache_t *mc,
           ret = OMCACHE_AGAIN;
           break;
         }
-      if (mc->lookup.active && mc->lookup.found == mc->lookup.count)
+      if (call && call->found == call->count)
         {
-          omc_debug("returned %zu responses, breaking loop", mc->lookup.values_returned);
+          omc_debug("returned %zu responses, breaking loop", call->values_returned);
           ret = OMCACHE_OK;
           break;
         }
@@ -1373,32 +3974,232 @@ int omcache_io(omcache_t *mc,
       if (timeout_msec == 0 && !found_new_names)
         break;
     }
+  return ret;
+}
+
+#ifdef WITH_THREADS
+// wait for the responses to a call on a thread-safe handle without
+// holding the lock while blocked.  one waiting thread polls the
+// connections for everyone and processes the responses it sees, the
+// other threads sleep until their calls are complete or until they have
+// to take over polling.  with the I/O thread running all threads sleep.
+static int omc_io_wait(omcache_t *mc, omc_call_t *call, int64_t timeout_abs)
+{
+  int ret = OMCACHE_OK;
+  // let the polling thread notice the new requests
+  omc_io_wake(mc);
+  while (call->found < call->count)
+    {
+      int32_t timeout_msec = -1;
+      if (timeout_abs > 0)
+        {
+          int64_t now = omc_msec();
+          if (now > timeout_abs)
+            {
+              omc_debug("%s", "omcache_io timeout");
+              ret = OMCACHE_AGAIN;
+              break;
+            }
+          timeout_msec = timeout_abs - now;
+        }
+      if (mc->iot.running || mc->ts.polling)
+        {
+          omc_call_wait(mc, call, timeout_msec);
+          continue;
+        }
+
+      int nfds = -1;
+      bool found_new_names = false;
+      ret = omc_io_round(mc, 0, &nfds, &found_new_names);
+      if (nfds == 0)
+        {
+          omc_debug("%s", "nothing to poll, breaking");
+          ret = OMCACHE_OK;
+          break;
+        }
+      if (ret == OMCACHE_BUFFER_FULL)
+        {
+          omc_debug("%s", "receive buffer full, breaking loop");
+          ret = OMCACHE_AGAIN;
+          break;
+        }
+      if (!(ret == OMCACHE_OK || ret == OMCACHE_AGAIN))
+        break;
+      ret = OMCACHE_AGAIN;
+      if (call->found == call->count || found_new_names)
+        continue;
+
+      int srv_nfds, poll_timeout;
+      struct pollfd *srv_pfds = omcache_poll_fds(mc, &srv_nfds, &poll_timeout);
+      if (timeout_msec >= 0)
+        poll_timeout = min(poll_timeout, timeout_msec);
+      mc->ts.pfds = omc_scratch_reserve(mc->ts.pfds, &mc->ts.pfds_size, srv_nfds + 1, sizeof(*mc->ts.pfds));
+      struct pollfd *pfds = mc->ts.pfds;
+      pfds[0].fd = mc->ts.wake_fds[0];
+      pfds[0].events = POLLIN;
+      pfds[0].revents = 0;
+      memcpy(pfds + 1, srv_pfds, srv_nfds * sizeof(*pfds));
+
+      // other threads may send requests and process responses while we're
+      // polling, they wake us up through the pipe.  nobody else touches
+      // 'pfds' while 'polling' is set.
+      mc->ts.polling = true;
+      omc_unlock(mc);
+      poll(pfds, srv_nfds + 1, poll_timeout);
+      omc_lock(mc);
+      mc->ts.polling = false;
+      if (pfds[0].revents)
+        omc_io_wake_clear(mc);
+    }
+  if (call->found == call->count)
+    ret = OMCACHE_OK;
+  // someone else may have been waiting for us to poll for them
+  omc_io_handoff(mc);
+  return ret;
+}
+#endif // WITH_THREADS
+
+static int omc_io(omcache_t *mc,
+                  omcache_req_t *reqs, size_t *req_count,
+                  omcache_value_t *values, size_t *value_count,
+                  int32_t timeout_msec)
+{
+  int ret;
+  int64_t timeout_abs = (timeout_msec > 0) ? omc_msec() + timeout_msec : timeout_msec;
+  omc_call_t *call = NULL;
+
+  mc->lookup.iteration ++;
+  omc_recv_pool_reclaim(mc);
+  if (reqs && req_count && *req_count)
+    {
+      call = omc_call_get(mc);
+      if (!(reqs[0].header.opaque == call->min_req &&
+            reqs[*req_count - 1].header.opaque == call->max_req))
+        {
+          omc_log(LOG_ERR, "%s", "omcache_io called with requests that are not active");
+          return OMCACHE_INVALID;
+        }
+      call->active = true;
+      call->values = values;
+      call->values_size = value_count ? *value_count : 0;
+      call->values_returned = 0;
+    }
 
-  if ((!mc->lookup.active || mc->lookup.found == mc->lookup.count) && req_count)
+  if (value_count)
+    *value_count = 0;
+
+#ifdef WITH_THREADS
+  // io_uring keeps receives of its own in flight on the sockets, polling
+  // them without the lock could miss the data they consume
+  if (call && timeout_msec != 0 && mc->ts.enabled && mc->ts.depth == 1 && !omc_uring_enabled(mc))
+    ret = omc_io_wait(mc, call, timeout_abs);
+  else
+#endif // WITH_THREADS
+    ret = omc_io_loop(mc, call, timeout_abs, timeout_msec);
+
+  if ((call == NULL || call->found == call->count) && req_count)
     *req_count = 0;
   if (value_count)
-    *value_count = mc->lookup.values_returned;
-  mc->lookup.active = false;
+    *value_count = call ? call->values_returned : 0;
+  if (call)
+    call->active = false;
   return ret;
 }
 
 int omcache_set_buffering(omcache_t *mc, uint32_t enabled)
 {
+  omc_lock(mc);
   mc->buffer_writes = enabled ? true : false;
+  omc_unlock(mc);
   return OMCACHE_OK;
 }
 
 int omcache_reset_buffers(omcache_t *mc)
 {
-  for (off_t i=0; i<mc->server_count; i++)
+  omc_lock(mc);
+  for (off_t i=0; i<mc->conn_count; i++)
     {
-      omc_srv_t *srv = mc->servers[i];
+      omc_srv_t *srv = mc->conns[i];
       srv->send_buffer.r = srv->send_buffer.base;
       srv->send_buffer.w = srv->send_buffer.base;
       srv->recv_buffer.r = srv->recv_buffer.base;
       srv->recv_buffer.w = srv->recv_buffer.base;
       srv->last_req_recvd = srv->last_req_sent;
       srv->last_req_sent_nq = srv->last_req_sent;
+      srv->stream.active = false;
+      srv->stream.done = false;
+      omc_recv_buffer_release(mc, srv);
+      omc_flights_drop(mc, srv);
+#ifdef WITH_IO_URING
+      srv->ur_ready = false;
+#endif // WITH_IO_URING
+      omc_srv_mark_dirty(mc, srv);
+    }
+  omc_unlock(mc);
+  return OMCACHE_OK;
+}
+
+omcache_pin_t *omcache_value_pin(omcache_t *mc, omcache_value_t *value)
+{
+  omcache_pin_t *pin = NULL;
+  omc_lock(mc);
+  for (int i = 0; i < mc->conn_count && value->data_len; i ++)
+    {
+      omc_srv_t *srv = mc->conns[i];
+      omc_buf_t *buf = &srv->recv_buffer;
+      if (value->data < buf->base || value->data + value->data_len > buf->w)
+        continue;
+      pin = omc_recv_buffer_pin(srv);
+      break;
+    }
+  for (size_t i = 0; i < mc->recv_pool.retired_count && value->data_len && pin == NULL; i ++)
+    {
+      omcache_pin_t *retired = mc->recv_pool.retired[i];
+      if (value->data >= retired->base &&
+          value->data + value->data_len <= retired->base + retired->size)
+        pin = retired;
+    }
+#ifdef WITH_THREADS
+  // buffers holding the values returned to this thread's call may already
+  // have been taken away from their connections
+  omc_call_t *call = mc->ts.enabled ? omc_call_get(mc) : NULL;
+  for (size_t i = 0; call && i < call->pin_count && value->data_len && pin == NULL; i ++)
+    {
+      omcache_pin_t *held = call->pins[i];
+      if (value->data >= held->base &&
+          value->data + value->data_len <= held->base + held->size)
+        pin = held;
+    }
+#endif // WITH_THREADS
+  if (pin)
+    __atomic_add_fetch(&pin->refs, 1, __ATOMIC_RELAXED);
+  omc_unlock(mc);
+  if (pin)
+    return pin;
+
+  // the value isn't in a receive buffer, it may have been served from the
+  // near cache: pin a copy of it
+  pin = malloc(sizeof(*pin));
+  pin->refs = 1;
+  pin->size = value->key_len + value->data_len + 1;
+  pin->base = malloc(pin->size);
+  if (value->key_len)
+    memcpy(pin->base, value->key, value->key_len);
+  if (value->data_len)
+    memcpy(pin->base + value->key_len, value->data, value->data_len);
+  value->key = value->key_len ? pin->base : NULL;
+  // the data of streamed values was passed to the stream callback
+  if (value->data)
+    value->data = pin->base + value->key_len;
+  return pin;
+}
+
+int omcache_value_unpin(omcache_pin_t *pin)
+{
+  if (__atomic_sub_fetch(&pin->refs, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+      free(pin->base);
+      free(pin);
     }
   return OMCACHE_OK;
 }
@@ -1432,6 +4233,50 @@ static bool omc_is_request_quiet(uint8_t opcode)
   return false;
 }
 
+// requests that return the value of a key
+static bool omc_is_request_lookup(uint8_t opcode)
+{
+  switch (opcode)
+    {
+    case PROTOCOL_BINARY_CMD_GET:
+    case PROTOCOL_BINARY_CMD_GETQ:
+    case PROTOCOL_BINARY_CMD_GETK:
+    case PROTOCOL_BINARY_CMD_GETKQ:
+    case PROTOCOL_BINARY_CMD_GAT:
+    case PROTOCOL_BINARY_CMD_GATQ:
+    case PROTOCOL_BINARY_CMD_GATK:
+    case PROTOCOL_BINARY_CMD_GATKQ:
+      return true;
+    }
+  return false;
+}
+
+// requests that modify the value of a key
+static bool omc_is_request_write(uint8_t opcode)
+{
+  switch (opcode)
+    {
+    case PROTOCOL_BINARY_CMD_SET:
+    case PROTOCOL_BINARY_CMD_SETQ:
+    case PROTOCOL_BINARY_CMD_ADD:
+    case PROTOCOL_BINARY_CMD_ADDQ:
+    case PROTOCOL_BINARY_CMD_REPLACE:
+    case PROTOCOL_BINARY_CMD_REPLACEQ:
+    case PROTOCOL_BINARY_CMD_DELETE:
+    case PROTOCOL_BINARY_CMD_DELETEQ:
+    case PROTOCOL_BINARY_CMD_INCREMENT:
+    case PROTOCOL_BINARY_CMD_INCREMENTQ:
+    case PROTOCOL_BINARY_CMD_DECREMENT:
+    case PROTOCOL_BINARY_CMD_DECREMENTQ:
+    case PROTOCOL_BINARY_CMD_APPEND:
+    case PROTOCOL_BINARY_CMD_APPENDQ:
+    case PROTOCOL_BINARY_CMD_PREPEND:
+    case PROTOCOL_BINARY_CMD_PREPENDQ:
+      return true;
+    }
+  return false;
+}
+
 static int omc_srv_submit(omcache_t *mc, omc_srv_t *srv,
                           struct iovec *iov, size_t iov_cnt,
                           size_t req_cnt omc_attribute_unused,
@@ -1448,6 +4293,7 @@ static int omc_srv_submit(omcache_t *mc, omc_srv_t *srv,
 
   // set last_req_sent field now that we're about to send (or buffer) this
   srv->last_req_sent = last_header->opaque;
+  omc_srv_mark_dirty(mc, srv);
   if (!omc_is_request_quiet(last_header->opcode))
     srv->last_req_sent_nq = srv->last_req_sent;
   omc_srv_debug(srv, "%c sending %zu messages, last: type 0x%hhx, id %u %s",
@@ -1456,8 +4302,10 @@ static int omc_srv_submit(omcache_t *mc, omc_srv_t *srv,
                 omc_is_request_quiet(last_header->opcode) ? "(quiet)" : "");
 
   // make sure we're meant to write immediately and the connection is
-  // established and the existing write buffer empty
-  if (srv->connected && mc->buffer_writes == false && buf_len == 0)
+  // established and the existing write buffer empty.  with io_uring the
+  // writes to all servers are submitted at once from the buffers.
+  if (srv->connected && mc->buffer_writes == false && buf_len == 0 &&
+      !omc_uring_enabled(mc))
     {
       struct msghdr msg = { .msg_iov = iov, .msg_iovlen = iov_cnt };
       res = sendmsg(srv->sock, &msg, MSG_NOSIGNAL);
@@ -1516,16 +4364,37 @@ static void omc_req_id_check(omcache_t *mc, size_t req_count)
 {
   // Note that we must take into account the fact that we may send implicit
   // NOOPs to disconnected servers at this point so don't push the limit
-  if (UINT32_MAX - mc->req_id > (mc->server_count + req_count) * 2)
+  uint64_t needed = ((uint64_t) mc->conn_count + req_count) * 2;
+  if (UINT32_MAX - mc->req_id > needed + OMC_REQ_ID_WRAP_MARGIN)
+    return;
+  // responses to the requests of calls waiting for them couldn't be told
+  // apart from the responses to requests sent after the wraparound
+  bool waiting = false;
+  for (omc_call_t *call = mc->lookup.calls; call && !waiting; call = call->next)
+    waiting = call->active && call->found < call->count;
+  if (waiting && UINT32_MAX - mc->req_id > needed)
     return;
+  if (waiting)
+    {
+      omc_log(LOG_WARNING, "%s", "req_ids exhausted, failing requests waiting for responses");
+      for (int i = 0; i < mc->conn_count; i++)
+        omc_lookup_discard_requests(mc, mc->conns[i], UINT32_MAX);
+    }
   omc_log(LOG_INFO, "performing req_id wraparound %u -> %u to handle %zu requests",
           mc->req_id, 42, req_count);
   mc->req_id = 42;
-  for (int i = 0; i < mc->server_count; i++)
-    if (mc->servers[i]->connected)
+  // the ids of responses to requests sent before the wraparound can't be
+  // compared with 'fill_after' anymore, they aren't cached
+  if (mc->near.cache)
+    omc_near_cache_clear(mc->near.cache);
+  mc->near.fill_after = mc->req_id;
+  for (int i = 0; i < mc->conn_count; i++)
+    omc_flights_drop(mc, mc->conns[i]);
+  for (int i = 0; i < mc->conn_count; i++)
+    if (mc->conns[i]->connected)
       {
-        mc->servers[i]->last_req_recvd = 0;
-        omc_srv_send_noop(mc, mc->servers[i]);
+        mc->conns[i]->last_req_recvd = 0;
+        omc_srv_send_noop(mc, mc->conns[i]);
       }
 }
 
@@ -1544,14 +4413,19 @@ static int omc_srv_send_noop(omcache_t *mc, omc_srv_t *srv)
 
 omcache_server_info_t *omcache_server_info(omcache_t *mc, int server_index)
 {
-  if (server_index >= mc->server_count || server_index < 0)
-    return NULL;
-  omc_srv_t *srv = mc->servers[server_index];
-  omcache_server_info_t *info = calloc(1, sizeof(*info));
-  info->omcache_version = OMCACHE_VERSION;
-  info->server_index = server_index;
-  info->hostname = strdup(srv->hostname);
-  info->port = atoi(srv->port);
+  omcache_server_info_t *info = NULL;
+  omc_lock(mc);
+  if (server_index < mc->server_count && server_index >= 0)
+    {
+      omc_srv_t *srv = mc->servers[server_index];
+      info = calloc(1, sizeof(*info));
+      info->omcache_version = OMCACHE_VERSION;
+      info->server_index = server_index;
+      info->hostname = strdup(srv->hostname);
+      info->port = atoi(srv->port);
+      info->weight = srv->weight;
+    }
+  omc_unlock(mc);
   return info;
 }
 
@@ -1578,10 +4452,188 @@ int omcache_command_status(omcache_t *mc, omcache_req_t *req, int32_t timeout_ms
   return ret;
 }
 
+// drop the near cached values of the keys written by 'reqs' and serve the
+// lookups found in the near cache, the served requests are removed from
+// 'reqs' and their values stored at the beginning of 'values'
+static size_t omc_near_lookup(omcache_t *mc, omc_call_t *call,
+                              omcache_req_t *reqs, size_t *req_countp,
+                              omcache_value_t *values, size_t value_size)
+{
+  omc_near_cache_t *nc = mc->near.cache;
+  size_t req_count = *req_countp;
+
+  for (size_t i = 0; i < req_count; i ++)
+    {
+      uint8_t opcode = reqs[i].header.opcode;
+      if (opcode == PROTOCOL_BINARY_CMD_FLUSH || opcode == PROTOCOL_BINARY_CMD_FLUSHQ)
+        omc_near_cache_clear(nc);
+      else if (omc_is_request_write(opcode))
+        omc_near_cache_del(nc, reqs[i].key, be16toh(reqs[i].header.keylen));
+      else
+        continue;
+      mc->near.barrier = true;
+    }
+  if (values == NULL || value_size == 0)
+    return 0;
+
+  int64_t now = omc_msec();
+  size_t hits = 0, kept = 0, copy_size = 0;
+  for (size_t i = 0; i < req_count; i ++)
+    {
+      omcache_req_t *req = &reqs[i];
+      if (hits < value_size && req->server_index == -1 &&
+          omc_is_request_lookup(req->header.opcode) &&
+          omc_near_cache_find(nc, req->key, be16toh(req->header.keylen), now, &values[hits]))
+        {
+          copy_size += values[hits].key_len + values[hits].data_len;
+          hits ++;
+        }
+      else
+        reqs[kept ++] = *req;
+    }
+  if (hits == 0)
+    return 0;
+
+  call->near_buf = omc_scratch_reserve(call->near_buf, &call->near_buf_size, copy_size, 1);
+  unsigned char *p = call->near_buf;
+  for (size_t i = 0; i < hits; i ++)
+    {
+      memcpy(p, values[i].key, values[i].key_len);
+      values[i].key = p;
+      p += values[i].key_len;
+      memcpy(p, values[i].data, values[i].data_len);
+      values[i].data = p;
+      p += values[i].data_len;
+    }
+  *req_countp = kept;
+  return hits;
+}
+
+// serve what we can from the near cache and send the rest to the servers
+static int omc_near_command(omcache_t *mc,
+                            omcache_req_t *reqs, size_t *req_countp,
+                            omcache_value_t *values, size_t *value_count,
+                            int32_t timeout_msec)
+{
+  size_t hits = 0;
+  omc_call_t *call = omc_call_begin(mc);
+  if (mc->near.cache)
+    hits = omc_near_lookup(mc, call, reqs, req_countp, values, value_count ? *value_count : 0);
+  if (hits == 0)
+    return omc_command(mc, reqs, req_countp, values, value_count, timeout_msec);
+
+  int ret = OMCACHE_OK;
+  size_t miss_count = 0;
+  if (*req_countp)
+    {
+      miss_count = *value_count - hits;
+      ret = omc_command(mc, reqs, req_countp, values + hits, &miss_count, timeout_msec);
+    }
+  *value_count = hits + miss_count;
+  return ret;
+}
+
 int omcache_command(omcache_t *mc,
                     omcache_req_t *reqs, size_t *req_countp,
                     omcache_value_t *values, size_t *value_count,
                     int32_t timeout_msec)
+{
+  omc_lock(mc);
+  int ret = omc_near_command(mc, reqs, req_countp, values, value_count, timeout_msec);
+#ifdef WITH_THREADS
+  if (ret == OMCACHE_BUFFERED || ret == OMCACHE_AGAIN)
+    omc_io_wake(mc);
+#endif // WITH_THREADS
+  omc_unlock(mc);
+  return ret;
+}
+
+static bool omc_coalesce_keys_match(const omcache_req_t *a, const omcache_req_t *b)
+{
+  return omc_flight_opcode(a->header.opcode) == omc_flight_opcode(b->header.opcode) &&
+    a->header.keylen == b->header.keylen &&
+    memcmp(a->key, b->key, be16toh(a->header.keylen)) == 0;
+}
+
+// set up the coalescing state of request 'i' routed to 'server_index',
+// returns true if the request follows an earlier lookup of the same key
+// and must not be sent.  conns[i] is set to the connection of the lookup.
+static bool omc_coalesce_route(omcache_t *mc, omcache_req_t *reqs, size_t i, int server_index)
+{
+  omc_coalesce_t *coalesce = mc->split.coalesce, *co = &coalesce[i];
+  omcache_req_t *req = &reqs[i];
+  size_t key_len = be16toh(req->header.keylen);
+  uint8_t opcode = req->header.opcode;
+
+  *co = (omc_coalesce_t) { .leader = -1 };
+  if (omc_is_request_write(opcode))
+    {
+      uint32_t key_hash = omc_hash_xxh3(req->key, key_len);
+      omc_flights_detach(mc, key_hash, req->key, key_len);
+      intptr_t li = omc_int_hash_table_find(mc->flights.calls, key_hash);
+      if (li >= 0 && reqs[li].header.keylen == req->header.keylen &&
+          memcmp(reqs[li].key, req->key, key_len) == 0)
+        {
+          coalesce[li].detached = true;
+          omc_int_hash_table_del(mc->flights.calls, key_hash);
+        }
+      return false;
+    }
+  if (opcode == PROTOCOL_BINARY_CMD_FLUSH || opcode == PROTOCOL_BINARY_CMD_FLUSHQ)
+    {
+      omc_flights_detach_all(mc);
+      for (size_t li = 0; li < i; li ++)
+        coalesce[li].detached = true;
+      omc_int_hash_table_init(mc->flights.calls, mc->flights.calls->size);
+      return false;
+    }
+  if (!omc_is_request_coalescable(opcode) || key_len == 0 || key_len > OMC_MAX_KEY_LEN)
+    return false;
+
+  co->key_hash = omc_hash_xxh3(req->key, key_len);
+  omc_srv_t *server = mc->servers[server_index];
+  intptr_t li = omc_int_hash_table_find(mc->flights.calls, co->key_hash);
+  if (li >= 0 && mc->conns[mc->split.conns[li]]->server == server &&
+      omc_coalesce_keys_match(&reqs[li], req))
+    {
+      co->follower = true;
+      co->leader = li;
+      mc->split.conns[i] = mc->split.conns[li];
+      return true;
+    }
+  co->flight = omc_flight_find(mc, co->key_hash, req, server);
+  if (co->flight)
+    {
+      co->follower = true;
+      mc->split.conns[i] = co->flight->conn->conn_index;
+      return true;
+    }
+  co->leads = true;
+  return false;
+}
+
+// launch or join the flight of request 'i' once it has been submitted
+static void omc_coalesce_sent(omcache_t *mc, omc_srv_t *srv, size_t i, const omcache_req_t *req)
+{
+  omc_coalesce_t *co = &mc->split.coalesce[i];
+  if (co->leads)
+    {
+      co->flight = omc_flight_launch(mc, srv, co->key_hash, req);
+      if (co->detached)
+        omc_flight_unhash(mc, co->flight);
+    }
+  else if (co->follower)
+    {
+      omc_flight_t *flight = co->leader >= 0 ? mc->split.coalesce[co->leader].flight : co->flight;
+      if (flight)
+        omc_flight_follow(flight, req);
+    }
+}
+
+static int omc_command(omcache_t *mc,
+                       omcache_req_t *reqs, size_t *req_countp,
+                       omcache_value_t *values, size_t *value_count,
+                       int32_t timeout_msec)
 {
   int ret = OMCACHE_OK;
   size_t req_count = *req_countp;
@@ -1598,30 +4650,52 @@ int omcache_command(omcache_t *mc,
     }
 
   // set up response lookup table
-  mc->lookup.active = false;
+  omc_call_t *call = omc_call_get(mc);
   mc->lookup.iteration ++;
-  mc->lookup.count = 0;
-  mc->lookup.found = 0;
-  mc->lookup.min_req = UINT32_MAX;
-  mc->lookup.max_req = 0;
-  mc->lookup.table = omc_hash_table_init(mc->lookup.table, req_count, NULL);
-
-  // split requests by server
-  struct omc_rps_bucket_s
-  {
-    omcache_req_t *reqs;
-    size_t count;
-    size_t size;
-  } reqs_per_server[mc->server_count];
-  memset(reqs_per_server, 0, sizeof(reqs_per_server));
+  omc_recv_pool_reclaim(mc);
+
+  // Force wraparound if we don't have enough req_ids available before it
+  omc_req_id_check(mc, req_count);
+
+  // route requests that don't name a server: hash all keys in one pass
+  // and look the hashes up in another
+  bool route = mc->server_count > 1;
+  if (route)
+    {
+      mc->split.hashes = omc_scratch_reserve(mc->split.hashes, &mc->split.hashes_size,
+                                             req_count, sizeof(uint32_t));
+      for (size_t i = 0; i < req_count; i ++)
+        if (reqs[i].server_index == -1)
+          mc->split.hashes[i] = mc->dist_method->key_hash_func(reqs[i].key, be16toh(reqs[i].header.keylen));
+    }
+  mc->split.conns = omc_scratch_reserve(mc->split.conns, &mc->split.conns_size,
+                                        req_count, sizeof(int));
+  int *conns = mc->split.conns;
+
+  // split requests by connection
+  mc->split.buckets = omc_scratch_reserve(mc->split.buckets, &mc->split.buckets_size,
+                                          mc->conn_count, sizeof(omc_rps_bucket_t));
+  omc_rps_bucket_t *reqs_per_server = mc->split.buckets;
+  memset(reqs_per_server, 0, mc->conn_count * sizeof(omc_rps_bucket_t));
+  size_t reqs_routed = 0;
+
+  omc_coalesce_t *coalesce = NULL;
+  if (mc->flights.enabled)
+    {
+      mc->split.coalesce = omc_scratch_reserve(mc->split.coalesce, &mc->split.coalesce_size,
+                                               req_count, sizeof(omc_coalesce_t));
+      coalesce = mc->split.coalesce;
+      mc->flights.calls = omc_int_hash_table_init(mc->flights.calls, req_count);
+    }
 
   for (size_t i = 0; i < req_count; i ++)
     {
       omcache_req_t *req = &reqs[i];
       int server_index = req->server_index;
 
+      conns[i] = -1;
       if (server_index == -1)
-        server_index = omc_ketama_lookup(mc, req->key, be16toh(req->header.keylen));
+        server_index = route ? omc_dist_route(mc, mc->split.hashes[i]) : 0;
       if (server_index >= mc->server_count || server_index < 0)
         {
           if (req->server_index != -1)
@@ -1630,12 +4704,25 @@ int omcache_command(omcache_t *mc,
           continue;
         }
 
-      struct omc_rps_bucket_s *rps = &reqs_per_server[server_index];
-      // try to flush out anything pending for the server if this is the
-      // first time we touch it
+      if (coalesce && omc_coalesce_route(mc, reqs, i, server_index))
+        {
+          reqs_per_server[conns[i]].count ++;
+          reqs_routed ++;
+          continue;
+        }
+
+      omc_srv_t *server = mc->servers[server_index];
+      size_t key_len = be16toh(req->header.keylen);
+      uint32_t key_hash = 0;
+      if (server->conn_count > 1 && key_len > 0)
+        key_hash = (route && req->server_index == -1) ? mc->split.hashes[i] :
+          mc->dist_method->key_hash_func(req->key, key_len);
+      omc_srv_t *srv = omc_srv_pick_conn(mc, server, key_len > 0, key_hash);
+      omc_rps_bucket_t *rps = &reqs_per_server[srv->conn_index];
+      // try to flush out anything pending for the connection if this is
+      // the first time we touch it
       if (rps->count == 0 && mc->buffer_writes == false)
         {
-          omc_srv_t *srv = mc->servers[server_index];
           ret = omc_srv_io(mc, srv);
           omc_srv_debug(srv, "io: %s", omcache_strerror(ret));
           if (ret != OMCACHE_AGAIN && ret != OMCACHE_OK)
@@ -1643,49 +4730,78 @@ int omcache_command(omcache_t *mc,
               omc_srv_log(LOG_NOTICE, srv, "dropping request, flush failed: %s", omcache_strerror(ret));
               ret = OMCACHE_NO_SERVERS;
               // if we used ketama we'll reschedule the request if the
-              // originally selected server was offlined by omc_srv_io
+              // originally selected server or connection was offlined by
+              // omc_srv_io
               if (req->server_index == -1 && srv->disabled)
                 i --;
               continue;
             }
           ret = OMCACHE_OK;
         }
+      conns[i] = srv->conn_index;
+      rps->count ++;
+      reqs_routed ++;
+      if (coalesce && coalesce[i].leads)
+        omc_int_hash_table_add(mc->flights.calls, coalesce[i].key_hash, i);
+    }
 
-      if (mc->server_count == 1 || req_count == 1)
-        {
-          // optimization for cases where we have a single server or a single request
-          rps->reqs = reqs;
-          rps->count = req_count;
-          if (req->server_index == -1)
-            break;  // if ketama picked a server we don't need to re-check anything
-        }
-      else
+  // group the requests by connection with a counting sort into a single
+  // array unless they all go to the same connection
+  bool single_conn = reqs_routed == req_count &&
+    reqs_per_server[conns[0]].count == req_count;
+  size_t *order = NULL;
+  if (single_conn)
+    {
+      reqs_per_server[conns[0]].reqs = reqs;
+    }
+  else if (reqs_routed)
+    {
+      mc->split.reqs = omc_scratch_reserve(mc->split.reqs, &mc->split.reqs_size,
+                                           reqs_routed, sizeof(omcache_req_t));
+      omcache_req_t *grouped = mc->split.reqs;
+      for (int i = 0; i < mc->conn_count; i ++)
         {
-          if (rps->size <= rps->count)
-            {
-              rps->size += 16;
-              rps->reqs = realloc(rps->reqs, rps->size * sizeof(omcache_req_t));
-            }
-          rps->reqs[rps->count ++] = *req;
+          reqs_per_server[i].reqs = grouped;
+          grouped += reqs_per_server[i].count;
+          reqs_per_server[i].count = 0;
         }
+      // the coalescing state is looked up by the original request index
+      if (coalesce)
+        order = mc->split.order = omc_scratch_reserve(mc->split.order, &mc->split.order_size,
+                                                      reqs_routed, sizeof(size_t));
+      for (size_t i = 0; i < req_count; i ++)
+        if (conns[i] >= 0)
+          {
+            omc_rps_bucket_t *rps = &reqs_per_server[conns[i]];
+            if (order)
+              order[rps->reqs + rps->count - mc->split.reqs] = i;
+            rps->reqs[rps->count ++] = reqs[i];
+          }
     }
 
-  // Force wraparound if we don't have enough req_ids available before it
-  omc_req_id_check(mc, req_count);
+  // requests are numbered sequentially from here on so their responses can
+  // be looked up directly by 'opaque'
+  call->table = omc_seq_table_init(call->table, mc->req_id + 1, req_count);
 
-  for (int i = 0; i < mc->server_count; i ++)
+  for (int i = 0; i < mc->conn_count; i ++)
     {
-      omc_srv_t *srv = mc->servers[i];
-      struct omc_rps_bucket_s *rps = &reqs_per_server[i];
-
-      srv->active_requests = rps->count;
+      omc_srv_t *srv = mc->conns[i];
+      omc_rps_bucket_t *rps = &reqs_per_server[i];
+
+      // the values returned from the buffer during the previous call
+      // aren't needed anymore
+      if (srv->recv_buffer.r == srv->recv_buffer.w && srv->recv_buffer.base &&
+          srv->keep_recv_buffer_iteration != mc->lookup.iteration)
+        omc_recv_buffer_release(mc, srv);
       if (rps->count == 0)
         continue;
 
-      size_t iov_size = min(4 * rps->count, g_iov_max);
-      struct iovec iov[iov_size];
+      mc->split.iov = omc_scratch_reserve(mc->split.iov, &mc->split.iov_size,
+                                          min(4 * rps->count, g_iov_max), sizeof(struct iovec));
+      struct iovec *iov = mc->split.iov;
       int iov_idx = 0, iov_req_count = 0;
       size_t srv_reqs_sent = 0;
+      struct omcache_req_header_s *last_header = NULL;
 
       for (size_t ri = 0; ri < rps->count; ri ++)
         {
@@ -1698,30 +4814,43 @@ int omcache_command(omcache_t *mc,
           req->header.datatype = PROTOCOL_BINARY_RAW_BYTES;
           // set an incrementing request id to each request
           req->header.opaque = ++ mc->req_id;
-          omc_srv_debug(srv, "%c queuing command: type 0x%hhx, id %u %s",
-                        srv->connected ? '+' : '-',
-                        req->header.opcode, req->header.opaque,
-                        omc_is_request_quiet(req->header.opcode) ? "(quiet)" : "");
-          // construct the iovector
-          iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) &req->header, .iov_len = sizeof(req->header) };
-          if (req->header.extlen)
-            iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) req->extra, .iov_len = req->header.extlen };
-          if (h_keylen)
-            iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) req->key, .iov_len = h_keylen };
-          if (h_datalen)
-            iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) req->data, .iov_len = h_datalen };
-          iov_req_count ++;
+          // requests following a flight are not sent
+          if (coalesce && coalesce[order ? order[req - mc->split.reqs] : ri].follower)
+            {
+              omc_srv_debug(srv, "  coalescing command: type 0x%hhx, id %u",
+                            req->header.opcode, req->header.opaque);
+            }
+          else
+            {
+              omc_srv_debug(srv, "%c queuing command: type 0x%hhx, id %u %s",
+                            srv->connected ? '+' : '-',
+                            req->header.opcode, req->header.opaque,
+                            omc_is_request_quiet(req->header.opcode) ? "(quiet)" : "");
+              // construct the iovector
+              iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) &req->header, .iov_len = sizeof(req->header) };
+              if (req->header.extlen)
+                iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) req->extra, .iov_len = req->header.extlen };
+              if (h_keylen)
+                iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) req->key, .iov_len = h_keylen };
+              if (h_datalen)
+                iov[iov_idx ++] = (struct iovec) { .iov_base = (void *) req->data, .iov_len = h_datalen };
+              iov_req_count ++;
+              last_header = &req->header;
+            }
 
           // submit tasks if we're running out of iovec space or are done here
           if ((g_iov_max - iov_idx < 4) || (ri == rps->count - 1))
             {
-              ret = omc_srv_submit(mc, srv, iov, iov_idx, iov_req_count, &req->header);
+              ret = iov_idx ? omc_srv_submit(mc, srv, iov, iov_idx, iov_req_count, last_header) : OMCACHE_OK;
               if (ret != OMCACHE_OK && ret != OMCACHE_BUFFERED)
                 {
                   omc_srv_log(LOG_WARNING, srv, "submitting %d requests failed, not sending %zu more",
                               iov_req_count, rps->count - ri - 1);
                   break;
                 }
+              for (size_t si = srv_reqs_sent; coalesce && si <= ri; si ++)
+                omc_coalesce_sent(mc, srv, order ? order[&rps->reqs[si] - mc->split.reqs] : si,
+                                  &rps->reqs[si]);
               srv_reqs_sent = ri + 1;
               iov_idx = 0;
               iov_req_count = 0;
@@ -1730,23 +4859,43 @@ int omcache_command(omcache_t *mc,
       // copy sent requests back to the original 'reqs' array so we can look them up later
       if (srv_reqs_sent)
         {
-          // NOTE: in case of 1 server or 1 request reqs and rps->reqs may point to the same place
+          // NOTE: if all requests went to a single connection reqs and
+          // rps->reqs point to the same place
           memmove(reqs + *req_countp, rps->reqs, srv_reqs_sent * sizeof(omcache_req_t));
-          if (mc->lookup.min_req == UINT32_MAX)
-            mc->lookup.min_req = rps->reqs[0].header.opaque;
-          mc->lookup.max_req = rps->reqs[srv_reqs_sent - 1].header.opaque;
-          mc->lookup.count += srv_reqs_sent;
+          if (call->min_req == UINT32_MAX)
+            call->min_req = rps->reqs[0].header.opaque;
+          call->max_req = rps->reqs[srv_reqs_sent - 1].header.opaque;
+          call->count += srv_reqs_sent;
+          // remember the range of ids sent to the connection for discarding
+          // the requests if the connection fails
+          call->spans = omc_scratch_reserve(call->spans, &call->spans_size,
+                                            call->span_count + 1, sizeof(*call->spans));
+          call->spans[call->span_count ++] = (omc_call_span_t) {
+            .srv = srv,
+            .first_req = rps->reqs[0].header.opaque,
+            .last_req = call->max_req,
+            };
           for (size_t ri = 0; ri < srv_reqs_sent; ri ++)
-            omc_hash_table_add(mc->lookup.table, rps->reqs[ri].header.opaque, &reqs[*req_countp + ri]);
+            omc_seq_table_add(call->table, rps->reqs[ri].header.opaque, &reqs[*req_countp + ri]);
           *req_countp += srv_reqs_sent;
         }
-      if (rps->size)
-        free(rps->reqs);
     }
 
+  // lookups sent before this call's writes may return values older than
+  // the ones written, don't store their responses in the near cache
+  if (mc->near.barrier)
+    {
+      mc->near.fill_after = mc->req_id;
+      mc->near.barrier = false;
+    }
+
+#ifdef WITH_IO_URING
+  if (omc_uring_enabled(mc) && mc->buffer_writes == false && timeout_msec == 0)
+    omc_uring_flush(mc);
+#endif // WITH_IO_URING
+
   if (timeout_msec == 0 || *req_countp == 0)
     {
-      mc->lookup.active = false;
       // no response requested or data wasn't sent. we're done.
       if (value_count)
         *value_count = 0;
@@ -1760,5 +4909,5 @@ int omcache_command(omcache_t *mc,
     }
 
   // look for responses to the queries we just sent
-  return omcache_io(mc, reqs, req_countp, values, value_count, timeout_msec);
+  return omc_io(mc, reqs, req_countp, values, value_count, timeout_msec);
 }
@@ -258,6 +258,18 @@ class OMcache(object):
             ms = _ffi.addressof(_oc.omcache_dist_libmemcached_ketama_weighted)
         elif method == "libmemcached_ketama_pre1010":
             ms = _ffi.addressof(_oc.omcache_dist_libmemcached_ketama_pre1010)
+        elif method == "jump_hash":
+            ms = _ffi.addressof(_oc.omcache_dist_jump_hash)
+        elif method == "maglev":
+            ms = _ffi.addressof(_oc.omcache_dist_maglev)
+        elif method == "rendezvous":
+            ms = _ffi.addressof(_oc.omcache_dist_rendezvous)
+        elif method == "ketama_xxh3":
+            ms = _ffi.addressof(_oc.omcache_dist_ketama_xxh3)
+        elif method == "ketama_murmur3":
+            ms = _ffi.addressof(_oc.omcache_dist_ketama_murmur3)
+        elif method == "ketama_crc32c":
+            ms = _ffi.addressof(_oc.omcache_dist_ketama_crc32c)
         else:
             raise Error("invalid distribution method {0!r}".format(method))
         return _oc.omcache_set_distribution_method(self.omc, ms)
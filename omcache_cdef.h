@@ -65,8 +65,13 @@ typedef struct omcache_value_s {
     uint32_t flags;             ///< Flags associated with the object
     uint64_t cas;               ///< CAS value for synchronization
     uint64_t delta_value;       ///< Value returned in delta operations
+    size_t stream_len;          ///< Length of a value passed to the stream
+                                ///  callback, data is NULL and data_len
+                                ///  zero for such values
 } omcache_value_t;
 
+typedef struct omcache_pin_s omcache_pin_t;
+
 // OMcache -object
 
 /**
@@ -136,6 +141,10 @@ int omcache_set_send_buffer_max_size(omcache_t *mc, size_t size);
  *             a response of the maximum default size (1MB) but if
  *             memcached is run with a different maximum value length
  *             setting this setting should be adjusted as well.
+ *             Buffers are allocated on demand in 64 kilobyte segments
+ *             which are recycled within the handle; a larger buffer
+ *             is only allocated for a response that doesn't fit in
+ *             one segment.
  * @return OMCACHE_OK on success.
  */
 int omcache_set_recv_buffer_max_size(omcache_t *mc, size_t size);
@@ -150,6 +159,135 @@ int omcache_set_recv_buffer_max_size(omcache_t *mc, size_t size);
  */
 int omcache_set_buffering(omcache_t *mc, uint32_t enabled);
 
+typedef enum omcache_io_backend_e {
+  OMCACHE_IO_POLL = 0,             ///< poll(2), the poll set is rebuilt on
+                                   ///  every iteration (default)
+  OMCACHE_IO_EPOLL = 1,            ///< epoll(7) with persistent
+                                   ///  registrations (Linux only)
+  OMCACHE_IO_URING = 2,            ///< io_uring(7) with batched sends and
+                                   ///  receives (Linux 5.11+, optional)
+} omcache_io_backend_t;
+
+/**
+ * Select the I/O multiplexing mechanism used internally by omcache_io().
+ * The epoll backend keeps server sockets registered between calls and only
+ * updates their interests when a server's state changes which makes waiting
+ * for responses cheaper with large server pools.  The io_uring backend
+ * buffers all requests and submits the sends and receives of all servers
+ * with a single system call per round which reduces the cost of large
+ * multi-server operations.  Note that omcache_poll_fds() can be used with
+ * any backend.
+ * @param mc OMcache handle.
+ * @param backend I/O backend (omcache_io_backend_t) to use.
+ * @return OMCACHE_OK on success;
+ *         OMCACHE_INVALID if the backend is not supported on this platform;
+ *         OMCACHE_FAIL if the backend could not be initialized.
+ */
+int omcache_set_io_backend(omcache_t *mc, int backend);
+
+/**
+ * Set the number of connections to open to each server.  Requests sent to
+ * a server are spread over its connections by their key's hash which
+ * allows memcached to process them in multiple worker threads.  All
+ * requests for the same key use the same connection while it is available
+ * and are processed in the order they were sent, requests without a key
+ * are striped over the connections in round-robin order.  Responses to a
+ * single omcache_command() call may arrive over different connections.
+ * @param mc OMcache handle.
+ * @param count Number of connections per server, 1 by default.
+ * @return OMCACHE_OK on success;
+ *         OMCACHE_INVALID if count is zero or larger than 64.
+ */
+int omcache_set_connections_per_server(omcache_t *mc, uint32_t count);
+
+/**
+ * Allow an OMcache handle to be shared between threads as a serialized
+ * shared handle: the threads share the handle's server connections and
+ * a single lock serializes sending requests and processing responses.
+ * Submitting requests is not lock-free.  The lock is not held while a
+ * call is blocked waiting for responses, so blocking calls made from
+ * different threads wait for their responses at the same time.  One of
+ * the waiting threads, or the I/O thread if it is running, polls the
+ * shared server connections and passes the responses it processes to the
+ * calls waiting for them.  Blocking calls made from callbacks, and all
+ * blocking calls with the io_uring I/O backend, keep holding the lock
+ * while they wait.  Returned values remain valid until the same thread's
+ * next call on the handle.  Responses to requests left pending by a call
+ * that timed out are only returned by omcache_io() if they have not been
+ * processed by another thread in the meantime.
+ * Callbacks are called with the lock held from whichever thread processes
+ * the response.  Thread-safe mode must be enabled before the handle is
+ * shared and must not be disabled while it is in use by other threads or
+ * while the I/O thread is running.
+ * @param mc OMcache handle.
+ * @param enabled If non-zero, the handle can be used by multiple threads.
+ * @return OMCACHE_OK on success;
+ *         OMCACHE_INVALID if OMcache was built without thread support or
+ *         if disabling was requested while the I/O thread is running;
+ *         OMCACHE_FAIL if thread-local storage or the pipe used for
+ *         waking up the polling thread could not be allocated.
+ */
+int omcache_set_thread_safe(omcache_t *mc, uint32_t enabled);
+
+/**
+ * Run a background thread which performs I/O on the handle's connections
+ * whenever they have pending work.  Buffered requests and requests whose
+ * responses were not waited for are sent and completed by the thread
+ * without further calls to omcache_io(); their responses are delivered to
+ * the callback set with omcache_set_response_callback() which is then
+ * called from the I/O thread.  Calls that wait for responses keep working
+ * as before.  Enabling the I/O thread also enables thread-safe mode, see
+ * omcache_set_thread_safe().  The thread is stopped by omcache_free().
+ * This function must not be called from a callback.
+ * @param mc OMcache handle.
+ * @param enabled If non-zero, start the I/O thread, otherwise stop it.
+ * @return OMCACHE_OK on success;
+ *         OMCACHE_INVALID if OMcache was built without thread support;
+ *         OMCACHE_FAIL if the thread could not be started.
+ */
+int omcache_set_io_thread(omcache_t *mc, uint32_t enabled);
+
+/**
+ * Coalesce concurrent lookups of the same key.  A GET or GETK request of
+ * a key that already has a lookup of the same type outstanding on its
+ * server is not sent; it completes with the response to the earlier
+ * lookup instead.  This applies both to duplicate keys in a single call
+ * and to lookups made while an earlier call's lookups are still pending,
+ * for example when using a zero timeout or an I/O thread.  Lookups made
+ * after a write or flush of a key through the handle are never coalesced
+ * with lookups sent before it.  GAT requests are not coalesced as they
+ * also update the key's expiration time.
+ * @param mc OMcache handle.
+ * @param enabled If non-zero, coalesce lookups.  Disabled by default.
+ * @return OMCACHE_OK.
+ */
+int omcache_set_coalescing(omcache_t *mc, uint32_t enabled);
+
+/**
+ * Keep the values of recently looked up keys in a client-side near cache.
+ * Lookups made with omcache_get(), omcache_gat(), their multi-key
+ * variants and omcache_command() are served from the near cache without
+ * contacting the servers as long as a key's cached value is younger than
+ * ttl_msec.  The near cache is filled from the responses to keyed lookups
+ * and the cached values of keys written or deleted through the handle are
+ * dropped, writes made by other clients become visible after at most
+ * ttl_msec.  Note that omcache_gat() calls served from the near cache do
+ * not update the key's expiration time on the server.  Values are evicted
+ * with the CLOCK algorithm once the total size of the cached entries
+ * exceeds max_bytes; keys hit at least once are preferred over keys only
+ * looked up once.  Values larger than an eighth of max_bytes are not
+ * cached.  Changing the settings keeps the cached values that fit in the
+ * new size.
+ * @param mc OMcache handle.
+ * @param max_bytes Maximum memory used by cached entries, zero disables
+ *                  the near cache and drops its contents.  Disabled by
+ *                  default.
+ * @param ttl_msec Maximum age of cached values in milliseconds.
+ * @return OMCACHE_OK on success;
+ *         OMCACHE_INVALID if max_bytes is set but ttl_msec is zero.
+ */
+int omcache_set_near_cache(omcache_t *mc, size_t max_bytes, uint32_t ttl_msec);
+
 /**
  * Set the server(s) to use with an OMcache handle.
  * OMcache does not currently implement asynchronous name lookups; to avoid
@@ -160,7 +298,13 @@ int omcache_set_buffering(omcache_t *mc, uint32_t enabled);
  *                Any existing servers on OMcache's server list that do not
  *                appear on the new list are dropped.  The servers that
  *                appear on both the currently used and new lists are kept
- *                and connections to them are not reset.
+ *                and connections to them are not reset.  A server may be
+ *                given a relative weight with host:port/weight syntax,
+ *                the default weight is 1.  Ketama distribution methods
+ *                scale each server's number of points by its share of the
+ *                total weight like libmemcached's weighted ketama and
+ *                rendezvous distribution scales its scores; the other
+ *                methods ignore weights.
  * @return OMCACHE_OK on success.
  */
 int omcache_set_servers(omcache_t *mc, const char *servers);
@@ -184,6 +328,52 @@ typedef uint32_t (omc_ketama_point_hash_func)(const char *hostname, const char *
  */
 typedef uint32_t (omc_ketama_key_hash_func)(const unsigned char *key, size_t key_len);
 
+/**
+ * Server lookup function for distribution methods that don't use a Ketama
+ * continuum.
+ * @param key_hash Hash value of the key as returned by key_hash_func.
+ * @param server_count Number of servers, at least one.
+ * @return Index of the server in the range (0 .. server_count - 1).
+ */
+typedef uint32_t (omc_dist_lookup_func)(uint32_t key_hash, uint32_t server_count);
+
+/**
+ * Lookup table populating function for table based distribution methods.
+ * Key hashes are mapped to servers with table[key_hash % table_size].
+ * The function is called with all servers enabled when the server list
+ * changes and again to populate the whole table whenever a server goes
+ * down or comes back.
+ * @param server_hashes hashes_per_server hash values for each server
+ *                      computed with dist->point_hash_func for point 0.
+ * @param hashes_per_server Number of hash values for each server in
+ *                          server_hashes, dist->entries_per_point which
+ *                          must be at least one.
+ * @param enabled Non-zero for each server that may be used in the table.
+ * @param server_count Number of servers.
+ * @param table Table to populate with server indexes, UINT32_MAX for
+ *              slots that can't be used if no servers are enabled.
+ * @param table_size Number of slots in table, a prime of at least
+ *                   dist->points_per_server slots per server.
+ */
+typedef void (omc_dist_table_func)(const uint32_t *server_hashes, uint32_t hashes_per_server,
+                                   const uint8_t *enabled, uint32_t server_count,
+                                   uint32_t *table, uint32_t table_size);
+
+/**
+ * Server scoring function for rendezvous (highest random weight)
+ * distribution methods.  A key is mapped to the enabled server with the
+ * highest score.
+ * @param key_hash Hash value of the key as returned by key_hash_func.
+ * @param server_seeds First hash value of each server computed with
+ *                     dist->point_hash_func for point 0.
+ * @param server_weights Relative weight of each server.
+ * @param server_count Number of servers, at least one.
+ * @param scores Array to store the key's score for each server in.
+ */
+typedef void (omc_dist_score_func)(uint32_t key_hash, const uint32_t *server_seeds,
+                                   const float *server_weights, uint32_t server_count,
+                                   float *scores);
+
 typedef struct omcache_dist_s
 {
   int omcache_version;         ///< OMcache client version
@@ -191,6 +381,11 @@ typedef struct omcache_dist_s
   uint32_t entries_per_point;  ///< Number of ketama entries per point
   omc_ketama_point_hash_func *point_hash_func;  ///< Hash function for points
   omc_ketama_key_hash_func *key_hash_func;      ///< Hash function for keys
+  // Since OMcache 0.4.0: the following fields are ignored if
+  // omcache_version is lower than 0x400
+  omc_dist_lookup_func *lookup_func;  ///< Server lookup function or NULL to use Ketama
+  omc_dist_table_func *table_func;    ///< Lookup table function or NULL to use Ketama
+  omc_dist_score_func *score_func;    ///< Server scoring function or NULL to use Ketama
 } omcache_dist_t;
 
 /**
@@ -207,8 +402,7 @@ extern omcache_dist_t omcache_dist_libmemcached_ketama;
 
 /**
  * Consistent distribution function compatible with libmemcached's
- * MEMCACHED_BEHAVIOR_KETAMA_WEIGHTED when all server weights are 1.
- * OMcache does not have a concept of server weights at the moment.
+ * MEMCACHED_BEHAVIOR_KETAMA_WEIGHTED.
  */
 extern omcache_dist_t omcache_dist_libmemcached_ketama_weighted;
 
@@ -224,6 +418,55 @@ extern omcache_dist_t omcache_dist_libmemcached_ketama_weighted;
  */
 extern omcache_dist_t omcache_dist_libmemcached_ketama_pre1010;
 
+/**
+ * Jump Consistent Hash distribution.  Servers are looked up with a few
+ * arithmetic operations without any lookup tables, keys are spread evenly
+ * over the servers and changing the server list is instant.  Adding a
+ * server to the end of the sorted server list or removing the last one
+ * only moves the keys of that server.  Keys of disabled servers are
+ * rehashed to the other servers.  Not compatible with libmemcached.
+ */
+extern omcache_dist_t omcache_dist_jump_hash;
+
+/**
+ * Maglev hashing distribution.  Servers are looked up from a prime sized
+ * table of about 100 slots per server which spreads keys more evenly than
+ * Ketama.  The whole table is rebuilt without the servers that are down
+ * when a server goes down or comes back, which only moves a small share
+ * of the other servers' keys.  Not compatible with libmemcached.
+ */
+extern omcache_dist_t omcache_dist_maglev;
+
+/**
+ * Weighted rendezvous (highest random weight) hashing distribution.  Each
+ * key is scored against every server and mapped to the server with the
+ * highest score; the keys of a disabled server are spread over all the
+ * remaining servers in the order of their scores.  Lookups take time
+ * linear to the number of servers.  Not compatible with libmemcached.
+ */
+extern omcache_dist_t omcache_dist_rendezvous;
+
+/**
+ * Ketama distribution with 256 points per server using XXH3 (the 64-bit
+ * variant of xxHash 3 truncated to 32 bits) for both keys and points.  A
+ * fast choice for new deployments.  Not compatible with libmemcached.
+ */
+extern omcache_dist_t omcache_dist_ketama_xxh3;
+
+/**
+ * Ketama distribution with 256 points per server using 32-bit MurmurHash3
+ * for both keys and points.  Not compatible with libmemcached.
+ */
+extern omcache_dist_t omcache_dist_ketama_murmur3;
+
+/**
+ * Ketama distribution with 256 points per server using CRC-32C for keys
+ * and XXH3 for points as CRC values of the similar point names aren't
+ * spread evenly.  Uses the crc32 instruction on x86-64 CPUs with SSE 4.2
+ * and a lookup table elsewhere.  Not compatible with libmemcached.
+ */
+extern omcache_dist_t omcache_dist_ketama_crc32c;
+
 /**
  * Set a log callback for the OMcache handle.
  * @param mc OMcache handle.
@@ -275,6 +518,39 @@ typedef void (omcache_response_callback_func)(omcache_t *mc, omcache_value_t *re
  */
 int omcache_set_response_callback(omcache_t *mc, omcache_response_callback_func *resp_cb, void *resp_cb_context);
 
+/**
+ * Stream callback type.
+ * @param mc OMcache handle.
+ * @param value Response value object with the received piece of the value
+ *              in data and data_len.  The data is only valid until the
+ *              callback returns.
+ * @param offset Offset of the piece in the full value.
+ * @param total_len Length of the full value.
+ * @param context Opaque context set in omcache_set_stream_callback().
+ */
+typedef void (omcache_stream_callback_func)(omcache_t *mc, omcache_value_t *value,
+                                            size_t offset, size_t total_len, void *context);
+
+/**
+ * Register a callback function for streaming large values.  The values
+ * of successful lookup responses larger than min_size bytes, or too large
+ * to fit in the receive buffer, are passed to the callback in pieces as
+ * they're received instead of being buffered in full.  Once the whole
+ * value has been passed the response is returned normally with its data
+ * set to NULL, data_len set to zero and stream_len set to the length of
+ * the full value.  omcache_get() and omcache_gat() return such values
+ * without data and omcache_get_chunked() fails with
+ * OMCACHE_TOO_LARGE_VALUE if the value or one of its chunks was streamed.
+ * @param mc OMcache handle.
+ * @param min_size Stream values larger than this many bytes.
+ * @param stream_cb Callback function to call for the pieces of values,
+ *                  NULL to disable streaming.
+ * @param stream_cb_context Opaque context to pass to the callback function.
+ * @return OMCACHE_OK on success.
+ */
+int omcache_set_stream_callback(omcache_t *mc, size_t min_size,
+                                omcache_stream_callback_func *stream_cb, void *stream_cb_context);
+
 // Control
 
 /**
@@ -363,6 +639,31 @@ int omcache_command(omcache_t *mc,
                     omcache_value_t *values, size_t *value_count,
                     int32_t timeout_msec);
 
+/**
+ * Keep the key and data of a response valid until omcache_value_unpin()
+ * is called.  Responses are normally only valid until the next call to
+ * omcache_io(); pinning lets the caller read them in place for as long as
+ * needed without copying them.  OMcache moves on to a new receive buffer
+ * when it needs to reuse memory holding pinned responses.  Values that
+ * are not stored in a receive buffer, like values served from the near
+ * cache, are copied and the key and data pointers in value are updated to
+ * point to the copy.  Must be called before the same thread's next call to
+ * omcache_io().
+ * @param mc OMcache handle.
+ * @param value Response returned by omcache_io() or passed to a response
+ *              callback.
+ * @return Pin to release with omcache_value_unpin().
+ */
+omcache_pin_t *omcache_value_pin(omcache_t *mc, omcache_value_t *value);
+
+/**
+ * Release a response pinned with omcache_value_pin().  The pin may be
+ * released from any thread, also after the OMcache handle was freed.
+ * @param pin Pin returned by omcache_value_pin().
+ * @return OMCACHE_OK.
+ */
+int omcache_value_unpin(omcache_pin_t *pin);
+
 // Server info
 
 /**
@@ -376,6 +677,27 @@ int omcache_command(omcache_t *mc,
  */
 int omcache_server_index_for_key(omcache_t *mc, const unsigned char *key, size_t key_len);
 
+/**
+ * Look up the server indexes for multiple keys at once, see
+ * omcache_server_index_for_key().  Optionally returns the positions of the
+ * keys grouped by server which allows callers to process the keys of each
+ * server together.
+ * @param mc OMcache handle.
+ * @param keys Keys to look up.
+ * @param key_lens Lengths of the keys.
+ * @param key_count Number of keys.
+ * @param server_indexes Array of key_count entries to store the server
+ *                       index of each key in, -1 if no server is available.
+ * @param key_order NULL or an array of key_count entries to store the
+ *                  positions of the keys in, ordered by server index with
+ *                  keys without a server last.  Keys of the same server
+ *                  stay in their original order.
+ * @return OMCACHE_OK on success;
+ *         OMCACHE_NO_SERVERS if no servers are configured.
+ */
+int omcache_server_indexes_for_keys(omcache_t *mc, const unsigned char **keys, const size_t *key_lens,
+                                    size_t key_count, int *server_indexes, size_t *key_order);
+
 typedef struct omcache_server_info_s
 {
   // Since OMcache 0.1.0: make sure to verify omcache_version in returned
@@ -384,6 +706,8 @@ typedef struct omcache_server_info_s
   int server_index;     ///< Server index
   char *hostname;       ///< Hostname of the server
   int port;             ///< Port number of the server
+  // Since OMcache 0.4.0
+  int weight;           ///< Relative weight of the server
 } omcache_server_info_t;
 
 /**
@@ -789,3 +1113,61 @@ int omcache_gat_multi(omcache_t *mc,
                       omcache_value_t *values,
                       size_t *value_count,
                       int32_t timeout_msec);
+
+/**
+ * Set the given key to the given value splitting values larger than
+ * chunk_size in chunks stored under their own keys.  The chunks are
+ * stored under keys "key:0" to "key:N" with a single round of pipelined
+ * quiet sets after which a manifest describing them is stored under key.
+ * Values stored with this function must be read with omcache_get_chunked().
+ * @param mc OMcache handle.
+ * @param key Key under which the value will be stored.
+ * @param key_len Length of the key.
+ * @param value New value to store in memcached.
+ * @param value_len Length of the value.
+ * @param expiration Expire the value after this time.
+ *                   See omcache_set() for details.
+ * @param flags Flags to associate with the stored object.
+ * @param chunk_size Maximum size of a single chunk, zero for the default
+ *                   of 1000000 bytes which fits in memcached's default
+ *                   1 megabyte item size limit.
+ * @param timeout_msec Maximum number of milliseconds to block while waiting
+ *                     for I/O to complete.  Zero means no blocking at all
+ *                     and a negative value blocks indefinitely.
+ * @return OMCACHE_OK if data was successfully written;
+ *         OMCACHE_BUFFERED if data was successfully added to write buffer.
+ *         OMCACHE_INVALID if the chunk keys would be too long.
+ */
+int omcache_set_chunked(omcache_t *mc,
+                        const unsigned char *key, size_t key_len,
+                        const unsigned char *value, size_t value_len,
+                        time_t expiration, uint32_t flags,
+                        size_t chunk_size, int32_t timeout_msec);
+
+/**
+ * Look up a value stored with omcache_set_chunked() and copy it to the
+ * given buffer.  The chunks of a value are retrieved with a single
+ * multi-key lookup once its manifest has been found and copied from the
+ * receive buffers directly to their place in buf.
+ * @param mc OMcache handle.
+ * @param key Key to look up.
+ * @param key_len Length of the key.
+ * @param buf Buffer to store the value in.
+ * @param buf_size Pointer to the size of buf, set to the length of the
+ *                 value on success or when buf is too small.
+ * @param flags Pointer to store the retrieved object's flags in.
+ * @param timeout_msec Maximum number of milliseconds to block while waiting
+ *                     for I/O to complete.  A negative value blocks
+ *                     indefinitely, zero is not allowed.
+ * @return OMCACHE_OK if the value was retrieved;
+ *         OMCACHE_NOT_FOUND the key or some of its chunks were not set in
+ *                           the backend.
+ *         OMCACHE_BUFFER_FULL buf is too small to hold the value.
+ *         OMCACHE_TOO_LARGE_VALUE the value or one of its chunks was
+ *                                 passed to the stream callback.
+ *         OMCACHE_AGAIN the value was not retrieved in time.
+ */
+int omcache_get_chunked(omcache_t *mc,
+                        const unsigned char *key, size_t key_len,
+                        unsigned char *buf, size_t *buf_size,
+                        uint32_t *flags, int32_t timeout_msec);
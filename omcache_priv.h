@@ -12,6 +12,8 @@
 #ifndef _OMCACHE_PRIV_H
 #define _OMCACHE_PRIV_H 1
 
+#include <stdbool.h>
+#include <time.h>
 #include "omcache.h"
 #include "memcached_protocol_binary.h"
 #include "compat.h"
@@ -20,6 +22,20 @@
 
 #define omc_hidden __attribute__((visibility("hidden")))
 
+static inline int64_t omc_msec(void)
+{
+  struct timespec ts;
+#ifdef CLOCK_MONOTONIC_COARSE
+  if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts) == -1)
+#endif
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+  return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
 typedef struct omc_hash_node_s
 {
   uint32_t key;
@@ -50,7 +66,37 @@ omc_hidden void *omc_hash_table_del(omc_hash_table_t *hash, uint32_t key);
 #define omc_int_hash_table_add(h,k,v) omc_hash_table_add((h), (k), (void *) (uintptr_t) (v))
 #define omc_int_hash_table_del(h,k) omc_hash_table_del((h), (k))
 
+typedef struct omc_seq_table_s
+{
+  uint32_t base;
+  uint32_t size;
+  uint32_t used;
+  uint32_t count;
+  uint64_t *bitmap;
+  void **vals;
+} omc_seq_table_t;
+
+omc_hidden omc_seq_table_t *omc_seq_table_init(omc_seq_table_t *table, uint32_t base, uint32_t size);
+omc_hidden void omc_seq_table_free(omc_seq_table_t *table);
+omc_hidden void *omc_seq_table_find(omc_seq_table_t *table, uint32_t key);
+omc_hidden int omc_seq_table_add(omc_seq_table_t *table, uint32_t key, void *val);
+omc_hidden void *omc_seq_table_del(omc_seq_table_t *table, uint32_t key);
+omc_hidden uint32_t omc_seq_table_next(omc_seq_table_t *table, uint32_t key);
+
+typedef struct omc_near_cache_s omc_near_cache_t;
+
+omc_hidden omc_near_cache_t *omc_near_cache_init(omc_near_cache_t *nc, size_t max_bytes, uint32_t ttl_msec);
+omc_hidden void omc_near_cache_free(omc_near_cache_t *nc);
+omc_hidden void omc_near_cache_clear(omc_near_cache_t *nc);
+omc_hidden bool omc_near_cache_find(omc_near_cache_t *nc, const unsigned char *key, size_t key_len,
+                                    int64_t now, omcache_value_t *value);
+omc_hidden void omc_near_cache_add(omc_near_cache_t *nc, const omcache_value_t *value, int64_t now);
+omc_hidden void omc_near_cache_del(omc_near_cache_t *nc, const unsigned char *key, size_t key_len);
+
 omc_hidden void omc_hash_md5(const unsigned char *key, size_t key_len, unsigned char *buf);
 omc_hidden uint32_t omc_hash_jenkins_oat(const unsigned char *key, size_t key_len);
+omc_hidden uint32_t omc_hash_murmur3(const unsigned char *key, size_t key_len);
+omc_hidden uint32_t omc_hash_xxh3(const unsigned char *key, size_t key_len);
+omc_hidden uint32_t omc_hash_crc32c(const unsigned char *key, size_t key_len);
 
 #endif // !_OMCACHE_PRIV_H
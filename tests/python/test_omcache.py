@@ -202,3 +202,17 @@ class TestOmcache(OMcacheCase):
         assert counts[b"ketama"] >= item_count / 10
         assert counts[b"ketama_weighted"] >= item_count / 10
         assert counts[b"ketama_pre1010"] >= item_count / 10
+        oc.set_servers([mc1, mc2])
+        oc.set_distribution_method("jump_hash")
+        oc.set("test_dist_jump", "jump_hash")
+        assert oc.get("test_dist_jump") == b"jump_hash"
+        oc.set_distribution_method("maglev")
+        oc.set("test_dist_maglev", "maglev")
+        assert oc.get("test_dist_maglev") == b"maglev"
+        oc.set_distribution_method("rendezvous")
+        oc.set("test_dist_rendezvous", "rendezvous")
+        assert oc.get("test_dist_rendezvous") == b"rendezvous"
+        for method in ("ketama_xxh3", "ketama_murmur3", "ketama_crc32c"):
+            oc.set_distribution_method(method)
+            oc.set("test_dist_" + method, method)
+            assert oc.get("test_dist_" + method) == method.encode()
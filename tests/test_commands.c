@@ -12,6 +12,11 @@
 #include <unistd.h>
 #include "test_omcache.h"
 
+#ifdef WITH_THREADS
+#include <pthread.h>
+#include <signal.h>
+#endif // WITH_THREADS
+
 #define TIMEOUT 2000
 
 START_TEST(test_noop)
@@ -467,6 +472,798 @@ START_TEST(test_response_callback)
 }
 END_TEST
 
+#define NC_KEYS 100
+
+static void ck_near_value(omcache_t *oc, const char *key, const char *expected)
+{
+  const unsigned char *get_val;
+  size_t get_val_len;
+  ck_omcache_ok(omcache_get(oc, (cuc *) key, strlen(key), &get_val, &get_val_len, NULL, NULL, TIMEOUT));
+  ck_assert_uint_eq(get_val_len, strlen(expected));
+  ck_assert_int_eq(memcmp(get_val, expected, get_val_len), 0);
+}
+
+START_TEST(test_near_cache)
+{
+  omcache_t *oc = ot_init_omcache(2, LOG_INFO);
+  omcache_t *oc2 = ot_init_omcache(2, LOG_INFO);
+  const char *key = "test_near_cache";
+  size_t key_len = strlen(key);
+  const unsigned char *get_val;
+  size_t get_val_len;
+  uint32_t flags;
+
+  ck_omcache(omcache_set_near_cache(oc, 100000, 0), OMCACHE_INVALID);
+  ck_omcache_ok(omcache_set_near_cache(oc, 100000, 500));
+
+  // writes made by other clients are not seen until the cached value expires
+  ck_omcache_ok(omcache_set(oc, (cuc *) key, key_len, (cuc *) "foo", 3, 0, 42, 0, TIMEOUT));
+  ck_near_value(oc, key, "foo");
+  ck_omcache_ok(omcache_set(oc2, (cuc *) key, key_len, (cuc *) "bar", 3, 0, 43, 0, TIMEOUT));
+  ck_near_value(oc, key, "foo");
+  ck_omcache_ok(omcache_gat(oc, (cuc *) key, key_len, &get_val, &get_val_len, 0, &flags, NULL, TIMEOUT));
+  ck_assert_uint_eq(flags, 42);
+  // cached values are returned without waiting
+  ck_omcache_ok(omcache_get(oc, (cuc *) key, key_len, &get_val, &get_val_len, &flags, NULL, 0));
+  ck_assert_int_eq(memcmp(get_val, "foo", 3), 0);
+  usleep(600000);
+  ck_omcache_ok(omcache_get(oc, (cuc *) key, key_len, &get_val, &get_val_len, &flags, NULL, TIMEOUT));
+  ck_assert_int_eq(memcmp(get_val, "bar", 3), 0);
+  ck_assert_uint_eq(flags, 43);
+
+  // local writes drop the cached value
+  ck_omcache_ok(omcache_set_near_cache(oc, 100000, 10000));
+  ck_omcache_ok(omcache_set(oc2, (cuc *) key, key_len, (cuc *) "baz", 3, 0, 0, 0, TIMEOUT));
+  ck_near_value(oc, key, "bar");
+  ck_omcache_ok(omcache_append(oc, (cuc *) key, key_len, (cuc *) "!", 1, 0, TIMEOUT));
+  ck_near_value(oc, key, "baz!");
+  ck_omcache_ok(omcache_delete(oc, (cuc *) key, key_len, TIMEOUT));
+  ck_omcache(omcache_get(oc, (cuc *) key, key_len, NULL, NULL, NULL, NULL, TIMEOUT), OMCACHE_NOT_FOUND);
+
+  // multi-key lookups mix cached values with responses from the servers
+  char *keys[NC_KEYS];
+  size_t key_lens[NC_KEYS];
+  omcache_req_t reqs[NC_KEYS];
+  omcache_value_t values[NC_KEYS];
+  for (int i = 0; i < NC_KEYS; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "test_near_cache_%d", i);
+      ck_omcache_ok(omcache_set(oc2, (cuc *) keys[i], key_lens[i], (cuc *) "old", 3, 0, 0, 0, TIMEOUT));
+    }
+  for (int i = 0; i < NC_KEYS / 2; i ++)
+    ck_near_value(oc, keys[i], "old");
+  for (int i = 0; i < NC_KEYS; i ++)
+    ck_omcache_ok(omcache_set(oc2, (cuc *) keys[i], key_lens[i], (cuc *) "new", 3, 0, 0, 0, TIMEOUT));
+  size_t req_count = NC_KEYS, value_count = NC_KEYS;
+  ck_omcache_ok(omcache_get_multi(oc, (cuc **) keys, key_lens, NC_KEYS, reqs, &req_count, values, &value_count, TIMEOUT));
+  ck_assert_uint_eq(value_count, NC_KEYS);
+  int stale = 0;
+  for (size_t i = 0; i < value_count; i ++)
+    stale += memcmp(values[i].data, "old", 3) == 0;
+  ck_assert_int_eq(stale, NC_KEYS / 2);
+
+  // a small cache only keeps some of the values
+  ck_omcache_ok(omcache_set_near_cache(oc, 4000, 10000));
+  for (int i = 0; i < NC_KEYS; i ++)
+    ck_omcache_ok(omcache_set(oc2, (cuc *) keys[i], key_lens[i], (cuc *) "big", 3, 0, 0, 0, TIMEOUT));
+  value_count = NC_KEYS;
+  req_count = NC_KEYS;
+  ck_omcache_ok(omcache_get_multi(oc, (cuc **) keys, key_lens, NC_KEYS, reqs, &req_count, values, &value_count, TIMEOUT));
+  ck_assert_uint_eq(value_count, NC_KEYS);
+  stale = 0;
+  for (size_t i = 0; i < value_count; i ++)
+    stale += memcmp(values[i].data, "big", 3) != 0;
+  ck_assert_int_ge(stale, 1);
+  ck_assert_int_le(stale, 4000 / 64);
+
+  // flushing or disabling the near cache drops the cached values
+  ck_omcache_ok(omcache_flush_all(oc, 0, 0, TIMEOUT));
+  ck_omcache_ok(omcache_flush_all(oc, 0, 1, TIMEOUT));
+  ck_omcache(omcache_get(oc, (cuc *) keys[0], key_lens[0], NULL, NULL, NULL, NULL, TIMEOUT), OMCACHE_NOT_FOUND);
+  ck_omcache_ok(omcache_set(oc2, (cuc *) keys[0], key_lens[0], (cuc *) "one", 3, 0, 0, 0, TIMEOUT));
+  ck_near_value(oc, keys[0], "one");
+  ck_omcache_ok(omcache_set(oc2, (cuc *) keys[0], key_lens[0], (cuc *) "two", 3, 0, 0, 0, TIMEOUT));
+  ck_omcache_ok(omcache_set_near_cache(oc, 0, 0));
+  ck_near_value(oc, keys[0], "two");
+
+  // with multiple connections per server lookups sent after unacknowledged
+  // writes see the written values and don't cache older ones
+  ck_omcache_ok(omcache_set_connections_per_server(oc, 4));
+  ck_omcache_ok(omcache_set_near_cache(oc, 100000, 10000));
+  for (int round = 0; round < 3; round ++)
+    for (int i = 0; i < NC_KEYS; i ++)
+      {
+        char val[32];
+        sprintf(val, "conn-%d-%d", round, i);
+        ck_omcache(omcache_set(oc, (cuc *) keys[i], key_lens[i], (cuc *) val, strlen(val), 0, 0, 0, 0),
+                   OMCACHE_BUFFERED);
+        ck_near_value(oc, keys[i], val);
+        ck_near_value(oc, keys[i], val);
+      }
+
+  // a req_id wraparound drops the cached values, see test_req_id_wraparound
+  struct omcache_s_TEST
+  {
+    int64_t init_msec;
+    uint32_t req_id;
+  };
+  ck_omcache_ok(omcache_set(oc2, (cuc *) keys[0], key_lens[0], (cuc *) "wrap", 4, 0, 0, 0, TIMEOUT));
+  ck_near_value(oc, keys[0], "conn-2-0");
+  ((struct omcache_s_TEST *) oc)->req_id = UINT32_MAX - 100;
+  ck_omcache_ok(omcache_noop(oc, 0, TIMEOUT));
+  ck_near_value(oc, keys[0], "wrap");
+
+  for (int i = 0; i < NC_KEYS; i ++)
+    free(keys[i]);
+  omcache_free(oc2);
+  omcache_free(oc);
+}
+END_TEST
+
+#define CO_KEYS 20
+
+static uint64_t ck_cmd_get(omcache_t *oc)
+{
+  omcache_value_t vals[100];
+  size_t val_count = sizeof(vals) / sizeof(vals[0]);
+  ck_omcache_ok(omcache_stat(oc, NULL, vals, &val_count, 0, TIMEOUT));
+  for (size_t i = 0; i < val_count; i ++)
+    if (vals[i].key_len == 7 && memcmp(vals[i].key, "cmd_get", 7) == 0)
+      {
+        char buf[32];
+        snprintf(buf, sizeof(buf), "%.*s", (int) vals[i].data_len, vals[i].data);
+        return strtoull(buf, NULL, 10);
+      }
+  ck_assert_msg(0, "cmd_get not found in stats");
+  return 0;
+}
+
+static void test_coalescing_cb(omcache_t *mc omc_attribute_unused,
+                               omcache_value_t *result, void *context)
+{
+  size_t *values_found_p = (size_t *) context;
+  if (result->status != OMCACHE_OK || result->data_len != 3)
+    return;
+  if (memcmp(result->data, "foo", 3) == 0)
+    values_found_p[0] ++;
+  else if (memcmp(result->data, "bar", 3) == 0)
+    values_found_p[1] ++;
+}
+
+START_TEST(test_coalescing)
+{
+  omcache_t *oc = ot_init_omcache(1, LOG_INFO);
+  const char *key = "test_coalescing";
+  size_t key_len = strlen(key);
+  const unsigned char *keys[CO_KEYS];
+  size_t key_lens[CO_KEYS];
+  omcache_req_t reqs[CO_KEYS];
+  omcache_value_t values[CO_KEYS];
+  for (int i = 0; i < CO_KEYS; i ++)
+    {
+      keys[i] = (cuc *) key;
+      key_lens[i] = key_len;
+    }
+
+  ck_omcache_ok(omcache_set_coalescing(oc, true));
+  ck_omcache_ok(omcache_set(oc, (cuc *) key, key_len, (cuc *) "foo", 3, 0, 0, 0, TIMEOUT));
+
+  // duplicate keys in a single call are looked up once
+  uint64_t cmd_get = ck_cmd_get(oc);
+  size_t req_count = CO_KEYS, value_count = CO_KEYS;
+  ck_omcache_ok(omcache_get_multi(oc, keys, key_lens, CO_KEYS, reqs, &req_count, values, &value_count, TIMEOUT));
+  ck_assert_uint_eq(value_count, CO_KEYS);
+  for (size_t i = 0; i < value_count; i ++)
+    {
+      ck_assert_uint_eq(values[i].data_len, 3);
+      ck_assert_int_eq(memcmp(values[i].data, "foo", 3), 0);
+    }
+  ck_assert_uint_eq(ck_cmd_get(oc), cmd_get + 1);
+
+  // lookups made while an earlier lookup is pending follow it
+  size_t values_found[2] = {0, 0};
+  ck_omcache_ok(omcache_set_response_callback(oc, test_coalescing_cb, values_found));
+  ck_omcache_ok(omcache_set_buffering(oc, true));
+  cmd_get = ck_cmd_get(oc);
+  for (int i = 0; i < CO_KEYS; i ++)
+    ck_omcache(omcache_get(oc, (cuc *) key, key_len, NULL, NULL, NULL, NULL, 0), OMCACHE_BUFFERED);
+  ck_omcache_ok(omcache_set_buffering(oc, false));
+  ck_omcache_ok(omcache_io(oc, NULL, NULL, NULL, NULL, TIMEOUT));
+  ck_assert_uint_eq(values_found[0], CO_KEYS);
+  ck_assert_uint_eq(ck_cmd_get(oc), cmd_get + 1);
+
+  // but not when the key was written in between
+  values_found[0] = 0;
+  ck_omcache_ok(omcache_set_buffering(oc, true));
+  cmd_get = ck_cmd_get(oc);
+  ck_omcache(omcache_get(oc, (cuc *) key, key_len, NULL, NULL, NULL, NULL, 0), OMCACHE_BUFFERED);
+  ck_omcache(omcache_set(oc, (cuc *) key, key_len, (cuc *) "bar", 3, 0, 0, 0, 0), OMCACHE_BUFFERED);
+  ck_omcache(omcache_get(oc, (cuc *) key, key_len, NULL, NULL, NULL, NULL, 0), OMCACHE_BUFFERED);
+  ck_omcache(omcache_get(oc, (cuc *) key, key_len, NULL, NULL, NULL, NULL, 0), OMCACHE_BUFFERED);
+  ck_omcache_ok(omcache_set_buffering(oc, false));
+  ck_omcache_ok(omcache_io(oc, NULL, NULL, NULL, NULL, TIMEOUT));
+  ck_assert_uint_eq(values_found[0], 1);
+  ck_assert_uint_eq(values_found[1], 2);
+  ck_assert_uint_eq(ck_cmd_get(oc), cmd_get + 2);
+  ck_omcache_ok(omcache_set_response_callback(oc, NULL, NULL));
+
+  // misses are coalesced too
+  ck_omcache_ok(omcache_delete(oc, (cuc *) key, key_len, TIMEOUT));
+  cmd_get = ck_cmd_get(oc);
+  req_count = CO_KEYS;
+  value_count = CO_KEYS;
+  ck_omcache_ok(omcache_get_multi(oc, keys, key_lens, CO_KEYS, reqs, &req_count, values, &value_count, TIMEOUT));
+  ck_assert_uint_eq(value_count, 0);
+  ck_assert_uint_eq(ck_cmd_get(oc), cmd_get + 1);
+
+  // disabled coalescing sends every lookup
+  ck_omcache_ok(omcache_set(oc, (cuc *) key, key_len, (cuc *) "foo", 3, 0, 0, 0, TIMEOUT));
+  ck_omcache_ok(omcache_set_coalescing(oc, false));
+  cmd_get = ck_cmd_get(oc);
+  req_count = CO_KEYS;
+  value_count = CO_KEYS;
+  ck_omcache_ok(omcache_get_multi(oc, keys, key_lens, CO_KEYS, reqs, &req_count, values, &value_count, TIMEOUT));
+  ck_assert_uint_eq(value_count, CO_KEYS);
+  ck_assert_uint_eq(ck_cmd_get(oc), cmd_get + CO_KEYS);
+
+  omcache_free(oc);
+}
+END_TEST
+
+#define VP_KEYS 10
+#define VP_SIZE 100000
+
+static void ck_pin_value(omcache_t *oc, const char *key, omcache_value_t *value)
+{
+  omcache_req_t req;
+  const unsigned char *keys[] = { (cuc *) key };
+  size_t key_lens[] = { strlen(key) };
+  size_t req_count = 1, value_count = 1;
+  ck_omcache_ok(omcache_get_multi(oc, keys, key_lens, 1, &req, &req_count, value, &value_count, TIMEOUT));
+  ck_assert_uint_eq(value_count, 1);
+  ck_assert_uint_eq(value->data_len, VP_SIZE);
+}
+
+START_TEST(test_value_pin)
+{
+  omcache_t *oc = ot_init_omcache(1, LOG_INFO);
+  char *keys[VP_KEYS];
+  unsigned char *vals[VP_KEYS];
+  for (int i = 0; i < VP_KEYS; i ++)
+    {
+      asprintf(&keys[i], "test_value_pin_%d", i);
+      vals[i] = malloc(VP_SIZE);
+      memset(vals[i], 'a' + i, VP_SIZE);
+      ck_omcache_ok(omcache_set(oc, (cuc *) keys[i], strlen(keys[i]), vals[i], VP_SIZE, 0, 0, 0, TIMEOUT));
+    }
+
+  // pinned values are read in place and survive the reuse of the buffer
+  omcache_value_t pinned, value;
+  ck_pin_value(oc, keys[0], &pinned);
+  const unsigned char *data = pinned.data;
+  omcache_pin_t *pin = omcache_value_pin(oc, &pinned);
+  ck_assert(pin != NULL);
+  ck_assert(pinned.data == data);
+  omcache_pin_t *pin2 = omcache_value_pin(oc, &pinned);
+  for (int r = 0; r < 3; r ++)
+    for (int i = 1; i < VP_KEYS; i ++)
+      {
+        ck_pin_value(oc, keys[i], &value);
+        ck_assert_int_eq(memcmp(value.data, vals[i], VP_SIZE), 0);
+      }
+  ck_assert_int_eq(memcmp(pinned.data, vals[0], VP_SIZE), 0);
+  ck_omcache_ok(omcache_value_unpin(pin));
+  ck_assert_int_eq(memcmp(pinned.data, vals[0], VP_SIZE), 0);
+  ck_omcache_ok(omcache_value_unpin(pin2));
+
+  // pins outlive the handle
+  ck_pin_value(oc, keys[1], &pinned);
+  pin = omcache_value_pin(oc, &pinned);
+  ck_pin_value(oc, keys[2], &value);
+  omcache_free(oc);
+  ck_assert_int_eq(memcmp(pinned.data, vals[1], VP_SIZE), 0);
+  ck_omcache_ok(omcache_value_unpin(pin));
+
+  // values served from the near cache are copied
+  oc = ot_init_omcache(1, LOG_INFO);
+  ck_omcache_ok(omcache_set_near_cache(oc, 10 * VP_SIZE, 10000));
+  ck_pin_value(oc, keys[3], &value);
+  ck_pin_value(oc, keys[3], &pinned);
+  data = pinned.data;
+  pin = omcache_value_pin(oc, &pinned);
+  ck_assert(pinned.data != data);
+  ck_assert_uint_eq(pinned.key_len, strlen(keys[3]));
+  ck_assert_int_eq(memcmp(pinned.key, keys[3], pinned.key_len), 0);
+  ck_pin_value(oc, keys[4], &value);
+  ck_assert_int_eq(memcmp(pinned.data, vals[3], VP_SIZE), 0);
+  ck_omcache_ok(omcache_value_unpin(pin));
+
+  for (int i = 0; i < VP_KEYS; i ++)
+    {
+      free(keys[i]);
+      free(vals[i]);
+    }
+  omcache_free(oc);
+}
+END_TEST
+
+#define LV_KEYS 16
+
+START_TEST(test_large_values)
+{
+  omcache_t *oc = ot_init_omcache(2, LOG_INFO);
+  char *keys[LV_KEYS];
+  size_t key_lens[LV_KEYS], val_lens[LV_KEYS];
+  unsigned char *vals[LV_KEYS];
+  omcache_req_t reqs[LV_KEYS];
+  omcache_value_t values[LV_KEYS];
+
+  // responses larger than a receive segment mixed with small ones, all
+  // values returned by a call must stay intact
+  for (int i = 0; i < LV_KEYS; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "test_large_values_%d", i);
+      val_lens[i] = (i % 2) ? 200000 + i : 10 + i;
+      vals[i] = malloc(val_lens[i]);
+      for (size_t j = 0; j < val_lens[i]; j ++)
+        vals[i][j] = i + j;
+      ck_omcache_ok(omcache_set(oc, (cuc *) keys[i], key_lens[i], vals[i], val_lens[i], 0, 0, 0, TIMEOUT));
+    }
+  for (int r = 0; r < 3; r ++)
+    {
+      size_t req_count = LV_KEYS, value_count = LV_KEYS, values_found = 0;
+      int ret = omcache_get_multi(oc, (cuc **) keys, key_lens, LV_KEYS, reqs, &req_count, values, &value_count, TIMEOUT);
+      for (;;)
+        {
+          for (size_t i = 0; i < value_count; i ++)
+            {
+              int k = atoi((const char *) values[i].key + strlen("test_large_values_"));
+              ck_assert_uint_eq(values[i].data_len, val_lens[k]);
+              ck_assert_int_eq(memcmp(values[i].data, vals[k], val_lens[k]), 0);
+            }
+          values_found += value_count;
+          if (ret == OMCACHE_OK)
+            break;
+          ck_omcache(ret, OMCACHE_AGAIN);
+          value_count = LV_KEYS;
+          ret = omcache_io(oc, reqs, &req_count, values, &value_count, TIMEOUT);
+        }
+      ck_assert_uint_eq(values_found, LV_KEYS);
+    }
+
+  for (int i = 0; i < LV_KEYS; i ++)
+    {
+      free(keys[i]);
+      free(vals[i]);
+    }
+  omcache_free(oc);
+}
+END_TEST
+
+#define ST_KEYS 8
+
+typedef struct
+{
+  unsigned char *bufs[ST_KEYS];
+  size_t lens[ST_KEYS];
+  size_t pieces;
+} ot_stream_t;
+
+static void test_stream_cb(omcache_t *mc __attribute__((unused)), omcache_value_t *value,
+                           size_t offset, size_t total_len, void *context)
+{
+  ot_stream_t *st = context;
+  char key[32];
+  // the key is followed by the piece of the value, not by its start
+  snprintf(key, sizeof(key), "%.*s", (int) value->key_len, value->key);
+  int k = atoi(key + strlen("test_stream_"));
+  // pieces are passed in order
+  ck_assert_uint_eq(offset, st->lens[k]);
+  if (offset == 0)
+    st->bufs[k] = malloc(total_len);
+  ck_assert_uint_le(offset + value->data_len, total_len);
+  memcpy(st->bufs[k] + offset, value->data, value->data_len);
+  st->lens[k] += value->data_len;
+  st->pieces ++;
+}
+
+START_TEST(test_stream)
+{
+  omcache_t *oc = ot_init_omcache(2, LOG_INFO);
+  ot_stream_t st;
+  char *keys[ST_KEYS];
+  size_t key_lens[ST_KEYS], val_lens[ST_KEYS];
+  unsigned char *vals[ST_KEYS];
+  omcache_req_t reqs[ST_KEYS];
+  omcache_value_t values[ST_KEYS];
+  const unsigned char *get_val;
+  size_t get_val_len;
+
+  memset(&st, 0, sizeof(st));
+  omcache_set_send_buffer_max_size(oc, 2000000);
+  for (int i = 0; i < ST_KEYS; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "test_stream_%d", i);
+      val_lens[i] = (i % 2) ? 900000 + i : 100 + i;
+      vals[i] = malloc(val_lens[i]);
+      for (size_t j = 0; j < val_lens[i]; j ++)
+        vals[i][j] = i + j;
+      ck_omcache_ok(omcache_set(oc, (cuc *) keys[i], key_lens[i], vals[i], val_lens[i], 0, 0, 0, TIMEOUT));
+    }
+
+  // the large values don't fit in the receive buffer but are streamed
+  // without dropping the other responses
+  omcache_set_recv_buffer_max_size(oc, 100000);
+  ck_omcache_ok(omcache_set_stream_callback(oc, 50000, test_stream_cb, &st));
+  size_t req_count = ST_KEYS, value_count = ST_KEYS, values_found = 0;
+  int ret = omcache_get_multi(oc, (cuc **) keys, key_lens, ST_KEYS, reqs, &req_count, values, &value_count, TIMEOUT);
+  for (;;)
+    {
+      for (size_t i = 0; i < value_count; i ++)
+        {
+          int k = atoi((const char *) values[i].key + strlen("test_stream_"));
+          ck_omcache_ok(values[i].status);
+          if (k % 2)
+            {
+              ck_assert(values[i].data == NULL);
+              ck_assert_uint_eq(values[i].data_len, 0);
+              ck_assert_uint_eq(values[i].stream_len, val_lens[k]);
+            }
+          else
+            {
+              ck_assert_uint_eq(values[i].data_len, val_lens[k]);
+              ck_assert_uint_eq(values[i].stream_len, 0);
+              ck_assert_int_eq(memcmp(values[i].data, vals[k], val_lens[k]), 0);
+            }
+        }
+      values_found += value_count;
+      if (ret == OMCACHE_OK)
+        break;
+      ck_omcache(ret, OMCACHE_AGAIN);
+      value_count = ST_KEYS;
+      ret = omcache_io(oc, reqs, &req_count, values, &value_count, TIMEOUT);
+    }
+  ck_assert_uint_eq(values_found, ST_KEYS);
+  ck_assert_uint_ge(st.pieces, ST_KEYS / 2);
+  for (int i = 0; i < ST_KEYS; i ++)
+    {
+      ck_assert_uint_eq(st.lens[i], (i % 2) ? val_lens[i] : 0);
+      if (i % 2)
+        ck_assert_int_eq(memcmp(st.bufs[i], vals[i], val_lens[i]), 0);
+      free(st.bufs[i]);
+      st.lens[i] = 0;
+    }
+
+  // the connections are still usable
+  ck_omcache_ok(omcache_get(oc, (cuc *) keys[0], key_lens[0], &get_val, &get_val_len, NULL, NULL, TIMEOUT));
+  ck_assert_uint_eq(get_val_len, val_lens[0]);
+  ck_assert_int_eq(memcmp(get_val, vals[0], val_lens[0]), 0);
+  ck_omcache_ok(omcache_get(oc, (cuc *) keys[1], key_lens[1], &get_val, &get_val_len, NULL, NULL, TIMEOUT));
+  ck_assert(get_val == NULL);
+  ck_assert_uint_eq(get_val_len, 0);
+  ck_assert_uint_eq(st.lens[1], val_lens[1]);
+  free(st.bufs[1]);
+
+  // chunked reads don't return streamed values
+  st.lens[1] = 0;
+  size_t buf_size = val_lens[1];
+  unsigned char *buf = malloc(buf_size);
+  ck_omcache(omcache_get_chunked(oc, (cuc *) keys[1], key_lens[1], buf, &buf_size, NULL, TIMEOUT),
+             OMCACHE_TOO_LARGE_VALUE);
+  ck_assert_uint_eq(st.lens[1], val_lens[1]);
+  free(st.bufs[1]);
+  free(buf);
+
+  // without streaming the large values can't be received
+  ck_omcache_ok(omcache_set_stream_callback(oc, 0, NULL, NULL));
+  ck_omcache(omcache_get(oc, (cuc *) keys[1], key_lens[1], &get_val, &get_val_len, NULL, NULL, TIMEOUT), OMCACHE_BUFFER_FULL);
+
+  for (int i = 0; i < ST_KEYS; i ++)
+    {
+      free(keys[i]);
+      free(vals[i]);
+    }
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_chunked)
+{
+  omcache_t *oc = ot_init_omcache(2, LOG_INFO);
+  const unsigned char key[] = "test_chunked";
+  size_t key_len = sizeof(key) - 1;
+  size_t val_len = 2500 * 1000, buf_size;
+  unsigned char *val = malloc(val_len), *buf = malloc(val_len);
+  const unsigned char *get_val;
+  size_t get_val_len;
+  uint32_t flags;
+
+  for (size_t i = 0; i < val_len; i ++)
+    val[i] = i % 251;
+  omcache_set_send_buffer_max_size(oc, 5000000);
+  ck_omcache(omcache_get_chunked(oc, key, key_len, buf, &buf_size, NULL, TIMEOUT), OMCACHE_NOT_FOUND);
+  // too large for a single item, split in three chunks
+  ck_omcache_ok(omcache_set_chunked(oc, key, key_len, val, val_len, 0, 42, 0, TIMEOUT));
+  ck_omcache_ok(omcache_get(oc, (cuc *) "test_chunked:2", 14, &get_val, &get_val_len, NULL, NULL, TIMEOUT));
+  ck_assert_uint_eq(get_val_len, val_len - 2 * 1000 * 1000);
+  ck_omcache(omcache_get(oc, (cuc *) "test_chunked:3", 14, NULL, NULL, NULL, NULL, TIMEOUT), OMCACHE_NOT_FOUND);
+
+  buf_size = val_len - 1;
+  ck_omcache(omcache_get_chunked(oc, key, key_len, buf, &buf_size, NULL, TIMEOUT), OMCACHE_BUFFER_FULL);
+  ck_assert_uint_eq(buf_size, val_len);
+  memset(buf, 0, val_len);
+  ck_omcache_ok(omcache_get_chunked(oc, key, key_len, buf, &buf_size, &flags, TIMEOUT));
+  ck_assert_uint_eq(buf_size, val_len);
+  ck_assert_uint_eq(flags, 42);
+  ck_assert_int_eq(memcmp(buf, val, val_len), 0);
+
+  // a chunk from a different write is not mixed in
+  ck_omcache_ok(omcache_set(oc, (cuc *) "test_chunked:1", 14, val, 1000 * 1000, 0, 0, 0, TIMEOUT));
+  ck_omcache(omcache_get_chunked(oc, key, key_len, buf, &buf_size, NULL, TIMEOUT), OMCACHE_NOT_FOUND);
+
+  // many small chunks
+  ck_omcache_ok(omcache_set_chunked(oc, key, key_len, val + 1, 10001, 0, 0, 1000, TIMEOUT));
+  buf_size = val_len;
+  ck_omcache_ok(omcache_get_chunked(oc, key, key_len, buf, &buf_size, NULL, TIMEOUT));
+  ck_assert_uint_eq(buf_size, 10001);
+  ck_assert_int_eq(memcmp(buf, val + 1, 10001), 0);
+
+  // small values are stored as they are
+  ck_omcache_ok(omcache_set_chunked(oc, key, key_len, (cuc *) "bar", 3, 0, 7, 1000, TIMEOUT));
+  ck_omcache_ok(omcache_get(oc, key, key_len, &get_val, &get_val_len, NULL, NULL, TIMEOUT));
+  ck_assert_uint_eq(get_val_len, 3);
+  buf_size = val_len;
+  ck_omcache_ok(omcache_get_chunked(oc, key, key_len, buf, &buf_size, &flags, TIMEOUT));
+  ck_assert_uint_eq(buf_size, 3);
+  ck_assert_uint_eq(flags, 7);
+  ck_assert_int_eq(memcmp(buf, "bar", 3), 0);
+
+  ck_omcache(omcache_get_chunked(oc, key, key_len, buf, &buf_size, NULL, 0), OMCACHE_INVALID);
+
+  free(val);
+  free(buf);
+  omcache_free(oc);
+}
+END_TEST
+
+#ifdef WITH_THREADS
+#define TS_THREADS 8
+#define TS_KEYS 50
+
+static void *test_thread_safe_thread(void *arg)
+{
+  omcache_t *oc = *(omcache_t **) arg;
+  uintptr_t errors = 0;
+  char *keys[TS_KEYS];
+  size_t key_lens[TS_KEYS];
+
+  for (int i = 0; i < TS_KEYS; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "test_thread_safe_%p_%d", arg, i);
+      if (omcache_set(oc, (cuc *) keys[i], key_lens[i], (cuc *) keys[i], key_lens[i], 0, 0, 0, TIMEOUT) != OMCACHE_OK)
+        errors ++;
+    }
+  for (int i = 0; i < TS_KEYS; i ++)
+    {
+      const unsigned char *val;
+      size_t val_len;
+      if (omcache_get(oc, (cuc *) keys[i], key_lens[i], &val, &val_len, NULL, NULL, TIMEOUT) != OMCACHE_OK ||
+          val_len != key_lens[i] || memcmp(val, keys[i], val_len) != 0)
+        errors ++;
+    }
+
+  omcache_value_t values[TS_KEYS];
+  omcache_req_t reqs[TS_KEYS];
+  size_t value_count = TS_KEYS, req_count = TS_KEYS;
+  if (omcache_get_multi(oc, (cuc **) keys, key_lens, TS_KEYS, reqs, &req_count, values, &value_count, TIMEOUT) != OMCACHE_OK)
+    errors ++;
+  // returned values must not be clobbered by the other threads
+  usleep(10000);
+  for (size_t i = 0; i < value_count; i ++)
+    if (values[i].key_len != values[i].data_len || memcmp(values[i].key, values[i].data, values[i].data_len) != 0)
+      errors ++;
+  errors += TS_KEYS - value_count;
+
+  for (int i = 0; i < TS_KEYS; i ++)
+    free(keys[i]);
+  return (void *) errors;
+}
+
+START_TEST(test_thread_safe)
+{
+  omcache_t *oc = ot_init_omcache(3, LOG_INFO);
+  omcache_t *ocs[TS_THREADS];
+  pthread_t threads[TS_THREADS];
+
+  ck_omcache_ok(omcache_set_thread_safe(oc, true));
+  for (int i = 0; i < TS_THREADS; i ++)
+    {
+      ocs[i] = oc;
+      ck_assert_int_eq(pthread_create(&threads[i], NULL, test_thread_safe_thread, &ocs[i]), 0);
+    }
+  for (int i = 0; i < TS_THREADS; i ++)
+    {
+      void *errors;
+      ck_assert_int_eq(pthread_join(threads[i], &errors), 0);
+      ck_assert_int_eq((uintptr_t) errors, 0);
+    }
+  ck_omcache_ok(omcache_set_thread_safe(oc, false));
+  ck_omcache_ok(omcache_noop(oc, 0, TIMEOUT));
+  omcache_free(oc);
+}
+END_TEST
+
+struct test_thread_wait_arg
+{
+  omcache_t *oc;
+  int server_index;
+  int ret;
+};
+
+static void *test_thread_wait_thread(void *arg)
+{
+  struct test_thread_wait_arg *twa = arg;
+  twa->ret = omcache_noop(twa->oc, twa->server_index, TIMEOUT);
+  return NULL;
+}
+
+START_TEST(test_thread_wait)
+{
+  char strbuf[100];
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  pid_t mc_pid0, mc_pid1;
+  int mc_port0 = ot_start_memcached(NULL, &mc_pid0);
+  int mc_port1 = ot_start_memcached(NULL, &mc_pid1);
+  int susp_server_index = -1;
+
+  snprintf(strbuf, sizeof(strbuf), "127.0.0.1:%d,127.0.0.1:%d", mc_port0, mc_port1);
+  ck_omcache_ok(omcache_set_servers(oc, strbuf));
+  // don't let the suspended server time out during the test
+  ck_omcache_ok(omcache_set_dead_timeout(oc, 3 * TIMEOUT));
+  ck_omcache_ok(omcache_set_thread_safe(oc, true));
+  for (int i = 0; i < 2; i ++)
+    {
+      ck_omcache_ok(omcache_noop(oc, i, TIMEOUT));
+      omcache_server_info_t *sinfo = omcache_server_info(oc, i);
+      if (sinfo->port == mc_port1)
+        susp_server_index = i;
+      ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+    }
+  ck_assert_int_ge(susp_server_index, 0);
+
+  // a thread waiting for a server that doesn't respond must not block the
+  // other threads' calls
+  kill(mc_pid1, SIGSTOP);
+  usleep(100000);  // allow 0.1 for SIGSTOP to be delivered
+  struct test_thread_wait_arg twa = { .oc = oc, .server_index = susp_server_index, .ret = -1 };
+  pthread_t thread;
+  ck_assert_int_eq(pthread_create(&thread, NULL, test_thread_wait_thread, &twa), 0);
+  usleep(100000);
+  int64_t start = ot_msec();
+  for (int i = 0; i < 10; i ++)
+    ck_omcache_ok(omcache_noop(oc, !susp_server_index, TIMEOUT));
+  ck_assert_int_le(ot_msec() - start, TIMEOUT / 2);
+  ck_assert_int_eq(pthread_join(thread, NULL), 0);
+  ck_omcache(twa.ret, OMCACHE_AGAIN);
+
+  kill(mc_pid1, SIGCONT);
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_thread_req_id_wraparound)
+{
+  // NOTE: omcache_t is opaque, see test_req_id_wraparound
+  struct omcache_s_TEST
+  {
+    int64_t init_msec;
+    uint32_t req_id;
+  };
+  char strbuf[100];
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  struct omcache_s_TEST *oc_s = (struct omcache_s_TEST *) oc;
+  pid_t mc_pid0, mc_pid1;
+  int mc_port0 = ot_start_memcached(NULL, &mc_pid0);
+  int mc_port1 = ot_start_memcached(NULL, &mc_pid1);
+  int susp_server_index = -1;
+
+  snprintf(strbuf, sizeof(strbuf), "127.0.0.1:%d,127.0.0.1:%d", mc_port0, mc_port1);
+  ck_omcache_ok(omcache_set_servers(oc, strbuf));
+  ck_omcache_ok(omcache_set_dead_timeout(oc, 3 * TIMEOUT));
+  ck_omcache_ok(omcache_set_thread_safe(oc, true));
+  for (int i = 0; i < 2; i ++)
+    {
+      ck_omcache_ok(omcache_noop(oc, i, TIMEOUT));
+      omcache_server_info_t *sinfo = omcache_server_info(oc, i);
+      if (sinfo->port == mc_port1)
+        susp_server_index = i;
+      ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+    }
+  ck_assert_int_ge(susp_server_index, 0);
+
+  kill(mc_pid1, SIGSTOP);
+  usleep(100000);  // allow 0.1 for SIGSTOP to be delivered
+  struct test_thread_wait_arg twa = { .oc = oc, .server_index = susp_server_index, .ret = -1 };
+  pthread_t thread;
+  ck_assert_int_eq(pthread_create(&thread, NULL, test_thread_wait_thread, &twa), 0);
+  usleep(100000);
+
+  // the wraparound is deferred while the thread waits for its response
+  oc_s->req_id = UINT32_MAX - 1000;
+  ck_omcache_ok(omcache_noop(oc, !susp_server_index, TIMEOUT));
+  ck_assert_uint_gt(oc_s->req_id, UINT32_MAX - 1000);
+
+  // until the ids run out, the waiting call's request then fails
+  oc_s->req_id = UINT32_MAX - 5;
+  ck_omcache_ok(omcache_noop(oc, !susp_server_index, TIMEOUT));
+  ck_assert_uint_lt(oc_s->req_id, 1000);
+  ck_assert_int_eq(pthread_join(thread, NULL), 0);
+  ck_omcache(twa.ret, OMCACHE_NO_SERVERS);
+
+  // the response to the request sent before the wraparound is ignored
+  kill(mc_pid1, SIGCONT);
+  for (int i = 0; i < 10; i ++)
+    ck_omcache_ok(omcache_noop(oc, susp_server_index, TIMEOUT));
+  omcache_free(oc);
+}
+END_TEST
+
+static void test_io_thread_cb(omcache_t *mc omc_attribute_unused, omcache_value_t *result, void *context)
+{
+  if (result->status == OMCACHE_OK && result->data_len > strlen("test_io_thread_") &&
+      memcmp(result->data, "test_io_thread_", strlen("test_io_thread_")) == 0)
+    __atomic_add_fetch((int *) context, 1, __ATOMIC_SEQ_CST);
+}
+
+START_TEST(test_io_thread)
+{
+  omcache_t *oc = ot_init_omcache(3, LOG_INFO);
+  char *keys[TS_KEYS];
+  size_t key_lens[TS_KEYS];
+  int responses = 0;
+
+  ck_omcache_ok(omcache_set_response_callback(oc, test_io_thread_cb, &responses));
+  ck_omcache_ok(omcache_set_io_thread(oc, true));
+  ck_omcache_ok(omcache_set_io_thread(oc, true));
+  ck_omcache(omcache_set_thread_safe(oc, false), OMCACHE_INVALID);
+  // let the thread go idle so that it must be woken up by new requests
+  usleep(100000);
+
+  // buffered requests are sent and completed by the I/O thread
+  ck_omcache_ok(omcache_set_buffering(oc, true));
+  for (int i = 0; i < TS_KEYS; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "test_io_thread_%d", i);
+      ck_omcache(omcache_set(oc, (cuc *) keys[i], key_lens[i], (cuc *) keys[i], key_lens[i], 0, 0, 0, 0), OMCACHE_BUFFERED);
+    }
+  omcache_req_t reqs[TS_KEYS];
+  size_t req_count = TS_KEYS;
+  ck_omcache(omcache_get_multi(oc, (cuc **) keys, key_lens, TS_KEYS, reqs, &req_count, NULL, NULL, 0), OMCACHE_BUFFERED);
+  for (int i = 0; i < TIMEOUT / 10 && __atomic_load_n(&responses, __ATOMIC_SEQ_CST) < TS_KEYS; i ++)
+    usleep(10000);
+  ck_assert_int_eq(__atomic_load_n(&responses, __ATOMIC_SEQ_CST), TS_KEYS);
+  ck_omcache_ok(omcache_set_buffering(oc, false));
+
+  // waiting for responses works while the thread is running
+  for (int i = 0; i < TS_KEYS; i ++)
+    {
+      const unsigned char *val;
+      size_t val_len;
+      ck_omcache_ok(omcache_get(oc, (cuc *) keys[i], key_lens[i], &val, &val_len, NULL, NULL, TIMEOUT));
+      ck_assert_int_eq(val_len, key_lens[i]);
+      free(keys[i]);
+    }
+
+  ck_omcache_ok(omcache_set_io_thread(oc, false));
+  ck_omcache_ok(omcache_set_thread_safe(oc, false));
+  ck_omcache_ok(omcache_noop(oc, 0, TIMEOUT));
+  // the thread is stopped when the handle is freed
+  ck_omcache_ok(omcache_set_io_thread(oc, true));
+  omcache_free(oc);
+}
+END_TEST
+#endif // WITH_THREADS
+
 Suite *ot_suite_commands(void)
 {
   Suite *s = suite_create("Commands");
@@ -484,6 +1281,18 @@ Suite *ot_suite_commands(void)
   ot_tcase_add(s, test_req_id_wraparound);
   ot_tcase_add(s, test_buffering);
   ot_tcase_add(s, test_response_callback);
+  ot_tcase_add(s, test_near_cache);
+  ot_tcase_add(s, test_coalescing);
+  ot_tcase_add(s, test_value_pin);
+  ot_tcase_add(s, test_large_values);
+  ot_tcase_add(s, test_stream);
+  ot_tcase_add(s, test_chunked);
+#ifdef WITH_THREADS
+  ot_tcase_add(s, test_thread_safe);
+  ot_tcase_add(s, test_thread_wait);
+  ot_tcase_add(s, test_thread_req_id_wraparound);
+  ot_tcase_add(s, test_io_thread);
+#endif // WITH_THREADS
 
   return s;
 }
@@ -104,6 +104,83 @@ START_TEST(test_suspended_memcache)
 }
 END_TEST
 
+#define RS_KEYS 90
+
+START_TEST(test_server_reset_multiget)
+{
+  // a server failing in the middle of a multi-key lookup only fails the
+  // lookups that were sent to it
+  char strbuf[100];
+  char *keys[RS_KEYS];
+  size_t key_lens[RS_KEYS];
+  int owners[RS_KEYS], statuses[RS_KEYS];
+  omcache_req_t reqs[RS_KEYS];
+  omcache_value_t values[RS_KEYS];
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  int reset_server_index = -1, reset_keys = 0;
+  pid_t mc_pid0, mc_pid1, mc_pid2;
+  int mc_port0 = ot_start_memcached(NULL, &mc_pid0);
+  int mc_port1 = ot_start_memcached(NULL, &mc_pid1);
+  int mc_port2 = ot_start_memcached(NULL, &mc_pid2);
+
+  sprintf(strbuf, "127.0.0.1:%d,127.0.0.1:%d,127.0.0.1:%d", mc_port0, mc_port1, mc_port2);
+  ck_omcache_ok(omcache_set_servers(oc, strbuf));
+  // don't let the suspended server time out during the test
+  ck_omcache_ok(omcache_set_dead_timeout(oc, 3 * TIMEOUT));
+  for (int i = 0; i < 3; i ++)
+    {
+      ck_omcache_ok(omcache_noop(oc, i, TIMEOUT));
+      omcache_server_info_t *sinfo = omcache_server_info(oc, i);
+      if (sinfo->port == mc_port2)
+        reset_server_index = i;
+      ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+    }
+  ck_assert_int_ge(reset_server_index, 0);
+  for (int i = 0; i < RS_KEYS; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "test_server_reset_multiget_%d", i);
+      ck_omcache_ok(omcache_set(oc, (cuc *) keys[i], key_lens[i], (cuc *) keys[i], key_lens[i], 0, 0, 0, TIMEOUT));
+      owners[i] = omcache_server_index_for_key(oc, (cuc *) keys[i], key_lens[i]);
+      reset_keys += owners[i] == reset_server_index;
+      statuses[i] = -1;
+    }
+  ck_assert_int_gt(reset_keys, 0);
+  ck_assert_int_lt(reset_keys, RS_KEYS);
+
+  // the other servers answer while the suspended one doesn't
+  kill(mc_pid2, SIGSTOP);
+  usleep(100000);  // allow 0.1 for SIGSTOP to be delivered
+  size_t req_count = RS_KEYS, value_count = RS_KEYS;
+  int ret = omcache_get_multi(oc, (cuc **) keys, key_lens, RS_KEYS, reqs, &req_count, values, &value_count, 200);
+  ck_omcache(ret, OMCACHE_AGAIN);
+  ck_assert_int_gt(req_count, 0);
+  kill(mc_pid2, SIGKILL);
+  for (;;)
+    {
+      for (size_t i = 0; i < value_count; i ++)
+        {
+          int k = atoi((const char *) values[i].key + strlen("test_server_reset_multiget_"));
+          ck_assert_int_eq(statuses[k], -1);
+          statuses[k] = values[i].status;
+        }
+      if (ret != OMCACHE_AGAIN)
+        break;
+      value_count = RS_KEYS;
+      ret = omcache_io(oc, reqs, &req_count, values, &value_count, TIMEOUT);
+    }
+  ck_omcache_ok(ret);
+  for (int i = 0; i < RS_KEYS; i ++)
+    {
+      if (owners[i] == reset_server_index)
+        ck_omcache(statuses[i], OMCACHE_SERVER_FAILURE);
+      else
+        ck_omcache_ok(statuses[i]);
+      free(keys[i]);
+    }
+  omcache_free(oc);
+}
+END_TEST
+
 START_TEST(test_all_backends_fail)
 {
   size_t item_count = 10;
@@ -217,11 +294,108 @@ START_TEST(test_all_backends_fail)
 }
 END_TEST
 
+START_TEST(test_maglev_server_down)
+{
+  char strbuf[100];
+  int before[200], dead_index = -1, kept = 0, moved = 0;
+  pid_t mc_pid0, mc_pid1;
+  int mc_port0 = ot_start_memcached(NULL, &mc_pid0);
+  int mc_port1 = ot_start_memcached(NULL, &mc_pid1);
+  sprintf(strbuf, "127.0.0.1:%d,127.0.0.1:%d,127.0.0.1:1", mc_port0, mc_port1);
+
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_maglev));
+  ck_omcache_ok(omcache_set_servers(oc, strbuf));
+  for (int i = 0; i < 3; i ++)
+    {
+      omcache_server_info_t *sinfo = omcache_server_info(oc, i);
+      if (sinfo->port == 1)
+        dead_index = i;
+      ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+    }
+  ck_assert_int_ge(dead_index, 0);
+  for (int i = 0; i < 200; i ++)
+    {
+      before[i] = omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i));
+      moved += before[i] == dead_index;
+    }
+  ck_assert_int_ge(moved, 30);
+
+  // nothing listens on port 1: the first attempt fails asynchronously and
+  // the second one disables the server and rebuilds the lookup table
+  omcache_noop(oc, dead_index, TIMEOUT);
+  omcache_noop(oc, dead_index, TIMEOUT);
+  for (int i = 0; i < 200; i ++)
+    {
+      int si = omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i));
+      ck_assert_int_ne(si, dead_index);
+      kept += si == before[i];
+      ck_omcache_ok(omcache_set(oc, (cuc *) &i, sizeof(i), (cuc *) &i, sizeof(i), 0, 0, 0, TIMEOUT));
+    }
+  // maglev disruption is near-minimal: almost all keys of the remaining
+  // servers stay where they were
+  ck_assert_int_ge(kept, (200 - moved) * 9 / 10);
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_rendezvous_server_down)
+{
+  char strbuf[100];
+  int before[200], moved_to[3] = {0}, dead_index = -1, kept = 0, moved = 0;
+  pid_t mc_pid0, mc_pid1;
+  int mc_port0 = ot_start_memcached(NULL, &mc_pid0);
+  int mc_port1 = ot_start_memcached(NULL, &mc_pid1);
+  sprintf(strbuf, "127.0.0.1:%d,127.0.0.1:%d,127.0.0.1:1", mc_port0, mc_port1);
+
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_rendezvous));
+  ck_omcache_ok(omcache_set_servers(oc, strbuf));
+  for (int i = 0; i < 3; i ++)
+    {
+      omcache_server_info_t *sinfo = omcache_server_info(oc, i);
+      if (sinfo->port == 1)
+        dead_index = i;
+      ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+    }
+  ck_assert_int_ge(dead_index, 0);
+  for (int i = 0; i < 200; i ++)
+    {
+      before[i] = omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i));
+      moved += before[i] == dead_index;
+    }
+  ck_assert_int_ge(moved, 30);
+
+  omcache_noop(oc, dead_index, TIMEOUT);
+  omcache_noop(oc, dead_index, TIMEOUT);
+  for (int i = 0; i < 200; i ++)
+    {
+      int si = omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i));
+      ck_assert_int_ne(si, dead_index);
+      if (si == before[i])
+        kept ++;
+      else
+        moved_to[si] ++;
+      ck_omcache_ok(omcache_set(oc, (cuc *) &i, sizeof(i), (cuc *) &i, sizeof(i), 0, 0, 0, TIMEOUT));
+    }
+  // only the keys of the disabled server moved and they were spread over
+  // both of the remaining servers
+  ck_assert_int_eq(kept, 200 - moved);
+  for (int i = 0; i < 3; i ++)
+    if (i != dead_index)
+      ck_assert_int_ge(moved_to[i], moved / 4);
+  omcache_free(oc);
+}
+END_TEST
+
 Suite *ot_suite_failures(void)
 {
   Suite *s = suite_create("Failures");
   ot_tcase_add_timeout(s, test_suspended_memcache, 60);
+  ot_tcase_add(s, test_server_reset_multiget);
   ot_tcase_add_timeout(s, test_all_backends_fail, 60);
+  ot_tcase_add(s, test_maglev_server_down);
+  ot_tcase_add(s, test_rendezvous_server_down);
 
   return s;
 }
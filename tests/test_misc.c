@@ -52,6 +52,44 @@ START_TEST(test_md5)
 }
 END_TEST
 
+START_TEST(test_seq_table)
+{
+  int vals[200];
+  uint32_t base = UINT32_MAX - 49;
+  omc_seq_table_t *table = omc_seq_table_init(NULL, base, 100);
+  // keys may wrap around
+  for (uint32_t i = 0; i < 100; i += 3)
+    ck_assert_int_eq(omc_seq_table_add(table, base + i, &vals[i]), 0);
+  ck_assert_int_eq(table->count, 34);
+  ck_assert_int_ne(omc_seq_table_add(table, base - 1, &vals[0]), 0);
+  ck_assert_int_ne(omc_seq_table_add(table, 10000, &vals[0]), 0);
+  ck_assert(omc_seq_table_find(table, base) == &vals[0]);
+  ck_assert(omc_seq_table_find(table, base + 1) == NULL);
+  ck_assert(omc_seq_table_find(table, 1) == &vals[51]);
+  ck_assert(omc_seq_table_find(table, 98) == NULL);
+  ck_assert(omc_seq_table_del(table, base) == &vals[0]);
+  ck_assert(omc_seq_table_del(table, base) == NULL);
+  ck_assert_int_eq(table->count, 33);
+  ck_assert_uint_eq(omc_seq_table_next(table, base), base + 3);
+  ck_assert_uint_eq(omc_seq_table_next(table, UINT32_MAX), 1);
+  ck_assert_uint_eq(omc_seq_table_next(table, 50), 50);
+
+  // reinitialization clears the table
+  table = omc_seq_table_init(table, 1000, 200);
+  ck_assert_int_eq(table->count, 0);
+  ck_assert_uint_eq(omc_seq_table_next(table, 1000), 1000);
+  for (uint32_t i = 0; i < 200; i ++)
+    {
+      ck_assert(omc_seq_table_find(table, 1000 + i) == NULL);
+      ck_assert_int_eq(omc_seq_table_add(table, 1000 + i, &vals[i]), 0);
+    }
+  table = omc_seq_table_init(table, 5, 10);
+  for (uint32_t i = 0; i < 200; i ++)
+    ck_assert(omc_seq_table_find(table, 5 + i) == NULL);
+  omc_seq_table_free(table);
+}
+END_TEST
+
 START_TEST(test_no_logging)
 {
   omcache_t *oc = ot_init_omcache(2, LOG_DEBUG);
@@ -68,6 +106,7 @@ Suite *ot_suite_misc(void)
   Suite *s = suite_create("Misc");
   ot_tcase_add(s, test_strerror);
   ot_tcase_add(s, test_md5);
+  ot_tcase_add(s, test_seq_table);
   ot_tcase_add(s, test_no_logging);
   return s;
 }
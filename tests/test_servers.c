@@ -89,6 +89,276 @@ START_TEST(test_distribution)
   check_distribution(oc, 4);
   ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_libmemcached_ketama_pre1010));
   check_distribution(oc, 4);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_jump_hash));
+  check_distribution(oc, 4);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_maglev));
+  check_distribution(oc, 4);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_rendezvous));
+  check_distribution(oc, 4);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_ketama_xxh3));
+  check_distribution(oc, 4);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_ketama_murmur3));
+  check_distribution(oc, 4);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_ketama_crc32c));
+  check_distribution(oc, 4);
+  // the Maglev table also works with a single hash per server
+  omcache_dist_t maglev_xxh3 = omcache_dist_maglev;
+  maglev_xxh3.entries_per_point = 1;
+  maglev_xxh3.point_hash_func = omcache_dist_ketama_xxh3.point_hash_func;
+  ck_omcache_ok(omcache_set_distribution_method(oc, &maglev_xxh3));
+  check_distribution(oc, 4);
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_jump_hash)
+{
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  int before[1000];
+
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_jump_hash));
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1, 127.0.0.1:2, 127.0.0.1:3, 127.0.0.1:4"));
+  for (int i = 0; i < 1000; i ++)
+    before[i] = omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i));
+
+  // adding a server to the end of the list only moves keys to it
+  int moved = 0;
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1, 127.0.0.1:2, 127.0.0.1:3, 127.0.0.1:4, 127.0.0.1:5"));
+  for (int i = 0; i < 1000; i ++)
+    {
+      int si = omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i));
+      if (si != before[i])
+        {
+          ck_assert_int_eq(si, 4);
+          moved ++;
+        }
+    }
+  ck_assert_int_ge(moved, 150);
+  ck_assert_int_le(moved, 250);
+
+  // the same servers give the same mapping as before
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:4, 127.0.0.1:3, 127.0.0.1:2, 127.0.0.1:1"));
+  for (int i = 0; i < 1000; i ++)
+    ck_assert_int_eq(omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i)), before[i]);
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_dist_version)
+{
+  // distribution methods of clients older than 0.4.0 don't have the fields
+  // added in 0.4.0 and always use ketama
+  omcache_dist_t old = omcache_dist_libmemcached_ketama;
+  old.omcache_version = 0x300;
+  old.lookup_func = omcache_dist_jump_hash.lookup_func;
+  const char *servers = "127.0.0.1:1, 127.0.0.1:2, 127.0.0.1:3, 127.0.0.1:4";
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  omcache_t *oc2 = ot_init_omcache(0, LOG_INFO);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &old));
+  ck_omcache_ok(omcache_set_servers(oc, servers));
+  ck_omcache_ok(omcache_set_servers(oc2, servers));
+  for (int i = 0; i < 1000; i ++)
+    ck_assert_int_eq(omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i)),
+                     omcache_server_index_for_key(oc2, (cuc *) &i, sizeof(i)));
+  omcache_free(oc);
+  omcache_free(oc2);
+}
+END_TEST
+
+static void check_same_mapping(omcache_t *oc, omcache_dist_t *dist, const char *servers)
+{
+  omcache_t *fresh = ot_init_omcache(0, LOG_INFO);
+  ck_omcache_ok(omcache_set_distribution_method(fresh, dist));
+  ck_omcache_ok(omcache_set_servers(fresh, servers));
+  for (int i = 0; i < 2000; i ++)
+    ck_assert_int_eq(omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i)),
+                     omcache_server_index_for_key(fresh, (cuc *) &i, sizeof(i)));
+  omcache_free(fresh);
+}
+
+START_TEST(test_ketama_incremental)
+{
+  // the continuum is updated in place when servers are added and removed,
+  // the result must match a continuum built from scratch
+  omcache_dist_t *dists[] = {
+    &omcache_dist_libmemcached_ketama,
+    &omcache_dist_libmemcached_ketama_weighted,
+    &omcache_dist_ketama_xxh3,
+  };
+  char servers[1000];
+  for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d ++)
+    {
+      omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+      ck_omcache_ok(omcache_set_distribution_method(oc, dists[d]));
+      for (int round = 0; round < 4; round ++)
+        {
+          char *p = servers;
+          for (int i = 0; i < 30; i ++)
+            if ((i + round) % 4 != 0)
+              p += sprintf(p, "%s127.0.0.%d:%d", p == servers ? "" : ",", i + 1, 11211 + i);
+          ck_omcache_ok(omcache_set_servers(oc, servers));
+          check_same_mapping(oc, dists[d], servers);
+        }
+      // weighted servers are handled by rebuilding the continuum
+      ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1/2, 127.0.0.2:2, 127.0.0.3:3"));
+      check_same_mapping(oc, dists[d], "127.0.0.1:1/2, 127.0.0.2:2, 127.0.0.3:3");
+      ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1, 127.0.0.2:2, 127.0.0.4:4"));
+      check_same_mapping(oc, dists[d], "127.0.0.1:1, 127.0.0.2:2, 127.0.0.4:4");
+      omcache_free(oc);
+    }
+}
+END_TEST
+
+START_TEST(test_point_hash_cache)
+{
+  // servers keep the point hashes of the last distribution method used,
+  // switching methods and weights must give the same results as a fresh
+  // handle
+  omcache_dist_t *dists[] = {
+    &omcache_dist_libmemcached_ketama,
+    &omcache_dist_libmemcached_ketama_weighted,
+    &omcache_dist_maglev,
+    &omcache_dist_libmemcached_ketama_pre1010,
+    &omcache_dist_rendezvous,
+    &omcache_dist_libmemcached_ketama,
+  };
+  const char *servers = "127.0.0.1:1, 127.0.0.2:2, 127.0.0.3:3, 127.0.0.4:4";
+  const char *weighted = "127.0.0.1:1/3, 127.0.0.2:2, 127.0.0.3:3/2, 127.0.0.4:4";
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  ck_omcache_ok(omcache_set_servers(oc, servers));
+  for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d ++)
+    {
+      ck_omcache_ok(omcache_set_distribution_method(oc, dists[d]));
+      check_same_mapping(oc, dists[d], servers);
+      ck_omcache_ok(omcache_set_servers(oc, weighted));
+      check_same_mapping(oc, dists[d], weighted);
+      ck_omcache_ok(omcache_set_servers(oc, weighted));
+      check_same_mapping(oc, dists[d], weighted);
+      ck_omcache_ok(omcache_set_servers(oc, servers));
+      check_same_mapping(oc, dists[d], servers);
+    }
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_key_hashes)
+{
+  // compare with the reference implementations: XXH3_64bits() truncated to
+  // 32 bits, MurmurHash3_x86_32() with seed 0 and CRC-32C's check value
+  const struct { size_t len; uint32_t hash; } xxh3[] = {
+    { 0, 0x38d394c2 }, { 3, 0x173d005c }, { 8, 0x3575982e }, { 16, 0xd74895d0 },
+    { 100, 0x42fbf926 }, { 200, 0x685f344d }, { 500, 0xf69c5043 },
+  };
+  unsigned char buf[500];
+  for (size_t i = 0; i < sizeof(buf); i ++)
+    buf[i] = i * 31 + 7;
+  for (size_t i = 0; i < sizeof(xxh3) / sizeof(xxh3[0]); i ++)
+    ck_assert_uint_eq(omcache_dist_ketama_xxh3.key_hash_func(buf, xxh3[i].len), xxh3[i].hash);
+  const char *fox = "The quick brown fox jumps over the lazy dog";
+  ck_assert_uint_eq(omcache_dist_ketama_murmur3.key_hash_func((cuc *) fox, strlen(fox)), 0x2e4ff723);
+  ck_assert_uint_eq(omcache_dist_ketama_murmur3.key_hash_func((cuc *) "", 0), 0);
+  ck_assert_uint_eq(omcache_dist_ketama_crc32c.key_hash_func((cuc *) "123456789", 9), 0xe3069283);
+}
+END_TEST
+
+START_TEST(test_rendezvous_weights)
+{
+  // a server with three times the weight of the other gets three times
+  // as many keys
+  const uint32_t seeds[2] = { 0x12345678, 0x9abcdef0 };
+  const float weights[2] = { 1.0, 3.0 };
+  float scores[2];
+  int hits[2] = {0};
+  for (uint32_t i = 0; i < 10000; i ++)
+    {
+      uint32_t key_hash = omcache_dist_rendezvous.key_hash_func((cuc *) &i, sizeof(i));
+      omcache_dist_rendezvous.score_func(key_hash, seeds, weights, 2, scores);
+      ck_assert(scores[0] > 0 && scores[1] > 0);
+      hits[scores[1] > scores[0]] ++;
+    }
+  ck_assert_int_ge(hits[0], 2300);
+  ck_assert_int_le(hits[0], 2700);
+}
+END_TEST
+
+static void check_weights(omcache_t *oc, int min_light, int max_light)
+{
+  int hits[2] = {0};
+  for (int i = 0; i < 4000; i ++)
+    hits[omcache_server_index_for_key(oc, (cuc *) &i, sizeof(i))] ++;
+  ck_assert_int_ge(hits[0], min_light);
+  ck_assert_int_le(hits[0], max_light);
+}
+
+START_TEST(test_server_weights)
+{
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  omcache_server_info_t *sinfo;
+
+  // the second server has three times the weight of the first one
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1, 127.0.0.1:2 / 3"));
+  sinfo = omcache_server_info(oc, 0);
+  // weight is only present in server info of version 0.4.0 and later
+  ck_assert_int_ge(sinfo->omcache_version, 0x400);
+  ck_assert_int_eq(sinfo->port, 1);
+  ck_assert_int_eq(sinfo->weight, 1);
+  ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+  sinfo = omcache_server_info(oc, 1);
+  ck_assert_int_eq(sinfo->port, 2);
+  ck_assert_int_eq(sinfo->weight, 3);
+  ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_libmemcached_ketama));
+  check_weights(oc, 700, 1300);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_libmemcached_ketama_weighted));
+  check_weights(oc, 700, 1300);
+  ck_omcache_ok(omcache_set_distribution_method(oc, &omcache_dist_rendezvous));
+  check_weights(oc, 700, 1300);
+
+  // weights of servers that stay on the list are updated, invalid weights
+  // are replaced with the default weight of 1
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1/x, 127.0.0.1:2/0"));
+  sinfo = omcache_server_info(oc, 1);
+  ck_assert_int_eq(sinfo->weight, 1);
+  ck_omcache_ok(omcache_server_info_free(oc, sinfo));
+  check_weights(oc, 1800, 2200);
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_server_indexes_for_keys)
+{
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  unsigned char *keys[500];
+  size_t key_lens[500], key_order[500];
+  int server_indexes[500];
+
+  for (int i = 0; i < 500; i ++)
+    key_lens[i] = asprintf((char **) &keys[i], "key-%d", i);
+  ck_omcache(omcache_server_indexes_for_keys(oc, (cuc **) keys, key_lens, 500, server_indexes, NULL), OMCACHE_NO_SERVERS);
+
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1, 127.0.0.1:2, 127.0.0.1:3, 127.0.0.1:4, 127.0.0.1:5"));
+  ck_omcache_ok(omcache_server_indexes_for_keys(oc, (cuc **) keys, key_lens, 500, server_indexes, key_order));
+  for (int i = 0; i < 500; i ++)
+    {
+      ck_assert_int_eq(server_indexes[i], omcache_server_index_for_key(oc, keys[i], key_lens[i]));
+      // keys are grouped by server and keep their order within the group
+      if (i > 0)
+        {
+          ck_assert_int_le(server_indexes[key_order[i - 1]], server_indexes[key_order[i]]);
+          if (server_indexes[key_order[i - 1]] == server_indexes[key_order[i]])
+            ck_assert_uint_lt(key_order[i - 1], key_order[i]);
+        }
+    }
+
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1"));
+  ck_omcache_ok(omcache_server_indexes_for_keys(oc, (cuc **) keys, key_lens, 500, server_indexes, key_order));
+  for (int i = 0; i < 500; i ++)
+    {
+      ck_assert_int_eq(server_indexes[i], 0);
+      ck_assert_uint_eq(key_order[i], i);
+      free(keys[i]);
+    }
   omcache_free(oc);
 }
 END_TEST
@@ -207,17 +477,202 @@ START_TEST(test_ipv6)
 }
 END_TEST
 
+#if defined(WITH_EPOLL) || defined(WITH_IO_URING)
+static void ot_check_io_backend(int backend)
+{
+  char *keys[200];
+  size_t key_lens[200];
+  omcache_t *oc = ot_init_omcache(3, LOG_INFO);
+  ck_omcache_ok(omcache_set_io_backend(oc, backend));
+  for (int i = 0; i < 3; i ++)
+    ck_omcache_ok(omcache_noop(oc, i, 1000));
+  ck_omcache_ok(omcache_set_buffering(oc, true));
+  for (int i = 0; i < 200; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "test_io_backends_%d_%d", backend, i);
+      if (i % 2)
+        continue;
+      ck_omcache(OMCACHE_BUFFERED,
+        omcache_set(oc, (cuc *) keys[i], key_lens[i], (cuc *) keys[i], key_lens[i], 0, 0, 0, 0));
+    }
+  ck_omcache_ok(omcache_set_buffering(oc, false));
+  ck_omcache_ok(omcache_io(oc, NULL, NULL, NULL, NULL, 5000));
+
+  // the server list can be changed while the backend is in use
+  ck_omcache_ok(omcache_set_servers(oc, "127.0.0.1:1"));
+  ck_omcache(omcache_noop(oc, 0, 1000), OMCACHE_NO_SERVERS);
+  omcache_free(oc);
+  oc = ot_init_omcache(3, LOG_INFO);
+  ck_omcache_ok(omcache_set_io_backend(oc, backend));
+
+  omcache_value_t values[200];
+  size_t value_count = 200, values_found = 0;
+  omcache_req_t reqs[200];
+  size_t req_count = 200;
+  ck_omcache_ok_or_again(omcache_get_multi(oc, (cuc **) keys, key_lens, 200, reqs, &req_count, values, &value_count, 5000));
+  values_found = value_count;
+  while (req_count > 0)
+    {
+      value_count = 200;
+      ck_omcache_ok_or_again(omcache_io(oc, reqs, &req_count, values, &value_count, 5000));
+      values_found += value_count;
+    }
+  ck_assert_int_eq(values_found, 100);
+
+  // requests sent without waiting for the response are delivered
+  ck_omcache(omcache_delete(oc, (cuc *) keys[0], key_lens[0], 0), OMCACHE_BUFFERED);
+  ck_omcache(omcache_get(oc, (cuc *) keys[0], key_lens[0], NULL, NULL, NULL, NULL, 1000), OMCACHE_NOT_FOUND);
+
+  // switching back to poll keeps the existing connections
+  ck_omcache_ok(omcache_set_io_backend(oc, OMCACHE_IO_POLL));
+  ck_omcache_ok(omcache_get(oc, (cuc *) keys[2], key_lens[2], NULL, NULL, NULL, NULL, 1000));
+  for (int i = 0; i < 200; i ++)
+    free(keys[i]);
+  omcache_free(oc);
+}
+#endif
+
+START_TEST(test_io_backends)
+{
+  omcache_t *oc = ot_init_omcache(0, LOG_INFO);
+  ck_omcache(omcache_set_io_backend(oc, 42), OMCACHE_INVALID);
+#ifdef WITH_EPOLL
+  ot_check_io_backend(OMCACHE_IO_EPOLL);
+#else
+  ck_omcache(omcache_set_io_backend(oc, OMCACHE_IO_EPOLL), OMCACHE_INVALID);
+#endif // WITH_EPOLL
+#ifdef WITH_IO_URING
+  // io_uring may be unavailable at runtime
+  if (omcache_set_io_backend(oc, OMCACHE_IO_URING) == OMCACHE_OK)
+    ot_check_io_backend(OMCACHE_IO_URING);
+#else
+  ck_omcache(omcache_set_io_backend(oc, OMCACHE_IO_URING), OMCACHE_INVALID);
+#endif // WITH_IO_URING
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_connections_per_server)
+{
+  omcache_t *oc = ot_init_omcache(2, LOG_INFO);
+  char *keys[100];
+  size_t key_lens[100];
+
+  ck_omcache(omcache_set_connections_per_server(oc, 0), OMCACHE_INVALID);
+  ck_omcache(omcache_set_connections_per_server(oc, 65), OMCACHE_INVALID);
+  ck_omcache_ok(omcache_set_connections_per_server(oc, 4));
+  for (int i = 0; i < 100; i ++)
+    {
+      key_lens[i] = asprintf(&keys[i], "conn-test-%d", i);
+      ck_omcache_ok(omcache_set(oc, (cuc *) keys[i], key_lens[i], (cuc *) keys[i], key_lens[i], 0, 0, 0, 1000));
+    }
+
+  omcache_value_t values[100];
+  size_t value_count = 100, values_found = 0;
+  omcache_req_t reqs[100];
+  size_t req_count = 100;
+  ck_omcache_ok_or_again(omcache_get_multi(oc, (cuc **) keys, key_lens, 100, reqs, &req_count, values, &value_count, 5000));
+  values_found = value_count;
+  while (req_count > 0)
+    {
+      value_count = 100;
+      ck_omcache_ok_or_again(omcache_io(oc, reqs, &req_count, values, &value_count, 5000));
+      values_found += value_count;
+    }
+  ck_assert_int_eq(values_found, 100);
+
+  // server indexes stay logical, the connections are not visible
+  omcache_server_info_t *info = omcache_server_info(oc, 1);
+  ck_assert_ptr_ne(info, NULL);
+  omcache_server_info_free(oc, info);
+  ck_assert_ptr_eq(omcache_server_info(oc, 2), NULL);
+
+  // shrinking the pool and changing the server list keeps things working
+  ck_omcache_ok(omcache_set_connections_per_server(oc, 1));
+  ck_omcache_ok(omcache_get(oc, (cuc *) keys[1], key_lens[1], NULL, NULL, NULL, NULL, 1000));
+  ck_omcache_ok(omcache_set_connections_per_server(oc, 3));
+  char srvstr[64];
+  sprintf(srvstr, "127.0.0.1:%d", ot_get_memcached(0));
+  ck_omcache_ok(omcache_set_servers(oc, srvstr));
+  for (int i = 0; i < 10; i ++)
+    ck_omcache_ok(omcache_noop(oc, 0, 1000));
+  for (int i = 0; i < 100; i ++)
+    free(keys[i]);
+  omcache_free(oc);
+}
+END_TEST
+
+START_TEST(test_connection_ordering)
+{
+  // all requests for a key go to the same connection so a read sent after
+  // a buffered or unacknowledged write of the key sees the new value
+  omcache_t *oc = ot_init_omcache(1, LOG_INFO);
+  const unsigned char *data;
+  size_t key_len, val_len, data_len;
+  char key[64], val[64];
+  int nfds, poll_timeout;
+
+  ck_omcache_ok(omcache_set_connections_per_server(oc, 4));
+  for (int i = 0; i < 100; i ++)
+    {
+      key_len = sprintf(key, "conn-order-%d", i);
+      ck_omcache_ok(omcache_set(oc, (cuc *) key, key_len, (cuc *) "old", 3, 0, 0, 0, 1000));
+    }
+  ck_omcache_ok(omcache_set_buffering(oc, true));
+  for (int i = 0; i < 100; i ++)
+    {
+      key_len = sprintf(key, "conn-order-%d", i);
+      val_len = sprintf(val, "buffered-%d", i);
+      ck_omcache(omcache_set(oc, (cuc *) key, key_len, (cuc *) val, val_len, 0, 0, 0, 0), OMCACHE_BUFFERED);
+    }
+  // the writes are spread over more than one connection
+  omcache_poll_fds(oc, &nfds, &poll_timeout);
+  ck_assert_int_ge(nfds, 2);
+  ck_omcache_ok(omcache_set_buffering(oc, false));
+  for (int i = 0; i < 100; i ++)
+    {
+      key_len = sprintf(key, "conn-order-%d", i);
+      val_len = sprintf(val, "buffered-%d", i);
+      ck_omcache_ok(omcache_get(oc, (cuc *) key, key_len, &data, &data_len, NULL, NULL, 1000));
+      ck_assert_int_eq(data_len, val_len);
+      ck_assert(memcmp(data, val, val_len) == 0);
+    }
+  // zero timeout writes interleaved with reads of the same keys
+  for (int i = 0; i < 100; i ++)
+    {
+      key_len = sprintf(key, "conn-order-%d", i);
+      val_len = sprintf(val, "unacked-%d", i);
+      ck_omcache(omcache_set(oc, (cuc *) key, key_len, (cuc *) val, val_len, 0, 0, 0, 0), OMCACHE_BUFFERED);
+      ck_omcache_ok(omcache_get(oc, (cuc *) key, key_len, &data, &data_len, NULL, NULL, 1000));
+      ck_assert_int_eq(data_len, val_len);
+      ck_assert(memcmp(data, val, val_len) == 0);
+    }
+  omcache_free(oc);
+}
+END_TEST
+
 Suite *ot_suite_servers(void)
 {
   Suite *s = suite_create("Servers");
 
   ot_tcase_add(s, test_server_list);
   ot_tcase_add(s, test_distribution);
+  ot_tcase_add(s, test_server_indexes_for_keys);
+  ot_tcase_add(s, test_jump_hash);
+  ot_tcase_add(s, test_dist_version);
+  ot_tcase_add(s, test_ketama_incremental);
+  ot_tcase_add(s, test_point_hash_cache);
+  ot_tcase_add(s, test_key_hashes);
+  ot_tcase_add(s, test_rendezvous_weights);
+  ot_tcase_add(s, test_server_weights);
   ot_tcase_add(s, test_no_servers);
   ot_tcase_add(s, test_invalid_servers);
   ot_tcase_add(s, test_multiple_times_same_server);
   ot_tcase_add(s, test_fd_map_allocations);
   ot_tcase_add(s, test_ipv6);
+  ot_tcase_add(s, test_io_backends);
+  ot_tcase_add(s, test_connections_per_server);
+  ot_tcase_add(s, test_connection_ordering);
 
   return s;
 }
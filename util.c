@@ -115,3 +115,91 @@ void *omc_hash_table_del(omc_hash_table_t *hash, uint32_t key)
     }
   return hash->not_found_val;
 }
+
+// direct-indexed table for keys allocated from a contiguous sequence, slot
+// 'key - base' holds the value for 'key' and a bitmap tracks occupied slots
+omc_seq_table_t *omc_seq_table_init(omc_seq_table_t *old_table, uint32_t base, uint32_t size)
+{
+  omc_seq_table_t *table = old_table;
+  uint32_t words = (size + 63) / 64;
+  // reuse old table if one was given and the size is right
+  if (table == NULL || table->size < size)
+    {
+      omc_seq_table_free(old_table);
+      // allocate the table, the bitmap and the values in a single allocation
+      size = words * 64;
+      table = malloc(sizeof(omc_seq_table_t) + words * sizeof(uint64_t) + size * sizeof(void *));
+      table->size = size;
+      table->bitmap = (uint64_t *) (table + 1);
+      table->vals = (void **) (table->bitmap + words);
+      memset(table->bitmap, 0, words * sizeof(uint64_t));
+    }
+  else
+    {
+      // only the words that may have been used since the previous reset
+      // need to be cleared
+      uint32_t used = (table->used + 63) / 64;
+      memset(table->bitmap, 0, used * sizeof(uint64_t));
+    }
+  table->base = base;
+  table->count = 0;
+  table->used = 0;
+  return table;
+}
+
+void omc_seq_table_free(omc_seq_table_t *table)
+{
+  free(table);
+}
+
+void *omc_seq_table_find(omc_seq_table_t *table, uint32_t key)
+{
+  uint32_t idx = key - table->base;
+  if (idx >= table->used || !(table->bitmap[idx / 64] & (1ULL << (idx % 64))))
+    return NULL;
+  return table->vals[idx];
+}
+
+int omc_seq_table_add(omc_seq_table_t *table, uint32_t key, void *val)
+{
+  uint32_t idx = key - table->base;
+  if (idx >= table->size)
+    return -1;
+  if (!(table->bitmap[idx / 64] & (1ULL << (idx % 64))))
+    table->count ++;
+  table->bitmap[idx / 64] |= 1ULL << (idx % 64);
+  table->vals[idx] = val;
+  if (idx >= table->used)
+    table->used = idx + 1;
+  return 0;
+}
+
+void *omc_seq_table_del(omc_seq_table_t *table, uint32_t key)
+{
+  void *val = omc_seq_table_find(table, key);
+  if (val == NULL)
+    return NULL;
+  uint32_t idx = key - table->base;
+  table->bitmap[idx / 64] &= ~(1ULL << (idx % 64));
+  table->count --;
+  return val;
+}
+
+// return the key of the first occupied slot at or after 'key' or the key
+// following the last slot if no such slot exists
+uint32_t omc_seq_table_next(omc_seq_table_t *table, uint32_t key)
+{
+  uint32_t idx = key - table->base;
+  if (idx >= table->used)
+    return table->base + table->used;
+  uint32_t word = idx / 64;
+  uint64_t bits = table->bitmap[word] & (~0ULL << (idx % 64));
+  while (bits == 0)
+    {
+      if (++ word * 64 >= table->used)
+        return table->base + table->used;
+      bits = table->bitmap[word];
+    }
+  idx = word * 64 + omc_ctz64(bits);
+  return table->base + idx;
+}